@@ -0,0 +1,626 @@
+// bsonarray.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#endif
+
+namespace microbson {
+namespace detail {
+/**\brief layout of array where all items have same fixed-width type and keys
+ * are shortest decimal indexes. Such array consists of runs with fixed stride:
+ * stride changes only when index gains a digit
+ */
+struct ArrayLayout {
+  bson::NodeType type;
+  int            width;
+  int            count;
+};
+
+/**\return width of value of the type, or -1 if values have different length
+ */
+constexpr int fixedWidth(bson::NodeType type) noexcept {
+  switch (type) {
+  case bson::double_node:
+    return SIZE_OF_DOUBLE_VALUE;
+  case bson::int32_node:
+    return SIZE_OF_INT32_VALUE;
+  case bson::int64_node:
+    return SIZE_OF_INT64_VALUE;
+  case bson::boolean_node:
+    return SIZE_OF_BOOLEAN_VALUE;
+  case bson::null_node:
+    return SIZE_OF_NULL_VALUE;
+  case bson::objectid_node:
+    return SIZE_OF_OBJECTID_VALUE;
+  case bson::datetime_node:
+    return SIZE_OF_DATETIME_VALUE;
+  case bson::timestamp_node:
+    return SIZE_OF_TIMESTAMP_VALUE;
+  case bson::decimal128_node:
+    return SIZE_OF_DECIMAL128_VALUE;
+  default:
+    return -1;
+  }
+}
+
+/**\brief call `func(values, stride, count)` for every run of items with same
+ * stride, where `values` is pointer to value of first item of the run
+ */
+template <class Function>
+void forEachRun(const byte *data, int width, int count, Function func) noexcept(
+    noexcept(func(data, 0, 0))) {
+  const byte *item   = data + SIZE_OF_BSON_SIZE;
+  int         digits = 1;
+  int64_t     group  = 10; // count of indexes with same count of digits
+  for (int index = 0; index < count;) {
+    int runCount = std::min<int64_t>(group, count - index);
+    int stride   = SIZE_OF_BSON_TYPE + digits + SIZE_OF_ZERO_BYTE + width;
+    func(item + SIZE_OF_BSON_TYPE + digits + SIZE_OF_ZERO_BYTE,
+         stride,
+         runCount);
+
+    item += runCount * stride;
+    index += runCount;
+    group = digits == 1 ? 90 : group * 10;
+    ++digits;
+  }
+}
+
+/**\brief check that the key is decimal representation of the index
+ * \param length count of digits in the index
+ */
+inline bool isIndexKey(const byte *key, size_t length, size_t index) noexcept {
+  for (size_t i = length; i > 0; --i, index /= 10) {
+    if (key[i - 1] != '0' + index % 10) {
+      return false;
+    }
+  }
+  return index == 0;
+}
+
+/**\brief detect homogeneous array. Count of items is computed from length of
+ * the array, after that type bytes and ends of keys are checked by the strides
+ * \param arr valid bson array, @see Document::valid
+ * \return false if the array is empty, has items of different types, or keys
+ * of items are not shortest decimal indexes of the items
+ */
+inline bool homogeneous(Array arr, ArrayLayout &layout) noexcept {
+  if (arr.empty() || arr.length() == MINIMAL_SIZE_OF_BSON_DOCUMENT) {
+    return false;
+  }
+
+  const byte    *data  = reinterpret_cast<const byte *>(arr.data());
+  bson::NodeType type  = static_cast<bson::NodeType>(data[SIZE_OF_BSON_SIZE]);
+  int            width = fixedWidth(type);
+  if (width < 0) {
+    return false;
+  }
+
+  int64_t rest   = arr.length() - (MINIMAL_SIZE_OF_BSON_DOCUMENT);
+  int     count  = 0;
+  int     digits = 1;
+  int64_t group  = 10;
+  for (;;) {
+    int stride = SIZE_OF_BSON_TYPE + digits + SIZE_OF_ZERO_BYTE + width;
+    if (rest <= group * stride) {
+      if (rest % stride != 0) {
+        return false;
+      }
+      count += rest / stride;
+      break;
+    }
+
+    rest -= group * stride;
+    count += group;
+    group = digits == 1 ? 90 : group * 10;
+    ++digits;
+  }
+
+  bool   valid    = true;
+  size_t index    = 0;
+  auto   checkRun = [type, width, &valid, &index](const byte *values,
+                                                int         stride,
+                                                int         runCount) {
+    int keyLength = stride - width - SIZE_OF_BSON_TYPE - SIZE_OF_ZERO_BYTE;
+    for (int i = 0; i < runCount && valid; ++i, ++index) {
+      const byte *key = values + i * stride - SIZE_OF_ZERO_BYTE - keyLength;
+
+      valid = key[-SIZE_OF_BSON_TYPE] == type && key[keyLength] == '\0' &&
+              isIndexKey(key, keyLength, index);
+    }
+  };
+  forEachRun(data, width, count, checkRun);
+  if (!valid) {
+    return false;
+  }
+
+  layout = ArrayLayout{type, width, count};
+  return true;
+}
+
+template <class T>
+T load(const byte *ptr) noexcept {
+  T retval;
+  std::memcpy(&retval, ptr, sizeof(T));
+  return retval;
+}
+
+struct NumberReduce {
+  double  sum = 0;
+  int64_t integerSum = 0;
+  double  min = std::numeric_limits<double>::infinity();
+  double  max = -std::numeric_limits<double>::infinity();
+};
+
+/**\brief add the value to exact integer sum. On overflow the integer sum is
+ * moved to floating point sum
+ */
+inline void addInteger(NumberReduce &reduce, int64_t val) noexcept {
+  int64_t sum = reduce.integerSum;
+  if (val > 0 ? sum > std::numeric_limits<int64_t>::max() - val
+              : sum < std::numeric_limits<int64_t>::min() - val) {
+    reduce.sum += double(std::exchange(sum, 0));
+  }
+  reduce.integerSum = sum + val;
+}
+
+template <class T>
+void reduceScalar(const byte   *values,
+                  int           stride,
+                  int           count,
+                  NumberReduce &reduce) noexcept {
+  for (int i = 0; i < count; ++i) {
+    T val = load<T>(values + i * stride);
+    if constexpr (std::is_floating_point<T>::value) {
+      reduce.sum += val;
+    } else {
+      addInteger(reduce, val);
+    }
+    reduce.min = std::min<double>(reduce.min, val);
+    reduce.max = std::max<double>(reduce.max, val);
+  }
+}
+
+#if defined(__AVX2__)
+inline void
+reduceDoubles(const byte *values, int stride, int count, NumberReduce &reduce) {
+  const __m256i offsets =
+      _mm256_set_epi64x(3 * stride, 2 * stride, stride, 0);
+  __m256d sum = _mm256_setzero_pd();
+  __m256d min = _mm256_set1_pd(reduce.min);
+  __m256d max = _mm256_set1_pd(reduce.max);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d val = _mm256_i64gather_pd(
+        reinterpret_cast<const double *>(values + i * stride), offsets, 1);
+    sum = _mm256_add_pd(sum, val);
+    min = _mm256_min_pd(min, val);
+    max = _mm256_max_pd(max, val);
+  }
+
+  alignas(32) double lanes[3][4];
+  _mm256_store_pd(lanes[0], sum);
+  _mm256_store_pd(lanes[1], min);
+  _mm256_store_pd(lanes[2], max);
+  for (int lane = 0; lane < 4; ++lane) {
+    reduce.sum += lanes[0][lane];
+    reduce.min = std::min(reduce.min, lanes[1][lane]);
+    reduce.max = std::max(reduce.max, lanes[2][lane]);
+  }
+
+  reduceScalar<double>(values + i * stride, stride, count - i, reduce);
+}
+
+inline void
+reduceInt32(const byte *values, int stride, int count, NumberReduce &reduce) {
+  const __m256i offsets = _mm256_set_epi32(7 * stride,
+                                           6 * stride,
+                                           5 * stride,
+                                           4 * stride,
+                                           3 * stride,
+                                           2 * stride,
+                                           stride,
+                                           0);
+  __m256i sum = _mm256_setzero_si256();
+  __m256i min = _mm256_set1_epi32(std::numeric_limits<int32_t>::max());
+  __m256i max = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i val = _mm256_i32gather_epi32(
+        reinterpret_cast<const int *>(values + i * stride), offsets, 1);
+    // sum in 64-bit lanes for avoid overflow
+    sum = _mm256_add_epi64(
+        sum,
+        _mm256_add_epi64(
+            _mm256_cvtepi32_epi64(_mm256_castsi256_si128(val)),
+            _mm256_cvtepi32_epi64(_mm256_extracti128_si256(val, 1))));
+    min = _mm256_min_epi32(min, val);
+    max = _mm256_max_epi32(max, val);
+  }
+
+  if (i != 0) {
+    alignas(32) int64_t sums[4];
+    alignas(32) int32_t lanes[2][8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(sums), sum);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[0]), min);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[1]), max);
+    for (int lane = 0; lane < 4; ++lane) {
+      addInteger(reduce, sums[lane]);
+    }
+    for (int lane = 0; lane < 8; ++lane) {
+      reduce.min = std::min<double>(reduce.min, lanes[0][lane]);
+      reduce.max = std::max<double>(reduce.max, lanes[1][lane]);
+    }
+  }
+
+  reduceScalar<int32_t>(values + i * stride, stride, count - i, reduce);
+}
+
+inline void
+reduceInt64(const byte *values, int stride, int count, NumberReduce &reduce) {
+  const __m256i offsets =
+      _mm256_set_epi64x(3 * stride, 2 * stride, stride, 0);
+  __m256i sum = _mm256_setzero_si256();
+  __m256i min = _mm256_set1_epi64x(std::numeric_limits<int64_t>::max());
+  __m256i max = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+
+  __m256i overflow = _mm256_setzero_si256();
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i val = _mm256_i64gather_epi64(
+        reinterpret_cast<const long long *>(values + i * stride), offsets, 1);
+    // sign bit of lane is set on overflow: both operands have other sign
+    // than the result
+    __m256i next = _mm256_add_epi64(sum, val);
+    overflow     = _mm256_or_si256(
+        overflow,
+        _mm256_and_si256(_mm256_xor_si256(sum, next),
+                         _mm256_xor_si256(val, next)));
+    sum = next;
+    min = _mm256_blendv_epi8(min, val, _mm256_cmpgt_epi64(min, val));
+    max = _mm256_blendv_epi8(max, val, _mm256_cmpgt_epi64(val, max));
+  }
+
+  if (i != 0) {
+    alignas(32) int64_t lanes[3][4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[0]), sum);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[1]), min);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[2]), max);
+    bool wrapped = _mm256_movemask_pd(_mm256_castsi256_pd(overflow)) != 0;
+    for (int lane = 0; lane < 4; ++lane) {
+      if (!wrapped) {
+        addInteger(reduce, lanes[0][lane]);
+      }
+      reduce.min = std::min<double>(reduce.min, lanes[1][lane]);
+      reduce.max = std::max<double>(reduce.max, lanes[2][lane]);
+    }
+    // sums of lanes are wrapped, so values are summed again one by one
+    for (int j = 0; wrapped && j < i; ++j) {
+      addInteger(reduce, load<int64_t>(values + j * stride));
+    }
+  }
+
+  reduceScalar<int64_t>(values + i * stride, stride, count - i, reduce);
+}
+#else
+inline void reduceDoubles(const byte   *values,
+                          int           stride,
+                          int           count,
+                          NumberReduce &reduce) noexcept {
+  reduceScalar<double>(values, stride, count, reduce);
+}
+
+inline void reduceInt32(const byte   *values,
+                        int           stride,
+                        int           count,
+                        NumberReduce &reduce) noexcept {
+  reduceScalar<int32_t>(values, stride, count, reduce);
+}
+
+inline void reduceInt64(const byte   *values,
+                        int           stride,
+                        int           count,
+                        NumberReduce &reduce) noexcept {
+  reduceScalar<int64_t>(values, stride, count, reduce);
+}
+#endif
+} // namespace detail
+
+/**\brief result of aggregation of numeric array. For empty array min and max
+ * are NaN
+ */
+struct Aggregate {
+  double sum   = 0;
+  double min   = std::numeric_limits<double>::quiet_NaN();
+  double max   = std::numeric_limits<double>::quiet_NaN();
+  size_t count = 0;
+
+  [[nodiscard]] double mean() const noexcept {
+    return count ? sum / count : std::numeric_limits<double>::quiet_NaN();
+  }
+};
+
+/**\brief compute sum, min, max and count of numeric array. If all items of the
+ * array have same type (double, int32 or int64), then values are read by runs
+ * with fixed stride (by SIMD gather, if AVX2 is available), otherwise every
+ * item is read as bson::Scalar. Integer values of homogeneous arrays are
+ * summed as int64 while the sum fits in it, so order of addition of doubles
+ * can differ from order of items
+ * \param arr valid bson array, @see Document::valid
+ * \throw bson::BadCast if some item is not a number
+ * \warning min and max are unspecified if array contains NaN
+ */
+inline Aggregate aggregate(Array arr) noexcept(false) {
+  Aggregate retval;
+
+  detail::ArrayLayout layout;
+  if (detail::homogeneous(arr, layout)) {
+    detail::NumberReduce reduce;
+    const byte          *data = reinterpret_cast<const byte *>(arr.data());
+    switch (layout.type) {
+    case bson::double_node:
+      detail::forEachRun(data,
+                         layout.width,
+                         layout.count,
+                         [&reduce](const byte *values, int stride, int count) {
+                           detail::reduceDoubles(values, stride, count, reduce);
+                         });
+      break;
+    case bson::int32_node:
+      detail::forEachRun(data,
+                         layout.width,
+                         layout.count,
+                         [&reduce](const byte *values, int stride, int count) {
+                           detail::reduceInt32(values, stride, count, reduce);
+                         });
+      break;
+    case bson::int64_node:
+      detail::forEachRun(data,
+                         layout.width,
+                         layout.count,
+                         [&reduce](const byte *values, int stride, int count) {
+                           detail::reduceInt64(values, stride, count, reduce);
+                         });
+      break;
+    default:
+      throw bson::BadCast{};
+    }
+
+    retval.sum   = reduce.sum + reduce.integerSum;
+    retval.min   = reduce.min;
+    retval.max   = reduce.max;
+    retval.count = layout.count;
+    return retval;
+  }
+
+  for (Node node : arr) {
+    double val = node.value<bson::Scalar>();
+    if (retval.count == 0) {
+      retval.min = val;
+      retval.max = val;
+    } else {
+      retval.min = std::min(retval.min, val);
+      retval.max = std::max(retval.max, val);
+    }
+    retval.sum += val;
+    ++retval.count;
+  }
+  return retval;
+}
+
+namespace detail {
+template <class T>
+constexpr void checkDecodable() noexcept {
+  static_assert(fixedWidth(static_cast<bson::NodeType>(
+                    type_traits<T>::node_type_code)) > 0,
+                "only fixed-width types (double, int32, int64, bool, ObjectId, "
+                "DateTime, Timestamp, Decimal128) can be decoded");
+}
+
+template <class T>
+typename type_traits<T>::return_type decodeValue(const byte *ptr) noexcept {
+  using value_type = typename type_traits<T>::value_type;
+  if constexpr (std::is_same<value_type, bool>::value) {
+    return *ptr != 0;
+  } else {
+    return static_cast<typename type_traits<T>::return_type>(
+        load<value_type>(ptr));
+  }
+}
+
+/**\brief decode all items of the array by one loop. Length of key of every
+ * item is known from its index, so keys are not scanned (except keys, which
+ * are not shortest decimal indexes)
+ * \param push function, which is called for every decoded value
+ * \throw bson::BadCast on first item of other type
+ */
+template <class T, class Function>
+void decodeItems(Array arr, Function push) noexcept(false) {
+  constexpr bson::NodeType type =
+      static_cast<bson::NodeType>(type_traits<T>::node_type_code);
+  constexpr int width = fixedWidth(type);
+
+  if (arr.empty()) {
+    return;
+  }
+
+  const byte *item   = reinterpret_cast<const byte *>(arr.data()) +
+                     SIZE_OF_BSON_SIZE;
+  const byte *end    = reinterpret_cast<const byte *>(arr.data()) +
+                    arr.length() - SIZE_OF_ZERO_BYTE;
+  size_t      digits = 1;
+  size_t      bound  = 10; // first index with one more digit
+  for (size_t index = 0; item < end; ++index) {
+    if (*item != type) {
+      throw bson::BadCast{};
+    }
+
+    if (index == bound) {
+      ++digits;
+      bound *= 10;
+    }
+
+    size_t keyLength = digits;
+    if (item[SIZE_OF_BSON_TYPE + keyLength] != '\0' ||
+        !isIndexKey(item + SIZE_OF_BSON_TYPE, keyLength, index)) {
+      keyLength = std::strlen(reinterpret_cast<const char *>(item) +
+                              SIZE_OF_BSON_TYPE);
+    }
+
+    const byte *value =
+        item + SIZE_OF_BSON_TYPE + keyLength + SIZE_OF_ZERO_BYTE;
+    push(decodeValue<T>(value));
+    item = value + width;
+  }
+}
+} // namespace detail
+
+/**\brief decode array of fixed-width values (double, int32, int64, bool,
+ * ObjectId, DateTime, Timestamp or Decimal128) in the buffer
+ * \param arr valid bson array, @see Document::valid
+ * \return count of decoded items
+ * \throw bson::BadCast on first item of other type, bson::OutOfRange if the
+ * array has more items then size of the buffer. In case of exception the
+ * buffer contains all items before wrong one
+ */
+template <class T>
+size_t decode(Array arr, T *out, size_t size) noexcept(false) {
+  detail::checkDecodable<T>();
+
+  size_t count = 0;
+  detail::decodeItems<T>(arr, [out, size, &count](T val) {
+    if (count == size) {
+      throw bson::OutOfRange{"buffer is too small for the array"};
+    }
+    out[count++] = val;
+  });
+  return count;
+}
+
+/**\brief append decoded items of array to the vector. For homogeneous arrays
+ * memory is reserved once and values are copied by runs without checks
+ * \throw bson::BadCast on first item of other type
+ */
+template <class T>
+void decode(Array arr, std::vector<T> &out) noexcept(false) {
+  detail::checkDecodable<T>();
+
+  detail::ArrayLayout layout;
+  if (detail::homogeneous(arr, layout) &&
+      layout.type == type_traits<T>::node_type_code) {
+    size_t offset = out.size();
+    out.resize(offset + layout.count);
+
+    auto ptr = out.begin() + offset;
+    detail::forEachRun(reinterpret_cast<const byte *>(arr.data()),
+                       layout.width,
+                       layout.count,
+                       [&ptr](const byte *values, int stride, int count) {
+                         for (int i = 0; i < count; ++i) {
+                           *ptr++ = detail::decodeValue<T>(values + i * stride);
+                         }
+                       });
+    return;
+  }
+
+  detail::decodeItems<T>(arr, [&out](T val) { out.push_back(val); });
+}
+
+template <class T>
+std::vector<T> decode(Array arr) noexcept(false) {
+  std::vector<T> retval;
+  decode(arr, retval);
+  return retval;
+}
+
+/**\brief zero-copy view over homogeneous array of fixed-width values. Values
+ * are read directly from serialized array by runs with fixed stride
+ */
+template <class T>
+class StridedView final {
+public:
+  using value_type = typename type_traits<T>::return_type;
+
+  StridedView() noexcept = default;
+
+  /**\param arr valid bson array, @see Document::valid
+   * \throw bson::BadCast if the array is not homogeneous array of values of
+   * type T
+   */
+  explicit StridedView(Array arr) noexcept(false) {
+    detail::checkDecodable<T>();
+
+    detail::ArrayLayout layout;
+    if (arr.empty() || arr.length() == MINIMAL_SIZE_OF_BSON_DOCUMENT) {
+      return;
+    }
+    if (!detail::homogeneous(arr, layout) ||
+        layout.type != type_traits<T>::node_type_code) {
+      throw bson::BadCast{};
+    }
+
+    size_ = layout.count;
+    detail::forEachRun(reinterpret_cast<const byte *>(arr.data()),
+                       layout.width,
+                       layout.count,
+                       [this](const byte *values, int stride, int) {
+                         runs_[runCount_++] = Run{values, stride};
+                       });
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return size_; }
+
+  [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+
+  /**\warning index is not checked
+   */
+  value_type operator[](size_t i) const noexcept {
+    // first run has 10 items, every next - in 10 times more then previous
+    size_t run   = 0;
+    size_t first = 0;
+    size_t bound = 10;
+    while (i >= bound) {
+      first = bound;
+      bound *= 10;
+      ++run;
+    }
+    return detail::decodeValue<T>(runs_[run].values +
+                                  (i - first) * runs_[run].stride);
+  }
+
+  /**\throw bson::OutOfRange if index is out of range
+   */
+  value_type at(size_t i) const noexcept(false) {
+    if (i >= size_) {
+      throw bson::OutOfRange{"index out of range"};
+    }
+    return (*this)[i];
+  }
+
+private:
+  struct Run {
+    const byte *values;
+    int         stride;
+  };
+
+  /**\brief array length is int, so items can not have more then 10 digits
+   */
+  Run    runs_[10]{};
+  int    runCount_ = 0;
+  size_t size_     = 0;
+};
+} // namespace microbson
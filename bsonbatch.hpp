@@ -0,0 +1,613 @@
+// bsonbatch.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include "minibson.hpp"
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#endif
+
+#define BSON_BATCH_MAGIC "BSONBAT1"
+#define BSON_BATCH_INDEX_MAGIC "BSONIDX1"
+#define SIZE_OF_BSON_BATCH_MAGIC 8
+#define SIZE_OF_BSON_BATCH_BLOCK_HEADER 8 // length + checksum
+#define SIZE_OF_BSON_BATCH_TAIL 28        // offset + count + checksum + magic
+
+namespace bson {
+/**\brief error of operating system, contains errno code
+ */
+class SystemError final
+    : virtual public Exception
+    , virtual public std::system_error {
+public:
+  using std::system_error::system_error;
+
+  [[nodiscard]] const char *what() const noexcept override {
+    return std::system_error::what();
+  }
+};
+} // namespace bson
+
+namespace microbson {
+namespace detail {
+inline const uint32_t *crc32cTable() noexcept {
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> retval{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+      }
+      retval[i] = crc;
+    }
+    return retval;
+  }();
+  return table.data();
+}
+
+[[noreturn]] inline void throwSystemError(const std::string &what) {
+  throw bson::SystemError{errno, std::generic_category(), what};
+}
+
+inline void writeAll(int fd, const byte *data, size_t length) {
+  while (length != 0) {
+    ssize_t written = ::write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throwSystemError("can not write batch file");
+    }
+    data += written;
+    length -= written;
+  }
+}
+
+/**\brief read-only mapping of whole file
+ */
+class MappedFile final {
+public:
+  explicit MappedFile(int fd) noexcept(false)
+      : data_{nullptr}
+      , size_{0} {
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+      throwSystemError("can not stat batch file");
+    }
+    size_ = info.st_size;
+    if (size_ == 0) {
+      return;
+    }
+
+    void *mapped = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+      throwSystemError("can not map batch file");
+    }
+    data_ = reinterpret_cast<const byte *>(mapped);
+  }
+
+  ~MappedFile() noexcept {
+    if (data_) {
+      ::munmap(const_cast<byte *>(data_), size_);
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  [[nodiscard]] const byte *data() const noexcept { return data_; }
+  [[nodiscard]] size_t      size() const noexcept { return size_; }
+
+private:
+  const byte *data_;
+  size_t      size_;
+};
+} // namespace detail
+
+/**\brief CRC32C (Castagnoli) checksum, computed by SSE4.2 instructions if they
+ * are available
+ * \param crc checksum of previous part of data
+ */
+inline uint32_t
+crc32c(const void *data, size_t length, uint32_t crc = 0) noexcept {
+  const byte *current = reinterpret_cast<const byte *>(data);
+  crc                 = ~crc;
+#if defined(__SSE4_2__)
+  uint64_t crc64 = crc;
+  for (; length >= 8; length -= 8, current += 8) {
+    uint64_t word;
+    std::memcpy(&word, current, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = uint32_t(crc64);
+  for (; length != 0; --length, ++current) {
+    crc = _mm_crc32_u8(crc, *current);
+  }
+#else
+  const uint32_t *table = detail::crc32cTable();
+  for (; length != 0; --length, ++current) {
+    crc = (crc >> 8) ^ table[(crc ^ *current) & 0xFF];
+  }
+#endif
+  return ~crc;
+}
+
+/**\brief writes documents in batch file. Every document is written as block:
+ * length of the document, CRC32C checksum of the document and the document
+ * itself. When the writer is closed, index footer with offsets of all blocks is
+ * written at end of the file, so documents can be read by record numbers
+ * without scanning.
+ *
+ * Blocks are buffered and written by big chunks, @see flush. Offsets of blocks
+ * are kept in memory until the writer is closed.
+ *
+ * Usage:
+ * ```
+ * microbson::BatchWriter writer{"data.bsonbatch"};
+ * size_t recordNumber = writer.append(doc);
+ * writer.close();
+ * ```
+ */
+class BatchWriter final {
+public:
+  enum Mode {
+    /**\brief create new file or truncate existing
+     */
+    truncate_mode,
+    /**\brief create new file or continue existing. Index footer of existing
+     * file is removed until the writer is closed. If the file was not closed
+     * properly, it is truncated to end of the last valid block
+     */
+    append_mode,
+  };
+
+  /**\throw bson::SystemError if can not open the file
+   * \throw bson::InvalidArgument if existing file is not batch file
+   */
+  explicit BatchWriter(const std::string &path,
+                       Mode               mode = truncate_mode) noexcept(false);
+
+  /**\brief closes the writer, errors are ignored
+   */
+  ~BatchWriter() noexcept;
+
+  BatchWriter(const BatchWriter &) = delete;
+  BatchWriter &operator=(const BatchWriter &) = delete;
+
+  /**\param doc valid bson document, @see Document::valid
+   * \return record number of the document
+   * \throw bson::SystemError if can not write the file
+   * \throw bson::InvalidArgument if the writer is closed
+   */
+  size_t append(Document doc) noexcept(false);
+
+  size_t append(const minibson::Document &doc) noexcept(false);
+
+  /**\return count of records in the file
+   */
+  [[nodiscard]] size_t size() const noexcept { return offsets_.size(); }
+
+  /**\brief writes buffered blocks in the file and synchronize the file with
+   * storage device
+   * \throw bson::SystemError if can not write the file
+   */
+  void flush() noexcept(false);
+
+  /**\brief writes buffered blocks and index footer, closes the file
+   * \throw bson::SystemError if can not write the file
+   */
+  void close() noexcept(false);
+
+private:
+  /**\return pointer to place for document of the block in the buffer
+   */
+  byte *reserveBlock(int length) noexcept(false);
+
+  void writePending() noexcept(false);
+
+  void recover() noexcept(false);
+
+private:
+  int                   fd_;
+  uint64_t              end_;
+  std::vector<uint64_t> offsets_;
+  std::vector<byte>     pending_;
+};
+
+/**\brief reads batch file by record numbers. The file is mapped in memory, so
+ * returned documents point directly to the mapped file and valid while the
+ * reader exists.
+ *
+ * If index footer is missing (the file was not closed) or damaged, then the
+ * reader scans the file and uses all valid blocks.
+ */
+class BatchReader final {
+public:
+  /**\throw bson::SystemError if can not open or map the file
+   * \throw bson::InvalidArgument if the file is not batch file
+   */
+  explicit BatchReader(const std::string &path) noexcept(false);
+
+  ~BatchReader() noexcept;
+
+  BatchReader(const BatchReader &) = delete;
+  BatchReader &operator=(const BatchReader &) = delete;
+
+  [[nodiscard]] size_t size() const noexcept { return count_; }
+
+  [[nodiscard]] bool empty() const noexcept { return count_ == 0; }
+
+  /**\return true if index footer was missing and the file was scanned
+   */
+  [[nodiscard]] bool recovered() const noexcept { return recovered_; }
+
+  /**\brief document by record number without any checks
+   */
+  Document operator[](size_t i) const noexcept {
+    uint64_t offset = this->offset(i);
+    int32_t  length;
+    std::memcpy(&length, file_->data() + offset, SIZE_OF_BSON_SIZE);
+    return Document{file_->data() + offset + SIZE_OF_BSON_BATCH_BLOCK_HEADER,
+                    length};
+  }
+
+  /**\brief document by record number, the checksum of the block is verified
+   * \throw bson::OutOfRange if i is not less then size
+   * \throw bson::InvalidArgument if the block is damaged
+   */
+  Document at(size_t i) const noexcept(false);
+
+private:
+  uint64_t offset(size_t i) const noexcept {
+    uint64_t retval;
+    std::memcpy(&retval, index_ + i * sizeof(uint64_t), sizeof(uint64_t));
+    return retval;
+  }
+
+private:
+  int                                 fd_;
+  std::unique_ptr<detail::MappedFile> file_;
+  /**\brief offsets of blocks, points to index footer of the file or to
+   * offsets_ if the file was scanned
+   */
+  const byte           *index_;
+  size_t                count_;
+  uint64_t              end_;
+  bool                  recovered_;
+  std::vector<uint64_t> offsets_;
+};
+
+namespace detail {
+inline bool readFooter(const byte *data,
+                       size_t      size,
+                       uint64_t   &indexOffset,
+                       uint64_t   &count) noexcept {
+  if (size < SIZE_OF_BSON_BATCH_MAGIC + SIZE_OF_BSON_BATCH_TAIL) {
+    return false;
+  }
+
+  const byte *tail = data + size - SIZE_OF_BSON_BATCH_TAIL;
+  if (std::memcmp(
+          tail + 20, BSON_BATCH_INDEX_MAGIC, SIZE_OF_BSON_BATCH_MAGIC) != 0) {
+    return false;
+  }
+
+  uint32_t checksum;
+  std::memcpy(&indexOffset, tail, sizeof(uint64_t));
+  std::memcpy(&count, tail + 8, sizeof(uint64_t));
+  std::memcpy(&checksum, tail + 16, sizeof(uint32_t));
+  if (indexOffset < SIZE_OF_BSON_BATCH_MAGIC ||
+      indexOffset > size - SIZE_OF_BSON_BATCH_TAIL ||
+      (size - SIZE_OF_BSON_BATCH_TAIL - indexOffset) / sizeof(uint64_t) !=
+          count ||
+      (size - SIZE_OF_BSON_BATCH_TAIL - indexOffset) % sizeof(uint64_t) != 0) {
+    return false;
+  }
+
+  // checksum covers offsets of blocks and the tail
+  const byte *index = data + indexOffset;
+  if (checksum != crc32c(tail, 16, crc32c(index, count * sizeof(uint64_t)))) {
+    return false;
+  }
+
+  // every block must have place for header and minimal document before next
+  // block
+  uint64_t minimal = SIZE_OF_BSON_BATCH_MAGIC;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t offset;
+    std::memcpy(&offset, index + i * sizeof(uint64_t), sizeof(uint64_t));
+    if (offset < minimal || offset > indexOffset ||
+        indexOffset - offset < SIZE_OF_BSON_BATCH_BLOCK_HEADER +
+                                   (MINIMAL_SIZE_OF_BSON_DOCUMENT)) {
+      return false;
+    }
+    minimal = offset + SIZE_OF_BSON_BATCH_BLOCK_HEADER +
+              (MINIMAL_SIZE_OF_BSON_DOCUMENT);
+  }
+  return true;
+}
+
+inline uint64_t scanBlocks(const byte            *data,
+                           size_t                 size,
+                           std::vector<uint64_t> &offsets) noexcept {
+  uint64_t current = SIZE_OF_BSON_BATCH_MAGIC;
+  while (size - current >= SIZE_OF_BSON_BATCH_BLOCK_HEADER) {
+    int32_t  length;
+    uint32_t checksum;
+    std::memcpy(&length, data + current, SIZE_OF_BSON_SIZE);
+    std::memcpy(
+        &checksum, data + current + SIZE_OF_BSON_SIZE, sizeof(uint32_t));
+
+    const byte *doc = data + current + SIZE_OF_BSON_BATCH_BLOCK_HEADER;
+    if (length < (MINIMAL_SIZE_OF_BSON_DOCUMENT) ||
+        uint64_t(length) > size - current - SIZE_OF_BSON_BATCH_BLOCK_HEADER ||
+        std::memcmp(doc, &length, SIZE_OF_BSON_SIZE) != 0 ||
+        crc32c(doc, length) != checksum) {
+      break;
+    }
+
+    offsets.emplace_back(current);
+    current += SIZE_OF_BSON_BATCH_BLOCK_HEADER + length;
+  }
+  return current;
+}
+} // namespace detail
+
+inline BatchWriter::BatchWriter(const std::string &path, Mode mode)
+    : fd_{-1}
+    , end_{0} {
+  int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+  if (mode == truncate_mode) {
+    flags |= O_TRUNC;
+  }
+
+  fd_ = ::open(path.c_str(), flags, 0644);
+  if (fd_ < 0) {
+    detail::throwSystemError("can not open batch file " + path);
+  }
+
+  try {
+    this->recover();
+  } catch (...) {
+    ::close(fd_);
+    throw;
+  }
+}
+
+inline void BatchWriter::recover() {
+  uint64_t end = 0;
+  {
+    detail::MappedFile file{fd_};
+    if (file.size() >= SIZE_OF_BSON_BATCH_MAGIC) {
+      if (std::memcmp(
+              file.data(), BSON_BATCH_MAGIC, SIZE_OF_BSON_BATCH_MAGIC) != 0) {
+        throw bson::InvalidArgument{"not a bson batch file"};
+      }
+
+      uint64_t indexOffset;
+      uint64_t count;
+      if (detail::readFooter(file.data(), file.size(), indexOffset, count)) {
+        offsets_.resize(count);
+        std::memcpy(offsets_.data(),
+                    file.data() + indexOffset,
+                    count * sizeof(uint64_t));
+        end = indexOffset;
+      } else {
+        end = detail::scanBlocks(file.data(), file.size(), offsets_);
+      }
+    }
+  }
+
+  if (end == 0) {
+    // new file, or file without complete header
+    if (::ftruncate(fd_, 0) != 0) {
+      detail::throwSystemError("can not truncate batch file");
+    }
+    pending_.assign(BSON_BATCH_MAGIC,
+                    BSON_BATCH_MAGIC + SIZE_OF_BSON_BATCH_MAGIC);
+    end_ = 0;
+    return;
+  }
+
+  // remove index footer or damaged tail
+  if (::ftruncate(fd_, end) != 0) {
+    detail::throwSystemError("can not truncate batch file");
+  }
+  if (::lseek(fd_, end, SEEK_SET) < 0) {
+    detail::throwSystemError("can not seek batch file");
+  }
+  end_ = end;
+}
+
+inline BatchWriter::~BatchWriter() noexcept {
+  try {
+    this->close();
+  } catch (...) {
+  }
+}
+
+inline byte *BatchWriter::reserveBlock(int length) {
+  if (fd_ < 0) {
+    throw bson::InvalidArgument{"batch writer is closed"};
+  }
+
+  offsets_.emplace_back(end_ + pending_.size());
+
+  size_t begin = pending_.size();
+  pending_.resize(begin + SIZE_OF_BSON_BATCH_BLOCK_HEADER + length);
+
+  int32_t blockLength = length;
+  std::memcpy(pending_.data() + begin, &blockLength, SIZE_OF_BSON_SIZE);
+  return pending_.data() + begin + SIZE_OF_BSON_BATCH_BLOCK_HEADER;
+}
+
+inline size_t BatchWriter::append(Document doc) {
+  static const byte emptyDocument[] = {
+      (MINIMAL_SIZE_OF_BSON_DOCUMENT), 0, 0, 0, 0};
+
+  const void *data   = doc.empty() ? emptyDocument : doc.data();
+  int         length = doc.empty() ? sizeof(emptyDocument) : doc.length();
+
+  byte *out = this->reserveBlock(length);
+  std::memcpy(out, data, length);
+
+  uint32_t checksum = crc32c(out, length);
+  std::memcpy(out - sizeof(uint32_t), &checksum, sizeof(uint32_t));
+
+  if (pending_.size() >= (1 << 20)) {
+    this->writePending();
+  }
+  return offsets_.size() - 1;
+}
+
+inline size_t BatchWriter::append(const minibson::Document &doc) {
+  int   length = doc.getSerializedSize();
+  byte *out    = this->reserveBlock(length);
+  doc.serialize(out, length);
+
+  uint32_t checksum = crc32c(out, length);
+  std::memcpy(out - sizeof(uint32_t), &checksum, sizeof(uint32_t));
+
+  if (pending_.size() >= (1 << 20)) {
+    this->writePending();
+  }
+  return offsets_.size() - 1;
+}
+
+inline void BatchWriter::writePending() {
+  detail::writeAll(fd_, pending_.data(), pending_.size());
+  end_ += pending_.size();
+  pending_.clear();
+}
+
+inline void BatchWriter::flush() {
+  if (fd_ < 0) {
+    return;
+  }
+
+  this->writePending();
+  if (::fsync(fd_) != 0) {
+    detail::throwSystemError("can not sync batch file");
+  }
+}
+
+inline void BatchWriter::close() {
+  if (fd_ < 0) {
+    return;
+  }
+
+  uint64_t indexOffset = end_ + pending_.size();
+  uint64_t count       = offsets_.size();
+  size_t   begin       = pending_.size();
+  pending_.resize(begin + count * sizeof(uint64_t) + SIZE_OF_BSON_BATCH_TAIL);
+
+  byte *out = pending_.data() + begin;
+  std::memcpy(out, offsets_.data(), count * sizeof(uint64_t));
+  out += count * sizeof(uint64_t);
+  std::memcpy(out, &indexOffset, sizeof(uint64_t));
+  std::memcpy(out + 8, &count, sizeof(uint64_t));
+  uint32_t checksum = crc32c(
+      out, 16, crc32c(offsets_.data(), count * sizeof(uint64_t)));
+  std::memcpy(out + 16, &checksum, sizeof(uint32_t));
+  std::memcpy(out + 20, BSON_BATCH_INDEX_MAGIC, SIZE_OF_BSON_BATCH_MAGIC);
+
+  int fd = fd_;
+  fd_    = -1;
+  try {
+    detail::writeAll(fd, pending_.data(), pending_.size());
+    if (::fsync(fd) != 0) {
+      detail::throwSystemError("can not sync batch file");
+    }
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+  pending_.clear();
+}
+
+inline BatchReader::BatchReader(const std::string &path)
+    : fd_{-1}
+    , index_{nullptr}
+    , count_{0}
+    , end_{0}
+    , recovered_{false} {
+  fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    detail::throwSystemError("can not open batch file " + path);
+  }
+
+  try {
+    file_ = std::make_unique<detail::MappedFile>(fd_);
+    if (file_->size() < SIZE_OF_BSON_BATCH_MAGIC ||
+        std::memcmp(
+            file_->data(), BSON_BATCH_MAGIC, SIZE_OF_BSON_BATCH_MAGIC) != 0) {
+      throw bson::InvalidArgument{"not a bson batch file"};
+    }
+  } catch (...) {
+    ::close(fd_);
+    throw;
+  }
+
+  uint64_t indexOffset;
+  uint64_t count;
+  if (detail::readFooter(file_->data(), file_->size(), indexOffset, count)) {
+    index_ = file_->data() + indexOffset;
+    count_ = count;
+    end_   = indexOffset;
+    return;
+  }
+
+  end_       = detail::scanBlocks(file_->data(), file_->size(), offsets_);
+  index_     = reinterpret_cast<const byte *>(offsets_.data());
+  count_     = offsets_.size();
+  recovered_ = true;
+}
+
+inline BatchReader::~BatchReader() noexcept {
+  file_.reset();
+  ::close(fd_);
+}
+
+inline Document BatchReader::at(size_t i) const {
+  if (i >= count_) {
+    throw bson::OutOfRange{"record number is out of range"};
+  }
+
+  uint64_t offset = this->offset(i);
+  if (offset < SIZE_OF_BSON_BATCH_MAGIC || offset > end_ ||
+      end_ - offset < SIZE_OF_BSON_BATCH_BLOCK_HEADER) {
+    throw bson::InvalidArgument{"damaged batch block"};
+  }
+
+  int32_t  length;
+  uint32_t checksum;
+  std::memcpy(&length, file_->data() + offset, SIZE_OF_BSON_SIZE);
+  std::memcpy(&checksum,
+              file_->data() + offset + SIZE_OF_BSON_SIZE,
+              sizeof(uint32_t));
+
+  const byte *doc = file_->data() + offset + SIZE_OF_BSON_BATCH_BLOCK_HEADER;
+  if (length < (MINIMAL_SIZE_OF_BSON_DOCUMENT) ||
+      uint64_t(length) > end_ - offset - SIZE_OF_BSON_BATCH_BLOCK_HEADER ||
+      crc32c(doc, length) != checksum) {
+    throw bson::InvalidArgument{"damaged batch block"};
+  }
+  return Document{doc, length};
+}
+} // namespace microbson
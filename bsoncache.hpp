@@ -0,0 +1,195 @@
+// bsoncache.hpp
+
+#pragma once
+
+#include "bsonhash.hpp"
+#include "microbson.hpp"
+#include "minibson.hpp"
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace minibson {
+/**\brief thread-safe cache of parsed documents for repeated payloads. Documents
+ * are identified by hash and length of serialized bytes, so byte-identical
+ * payloads are parsed only once and all callers share one immutable tree.
+ *
+ * Every entry keeps copy of serialized bytes, so hash collisions never return
+ * wrong document. Memory usage of entry is estimated as doubled length of the
+ * serialized document. If memory usage exceeds the budget, least recently used
+ * entries are evicted. Documents, which are still referenced by callers, stay
+ * alive after eviction.
+ */
+class ParseCache final {
+public:
+  using value_type = std::shared_ptr<const Document>;
+
+  /**\param memoryBudget maximum of estimated memory usage in bytes
+   */
+  explicit ParseCache(size_t memoryBudget) noexcept
+      : memoryBudget_{memoryBudget}
+      , memoryUsage_{0}
+      , hits_{0}
+      , misses_{0} {}
+
+  ParseCache(const ParseCache &) = delete;
+  ParseCache &operator=(const ParseCache &) = delete;
+
+  /**\brief returns cached document or parses it and puts in the cache
+   * \param data pointer to serialized bson document
+   * \param length size of buffer
+   * \throw bson::InvalidArgument if can not deserialize bson
+   */
+  value_type get(const void *data, int length) noexcept(false);
+
+  value_type get(microbson::Document doc) noexcept(false) {
+    return this->get(doc.data(), doc.length());
+  }
+
+  [[nodiscard]] size_t hits() const noexcept;
+  [[nodiscard]] size_t misses() const noexcept;
+
+  /**\return count of cached documents
+   */
+  [[nodiscard]] size_t size() const noexcept;
+
+  [[nodiscard]] size_t memoryUsage() const noexcept;
+
+  [[nodiscard]] size_t memoryBudget() const noexcept { return memoryBudget_; }
+
+  void clear() noexcept;
+
+private:
+  struct Key {
+    uint64_t hash;
+    int      length;
+
+    bool operator==(const Key &rhs) const noexcept {
+      return hash == rhs.hash && length == rhs.length;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const noexcept { return key.hash; }
+  };
+
+  struct Entry {
+    Key               key;
+    std::vector<byte> bytes;
+    value_type        doc;
+  };
+
+  using list_type = std::list<Entry>;
+
+  static size_t cost(int length) noexcept {
+    return 2 * size_t(length) + sizeof(Entry);
+  }
+
+  void evict() noexcept;
+
+private:
+  const size_t       memoryBudget_;
+  mutable std::mutex mutex_;
+  /**\brief most recently used entries at the front
+   */
+  list_type                                            entries_;
+  std::unordered_map<Key, list_type::iterator, KeyHash> index_;
+  size_t                                               memoryUsage_;
+  size_t                                               hits_;
+  size_t                                               misses_;
+};
+
+inline ParseCache::value_type ParseCache::get(const void *data, int length) {
+  if (data == nullptr || length < MINIMAL_SIZE_OF_BSON_DOCUMENT) {
+    throw bson::InvalidArgument{"invalid bson"};
+  }
+
+  int32_t docLength;
+  std::memcpy(&docLength, data, SIZE_OF_BSON_SIZE);
+  if (docLength < MINIMAL_SIZE_OF_BSON_DOCUMENT || docLength > length) {
+    throw bson::InvalidArgument{"invalid bson"};
+  }
+
+  Key key{microbson::hash64(data, docLength), docLength};
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto                        found = index_.find(key);
+    if (found != index_.end() &&
+        std::memcmp(found->second->bytes.data(), data, docLength) == 0) {
+      entries_.splice(entries_.begin(), entries_, found->second);
+      ++hits_;
+      return found->second->doc;
+    }
+    ++misses_;
+  }
+
+  // parsing is done without lock, so other threads are not blocked
+  value_type doc = std::make_shared<const Document>(data, docLength);
+  if (cost(docLength) > memoryBudget_) {
+    return doc;
+  }
+
+  const byte *begin = reinterpret_cast<const byte *>(data);
+
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto                        found = index_.find(key);
+  if (found != index_.end()) {
+    if (std::memcmp(found->second->bytes.data(), data, docLength) == 0) {
+      // same document was cached by other thread
+      entries_.splice(entries_.begin(), entries_, found->second);
+      return found->second->doc;
+    }
+
+    // collision of hashes, the last document wins
+    memoryUsage_ -= cost(docLength);
+    entries_.erase(found->second);
+    index_.erase(found);
+  }
+
+  entries_.emplace_front(
+      Entry{key, std::vector<byte>(begin, begin + docLength), doc});
+  index_.emplace(key, entries_.begin());
+  memoryUsage_ += cost(docLength);
+  this->evict();
+  return doc;
+}
+
+inline void ParseCache::evict() noexcept {
+  while (memoryUsage_ > memoryBudget_ && !entries_.empty()) {
+    const Entry &last = entries_.back();
+    memoryUsage_ -= cost(last.key.length);
+    index_.erase(last.key);
+    entries_.pop_back();
+  }
+}
+
+inline size_t ParseCache::hits() const noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return hits_;
+}
+
+inline size_t ParseCache::misses() const noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return misses_;
+}
+
+inline size_t ParseCache::size() const noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return entries_.size();
+}
+
+inline size_t ParseCache::memoryUsage() const noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return memoryUsage_;
+}
+
+inline void ParseCache::clear() noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+  entries_.clear();
+  index_.clear();
+  memoryUsage_ = 0;
+}
+} // namespace minibson
@@ -0,0 +1,300 @@
+// bsoncolumns.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace microbson {
+/**\brief extracts fields from batch of documents into preallocated columns:
+ * one contiguous vector of values per field, validity bitmap (bit per row,
+ * least significant bit first) and offsets and data buffers for strings. All
+ * fields of a document are read by one traversal.
+ *
+ * Rows are indexes of documents in the batch. Several threads can extract
+ * disjoint row ranges, if every range starts from row multiple of 8 (so
+ * threads never share byte of validity bitmap). String columns are filled in
+ * two phases: lengths of strings are measured (also by disjoint ranges), then
+ * @see allocate computes offsets, after that the strings can be extracted.
+ *
+ * Usage:
+ * ```
+ * using microbson::ColumnExtractor;
+ * ColumnExtractor columns{{{"latency", ColumnExtractor::double_column},
+ *                          {"host", ColumnExtractor::string_column}},
+ *                         docs.size()};
+ * columns.measure(docs.data(), 0, docs.size()); // in parallel
+ * columns.allocate();
+ * columns.extract(docs.data(), 0, docs.size()); // in parallel
+ * ```
+ */
+class ColumnExtractor final {
+public:
+  enum ColumnType {
+    /**\brief int32, int64 and double values as bson::Scalar
+     */
+    double_column,
+    /**\brief int32 and int64 values
+     */
+    int64_column,
+    string_column,
+  };
+
+  struct Column {
+    std::string          path;
+    ColumnType           type;
+    std::vector<double>  doubles;
+    std::vector<int64_t> integers;
+    std::vector<byte>    validity;
+    /**\brief string of row `i` is [offsets[i], offsets[i + 1]) of data
+     */
+    std::vector<size_t> offsets;
+    std::vector<char>   data;
+
+    [[nodiscard]] bool valid(size_t row) const noexcept {
+      return validity[row >> 3] & (1 << (row & 7));
+    }
+
+    [[nodiscard]] std::string_view string(size_t row) const noexcept {
+      return std::string_view{data.data() + offsets[row],
+                              offsets[row + 1] - offsets[row]};
+    }
+  };
+
+  /**\param fields paths of fields, keys of nested documents and arrays must
+   * be separated by BSON_PATH_DELIMITER
+   * \param rows count of documents in the batch
+   */
+  ColumnExtractor(const std::vector<std::pair<std::string, ColumnType>> &fields,
+                  size_t rows) noexcept;
+
+  [[nodiscard]] size_t rows() const noexcept { return rows_; }
+
+  [[nodiscard]] size_t size() const noexcept { return columns_.size(); }
+
+  [[nodiscard]] const Column &column(size_t i) const noexcept {
+    return columns_[i];
+  }
+
+  /**\brief first phase for string columns, measure length of strings
+   * \param docs batch of valid bson documents, @see Document::valid
+   * \throw bson::InvalidArgument if begin is not multiple of 8 or range is out
+   * of the batch
+   */
+  void measure(const Document *docs, size_t begin, size_t end) noexcept(false);
+
+  /**\brief compute offsets of strings and allocate data buffers for them.
+   * Must be called by one thread after all ranges are measured
+   */
+  void allocate() noexcept;
+
+  /**\brief fill columns by values of documents in rows [begin, end)
+   * \param docs batch of valid bson documents, @see Document::valid
+   * \throw bson::InvalidArgument if begin is not multiple of 8, range is out of
+   * the batch, or string columns are not allocated
+   */
+  void extract(const Document *docs, size_t begin, size_t end) noexcept(false);
+
+private:
+  struct Level {
+    /**\brief indexes of columns for node by the path
+     */
+    std::vector<size_t>                       columns;
+    std::map<std::string, Level, std::less<>> children;
+  };
+
+  void checkRange(size_t begin, size_t end) const noexcept(false);
+
+  /**\brief find nodes of all columns in the document by one traversal
+   */
+  void gather(Document doc, const Level &level, const byte **nodes) const
+      noexcept;
+
+private:
+  std::vector<Column> columns_;
+  Level               fields_;
+  size_t              rows_;
+  bool                allocated_;
+};
+
+inline ColumnExtractor::ColumnExtractor(
+    const std::vector<std::pair<std::string, ColumnType>> &fields,
+    size_t                                                  rows) noexcept
+    : rows_{rows}
+    , allocated_{true} {
+  for (const auto &[path, type] : fields) {
+    Column column{
+        path, type, {}, {}, std::vector<byte>((rows + 7) / 8), {}, {}};
+    switch (type) {
+    case double_column:
+      column.doubles.resize(rows);
+      break;
+    case int64_column:
+      column.integers.resize(rows);
+      break;
+    case string_column:
+      column.offsets.resize(rows + 1);
+      allocated_ = false;
+      break;
+    }
+    columns_.emplace_back(std::move(column));
+
+    Level *current = &fields_;
+    detail::forEachKey(path, [&current](std::string_view key, bool) {
+      current = &detail::childLevel(current->children, key).first;
+      return true;
+    });
+    current->columns.emplace_back(columns_.size() - 1);
+  }
+}
+
+inline void ColumnExtractor::checkRange(size_t begin, size_t end) const {
+  if (begin % 8 != 0) {
+    throw bson::InvalidArgument{"range must start from row multiple of 8"};
+  }
+  if (begin > end || end > rows_) {
+    throw bson::InvalidArgument{"range is out of the batch"};
+  }
+}
+
+inline void ColumnExtractor::gather(Document      doc,
+                                    const Level  &level,
+                                    const byte  **nodes) const noexcept {
+  for (Node node : doc) {
+    auto found = level.children.find(node.key());
+    if (found == level.children.end()) {
+      continue;
+    }
+
+    const Level &child = found->second;
+    for (size_t column : child.columns) {
+      nodes[column] = reinterpret_cast<const byte *>(node.data());
+    }
+
+    if (!child.children.empty() && (node.type() == bson::document_node ||
+                                    node.type() == bson::array_node)) {
+      int header = SIZE_OF_BSON_TYPE + node.key().size() + SIZE_OF_ZERO_BYTE;
+
+      const byte *value = reinterpret_cast<const byte *>(node.data()) + header;
+      this->gather(Document{value, node.length() - header}, child, nodes);
+    }
+  }
+}
+
+inline void
+ColumnExtractor::measure(const Document *docs, size_t begin, size_t end) {
+  this->checkRange(begin, end);
+
+  std::vector<const byte *> nodes(columns_.size());
+  for (size_t row = begin; row < end; ++row) {
+    std::fill(nodes.begin(), nodes.end(), nullptr);
+    if (!docs[row].empty()) {
+      this->gather(docs[row], fields_, nodes.data());
+    }
+
+    for (size_t i = 0; i < columns_.size(); ++i) {
+      Column &column = columns_[i];
+      if (column.type != string_column) {
+        continue;
+      }
+
+      size_t length = 0;
+      if (nodes[i] && Node{nodes[i]}.type() == bson::string_node) {
+        length = Node{nodes[i]}.value<std::string_view>().size();
+      }
+      column.offsets[row + 1] = length;
+    }
+  }
+}
+
+inline void ColumnExtractor::allocate() noexcept {
+  for (Column &column : columns_) {
+    if (column.type != string_column) {
+      continue;
+    }
+
+    column.offsets[0] = 0;
+    for (size_t row = 0; row < rows_; ++row) {
+      column.offsets[row + 1] += column.offsets[row];
+    }
+    column.data.resize(column.offsets[rows_]);
+  }
+  allocated_ = true;
+}
+
+inline void
+ColumnExtractor::extract(const Document *docs, size_t begin, size_t end) {
+  this->checkRange(begin, end);
+  if (!allocated_) {
+    throw bson::InvalidArgument{"string columns are not allocated"};
+  }
+
+  std::vector<const byte *> nodes(columns_.size());
+  for (size_t row = begin; row < end; ++row) {
+    std::fill(nodes.begin(), nodes.end(), nullptr);
+    if (!docs[row].empty()) {
+      this->gather(docs[row], fields_, nodes.data());
+    }
+
+    byte mask = 1 << (row & 7);
+    for (size_t i = 0; i < columns_.size(); ++i) {
+      Column &column = columns_[i];
+      byte   &bits   = column.validity[row >> 3];
+      bits &= ~mask;
+
+      if (nodes[i] == nullptr) {
+        if (column.type == double_column) {
+          column.doubles[row] = 0;
+        } else if (column.type == int64_column) {
+          column.integers[row] = 0;
+        }
+        continue;
+      }
+
+      Node           node{nodes[i]};
+      bson::NodeType type  = node.type();
+      bool           valid = false;
+      switch (column.type) {
+      case double_column:
+        valid = type == bson::double_node || type == bson::int32_node ||
+                type == bson::int64_node;
+        column.doubles[row] = valid ? node.value<bson::Scalar>() : 0;
+        break;
+      case int64_column:
+        if (type == bson::int32_node) {
+          column.integers[row] = node.value<int32_t>();
+          valid                = true;
+        } else if (type == bson::int64_node) {
+          column.integers[row] = node.value<int64_t>();
+          valid                = true;
+        } else {
+          column.integers[row] = 0;
+        }
+        break;
+      case string_column:
+        if (type == bson::string_node) {
+          std::string_view val = node.value<std::string_view>();
+          // document can be changed after measure, so the length is checked
+          valid = val.size() == column.offsets[row + 1] - column.offsets[row];
+          if (valid) {
+            std::memcpy(column.data.data() + column.offsets[row],
+                        val.data(),
+                        val.size());
+          }
+        }
+        break;
+      }
+
+      if (valid) {
+        bits |= mask;
+      }
+    }
+  }
+}
+} // namespace microbson
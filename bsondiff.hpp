@@ -0,0 +1,109 @@
+// bsondiff.hpp
+
+#pragma once
+
+#include "bsonpatch.hpp"
+#include "microbson.hpp"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace microbson {
+namespace detail {
+inline bool sameBytes(Node lhs, Node rhs) noexcept {
+  int length = lhs.length();
+  return length == rhs.length() &&
+         std::memcmp(lhs.data(), rhs.data(), length) == 0;
+}
+
+inline void diffDocuments(Document           from,
+                          Document           to,
+                          const std::string &prefix,
+                          Patch             &patch) noexcept(false) {
+  if (from.length() == to.length() &&
+      (from.empty() ||
+       std::memcmp(from.data(), to.data(), from.length()) == 0)) {
+    return; // identical subtree
+  }
+
+  // nodes of source document ordered by keys for fast search
+  std::vector<Node> nodes;
+  for (Node node : from) {
+    nodes.emplace_back(node);
+  }
+  std::sort(nodes.begin(), nodes.end(), [](Node lhs, Node rhs) {
+    return lhs.key() < rhs.key();
+  });
+  std::vector<bool> matched(nodes.size(), false);
+
+  for (Node node : to) {
+    std::string path = prefix.empty() ? std::string{node.key()}
+                                      : prefix + BSON_PATH_DELIMITER +
+                                            std::string{node.key()};
+
+    auto found = std::lower_bound(nodes.begin(),
+                                  nodes.end(),
+                                  node.key(),
+                                  [](Node lhs, std::string_view key) {
+                                    return lhs.key() < key;
+                                  });
+    if (found != nodes.end() && found->key() == node.key()) {
+      matched[found - nodes.begin()] = true;
+
+      if (sameBytes(*found, node)) {
+        continue;
+      }
+
+      if (found->type() == node.type() &&
+          (node.type() == bson::document_node ||
+           node.type() == bson::array_node)) {
+        if (node.type() == bson::array_node) {
+          diffDocuments(found->value<Array>(),
+                        node.value<Array>(),
+                        path,
+                        patch);
+        } else {
+          diffDocuments(found->value<Document>(),
+                        node.value<Document>(),
+                        path,
+                        patch);
+        }
+        continue;
+      }
+    }
+
+    const byte *begin = reinterpret_cast<const byte *>(node.data()) +
+                        SIZE_OF_BSON_TYPE + node.key().size() +
+                        SIZE_OF_ZERO_BYTE;
+    const byte *end = reinterpret_cast<const byte *>(node.data()) +
+                      node.length();
+    patch.set(path, node.type(), std::vector<byte>(begin, end));
+  }
+
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (!matched[i]) {
+      patch.unset(prefix.empty() ? std::string{nodes[i].key()}
+                                 : prefix + BSON_PATH_DELIMITER +
+                                       std::string{nodes[i].key()});
+    }
+  }
+}
+} // namespace detail
+
+/**\brief compare two serialized documents and returns patch, which transforms
+ * first document to second. Into nested documents and arrays it recurses only
+ * if they have different bytes, so identical subtrees cost only one compare
+ * \param from valid bson document, @see Document::valid
+ * \param to valid bson document
+ * \return patch with set and unset operations. Order of values in result of
+ * the patch can be different from order in `to`
+ * \warning keys with BSON_PATH_DELIMITER can not be represented in the patch
+ */
+inline Patch diff(Document from, Document to) noexcept(false) {
+  Patch retval;
+  detail::diffDocuments(from, to, std::string{}, retval);
+  return retval;
+}
+} // namespace microbson
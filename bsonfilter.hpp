@@ -0,0 +1,465 @@
+// bsonfilter.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace microbson {
+class Filter;
+
+/**\brief predicate over fields of document, built by @see where and logical
+ * operators. For evaluation it must be compiled to @see Filter
+ */
+class Expression final {
+  friend class FilterField;
+  friend class Filter;
+  friend Expression operator&&(Expression lhs, Expression rhs) noexcept;
+  friend Expression operator||(Expression lhs, Expression rhs) noexcept;
+  friend Expression operator!(Expression expr) noexcept;
+
+public:
+  enum Operation {
+    and_operation,
+    or_operation,
+    not_operation,
+    exists_operation,
+    contains_operation,
+    equal_operation,
+    not_equal_operation,
+    less_operation,
+    less_equal_operation,
+    greater_operation,
+    greater_equal_operation,
+  };
+
+  enum ValueKind {
+    no_value,
+    number_value,
+    string_value,
+    boolean_value,
+  };
+
+private:
+  struct Term {
+    Operation             operation;
+    std::shared_ptr<Term> lhs;
+    std::shared_ptr<Term> rhs;
+    std::string           path;
+    ValueKind             kind   = no_value;
+    double                number = 0;
+    std::string           text;
+  };
+
+  explicit Expression(std::shared_ptr<Term> term) noexcept
+      : term_{std::move(term)} {}
+
+  std::shared_ptr<Term> term_;
+};
+
+/**\brief reference to value by path, keys of nested documents and arrays must
+ * be separated by BSON_PATH_DELIMITER. Comparisons with numbers match int32,
+ * int64 and double values (compared as bson::Scalar), comparisons with strings
+ * match only string values (compared lexicographically). Missing values and
+ * values of other types never match comparisons, `!=` included: negate `==`
+ * for matching them too
+ */
+class FilterField final {
+public:
+  explicit FilterField(std::string_view path) noexcept
+      : path_{path} {}
+
+  Expression exists() const noexcept {
+    return this->make(
+        Expression::exists_operation, Expression::no_value, 0, {});
+  }
+
+  /**\brief array contains item equal to the value, or string contains the
+   * value as substring
+   */
+  template <class T>
+  Expression contains(const T &val) const noexcept {
+    return this->compare(Expression::contains_operation, val);
+  }
+
+  template <class T>
+  Expression operator==(const T &val) const noexcept {
+    return this->compare(Expression::equal_operation, val);
+  }
+  template <class T>
+  Expression operator!=(const T &val) const noexcept {
+    return this->compare(Expression::not_equal_operation, val);
+  }
+  template <class T>
+  Expression operator<(const T &val) const noexcept {
+    return this->compare(Expression::less_operation, val);
+  }
+  template <class T>
+  Expression operator<=(const T &val) const noexcept {
+    return this->compare(Expression::less_equal_operation, val);
+  }
+  template <class T>
+  Expression operator>(const T &val) const noexcept {
+    return this->compare(Expression::greater_operation, val);
+  }
+  template <class T>
+  Expression operator>=(const T &val) const noexcept {
+    return this->compare(Expression::greater_equal_operation, val);
+  }
+
+private:
+  template <class T>
+  Expression compare(Expression::Operation operation, const T &val) const
+      noexcept {
+    if constexpr (std::is_same<T, bool>::value) {
+      return this->make(operation, Expression::boolean_value, val, {});
+    } else if constexpr (std::is_arithmetic<T>::value) {
+      return this->make(operation, Expression::number_value, double(val), {});
+    } else {
+      static_assert(std::is_convertible<T, std::string_view>::value,
+                    "value can be only number, boolean or string");
+      return this->make(operation,
+                        Expression::string_value,
+                        0,
+                        std::string_view{val});
+    }
+  }
+
+  Expression make(Expression::Operation operation,
+                  Expression::ValueKind kind,
+                  double                number,
+                  std::string_view      text) const noexcept {
+    return Expression{std::make_shared<Expression::Term>(
+        Expression::Term{operation,
+                         nullptr,
+                         nullptr,
+                         path_,
+                         kind,
+                         number,
+                         std::string{text}})};
+  }
+
+private:
+  std::string path_;
+};
+
+inline FilterField where(std::string_view path) noexcept {
+  return FilterField{path};
+}
+
+inline Expression operator&&(Expression lhs, Expression rhs) noexcept {
+  return Expression{std::make_shared<Expression::Term>(
+      Expression::Term{Expression::and_operation,
+                       std::move(lhs.term_),
+                       std::move(rhs.term_),
+                       {},
+                       Expression::no_value,
+                       0,
+                       {}})};
+}
+
+inline Expression operator||(Expression lhs, Expression rhs) noexcept {
+  return Expression{std::make_shared<Expression::Term>(
+      Expression::Term{Expression::or_operation,
+                       std::move(lhs.term_),
+                       std::move(rhs.term_),
+                       {},
+                       Expression::no_value,
+                       0,
+                       {}})};
+}
+
+inline Expression operator!(Expression expr) noexcept {
+  return Expression{std::make_shared<Expression::Term>(
+      Expression::Term{Expression::not_operation,
+                       std::move(expr.term_),
+                       nullptr,
+                       {},
+                       Expression::no_value,
+                       0,
+                       {}})};
+}
+
+/**\brief compiled expression. All fields referenced by the expression are
+ * found by one traversal of the document (traversal stops when all fields
+ * found), after that the plan is evaluated with short-circuit of logical
+ * operators. The filter is immutable, so it can be used from several threads
+ *
+ * Usage:
+ * ```
+ * using microbson::where;
+ * microbson::Filter filter{where("status") == "ok" && where("latency") > 250 &&
+ *                          where("tags").contains("x")};
+ * if (filter.match(doc)) { ... }
+ * ```
+ */
+class Filter final {
+public:
+  /**\brief count of found fields, which are kept in buffer on stack
+   */
+  static constexpr size_t stack_slots = 16;
+
+  explicit Filter(const Expression &expr) noexcept;
+
+  /**\brief evaluation not allocates memory if the filter references not more
+   * then `stack_slots` fields
+   * \param doc valid bson document, @see Document::valid
+   */
+  [[nodiscard]] bool match(Document doc) const noexcept;
+
+  /**\brief evaluate batch of documents, buffer for found fields is reused for
+   * all documents
+   * \param result array of `count` values, where result of evaluation of every
+   * document will be written
+   * \return count of matched documents
+   */
+  size_t match(const Document *docs, size_t count, bool *result) const noexcept;
+
+  /**\return count of distinct fields, which are referenced by the filter
+   */
+  [[nodiscard]] size_t fields() const noexcept { return slots_; }
+
+private:
+  struct Step {
+    Expression::Operation operation;
+    /**\brief for logical operations - indexes of operands, for others - index
+     * of slot with found node
+     */
+    size_t                lhs = 0;
+    size_t                rhs = 0;
+    Expression::ValueKind kind   = Expression::no_value;
+    double                number = 0;
+    std::string           text;
+  };
+
+  struct Level {
+    /**\brief index of slot for node by the path, or -1
+     */
+    int                                       slot = -1;
+    std::map<std::string, Level, std::less<>> children;
+  };
+
+  size_t compile(const Expression::Term &term) noexcept;
+
+  size_t slot(std::string_view path) noexcept;
+
+  /**\brief find all referenced nodes of the document
+   * \param remain count of not found yet fields
+   */
+  void gather(Document            doc,
+              const Level        &level,
+              const byte        **slots,
+              size_t             &remain) const noexcept;
+
+  bool evaluate(size_t step, const byte *const *slots) const noexcept;
+
+  bool compare(const Step &step, Node node) const noexcept;
+
+private:
+  std::vector<Step> steps_;
+  size_t            root_;
+  Level             fields_;
+  size_t            slots_ = 0;
+};
+
+inline Filter::Filter(const Expression &expr) noexcept {
+  root_ = this->compile(*expr.term_);
+}
+
+inline size_t Filter::slot(std::string_view path) noexcept {
+  Level *current = &fields_;
+  detail::forEachKey(path, [&current](std::string_view key, bool) {
+    current = &detail::childLevel(current->children, key).first;
+    return true;
+  });
+
+  if (current->slot < 0) {
+    current->slot = slots_++;
+  }
+  return current->slot;
+}
+
+inline size_t Filter::compile(const Expression::Term &term) noexcept {
+  Step step{term.operation, 0, 0, term.kind, term.number, term.text};
+  switch (term.operation) {
+  case Expression::and_operation:
+  case Expression::or_operation:
+    step.lhs = this->compile(*term.lhs);
+    step.rhs = this->compile(*term.rhs);
+    break;
+  case Expression::not_operation:
+    step.lhs = this->compile(*term.lhs);
+    break;
+  default:
+    step.lhs = this->slot(term.path);
+    break;
+  }
+
+  steps_.emplace_back(std::move(step));
+  return steps_.size() - 1;
+}
+
+inline void Filter::gather(Document      doc,
+                           const Level  &level,
+                           const byte  **slots,
+                           size_t       &remain) const noexcept {
+  for (Node node : doc) {
+    auto found = level.children.find(node.key());
+    if (found == level.children.end()) {
+      continue;
+    }
+
+    const Level &child = found->second;
+    if (child.slot >= 0) {
+      slots[child.slot] = reinterpret_cast<const byte *>(node.data());
+      --remain;
+    }
+
+    if (!child.children.empty() && (node.type() == bson::document_node ||
+                                    node.type() == bson::array_node)) {
+      int header = SIZE_OF_BSON_TYPE + node.key().size() + SIZE_OF_ZERO_BYTE;
+
+      const byte *value = reinterpret_cast<const byte *>(node.data()) + header;
+      this->gather(
+          Document{value, node.length() - header}, child, slots, remain);
+    }
+
+    if (remain == 0) {
+      return;
+    }
+  }
+}
+
+inline bool Filter::compare(const Step &step, Node node) const noexcept {
+  int order = 0;
+  switch (step.kind) {
+  case Expression::number_value: {
+    bson::NodeType type = node.type();
+    if (type != bson::double_node && type != bson::int32_node &&
+        type != bson::int64_node) {
+      return false;
+    }
+    double val = node.value<bson::Scalar>();
+    if (val != val) {
+      return false; // NaN not equal to anything
+    }
+    order = val < step.number ? -1 : (val > step.number ? 1 : 0);
+  } break;
+  case Expression::string_value: {
+    if (node.type() != bson::string_node) {
+      return false;
+    }
+    std::string_view val = node.value<std::string_view>();
+    if (step.operation == Expression::contains_operation) {
+      return val.find(step.text) != val.npos;
+    }
+    order = val.compare(step.text);
+  } break;
+  case Expression::boolean_value:
+    if (node.type() != bson::boolean_node) {
+      return false;
+    }
+    order = int(node.value<bool>()) - int(step.number != 0);
+    break;
+  case Expression::no_value:
+    return false;
+  }
+
+  switch (step.operation) {
+  case Expression::equal_operation:
+  case Expression::contains_operation:
+    return order == 0;
+  case Expression::not_equal_operation:
+    return order != 0;
+  case Expression::less_operation:
+    return order < 0;
+  case Expression::less_equal_operation:
+    return order <= 0;
+  case Expression::greater_operation:
+    return order > 0;
+  case Expression::greater_equal_operation:
+    return order >= 0;
+  default:
+    return false;
+  }
+}
+
+inline bool Filter::evaluate(size_t step, const byte *const *slots) const
+    noexcept {
+  const Step &current = steps_[step];
+  switch (current.operation) {
+  case Expression::and_operation:
+    return this->evaluate(current.lhs, slots) &&
+           this->evaluate(current.rhs, slots);
+  case Expression::or_operation:
+    return this->evaluate(current.lhs, slots) ||
+           this->evaluate(current.rhs, slots);
+  case Expression::not_operation:
+    return !this->evaluate(current.lhs, slots);
+  default:
+    break;
+  }
+
+  const byte *found = slots[current.lhs];
+  if (found == nullptr) {
+    return false;
+  }
+
+  Node node{found};
+  switch (current.operation) {
+  case Expression::exists_operation:
+    return true;
+  case Expression::contains_operation:
+    if (node.type() == bson::array_node) {
+      for (Node item : node.value<Array>()) {
+        if (this->compare(current, item)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    return current.kind == Expression::string_value &&
+           this->compare(current, node);
+  default:
+    return this->compare(current, node);
+  }
+}
+
+inline bool Filter::match(Document doc) const noexcept {
+  bool retval = false;
+  this->match(&doc, 1, &retval);
+  return retval;
+}
+
+inline size_t
+Filter::match(const Document *docs, size_t count, bool *result) const noexcept {
+  // the filter is shared between threads, so the buffer can not be a member
+  const byte               *local[stack_slots];
+  std::vector<const byte *> allocated;
+  const byte              **slots = local;
+  if (slots_ > stack_slots) {
+    allocated.resize(slots_);
+    slots = allocated.data();
+  }
+
+  size_t matched = 0;
+  for (size_t i = 0; i < count; ++i) {
+    std::fill(slots, slots + slots_, nullptr);
+
+    size_t remain = slots_;
+    if (!docs[i].empty()) {
+      this->gather(docs[i], fields_, slots, remain);
+    }
+
+    result[i] = this->evaluate(root_, slots);
+    matched += result[i];
+  }
+  return matched;
+}
+} // namespace microbson
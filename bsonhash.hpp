@@ -0,0 +1,300 @@
+// bsonhash.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#  include <immintrin.h>
+#endif
+
+namespace microbson {
+namespace detail {
+constexpr uint64_t prime32_1 = 0x9E3779B1u;
+constexpr uint64_t prime32_2 = 0x85EBCA77u;
+constexpr uint64_t prime32_3 = 0xC2B2AE3Du;
+constexpr uint64_t prime64_1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t prime64_2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t prime64_3 = 0x165667B19E3779F9ull;
+constexpr uint64_t prime64_4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t prime64_5 = 0x27D4EB2F165667C5ull;
+
+constexpr size_t hashStripeLength = 64;
+constexpr size_t hashBlockStripes = 16;
+constexpr size_t hashBlockLength  = hashStripeLength * hashBlockStripes;
+
+/**\brief random keys, every stripe of block is mixed with own offset of the
+ * secret, so reordered stripes produce different hash
+ */
+alignas(32) constexpr uint64_t hashSecret[24]{
+    0x6E789E6AA1B965F4ull, 0x06C45D188009454Full, 0xF88BB8A8724C81ECull,
+    0x1B39896A51A8749Bull, 0x53CB9F0C747EA2EAull, 0x2C829ABE1F4532E1ull,
+    0xC584133AC916AB3Cull, 0x3EE5789041C98AC3ull, 0xF3B8488C368CB0A6ull,
+    0x657EECDD3CB13D09ull, 0xC2D326E0055BDEF6ull, 0x8621A03FE0BBDB7Bull,
+    0x8E1F7555983AA92Full, 0xB54E0F1600CC4D19ull, 0x84BB3F97971D80ABull,
+    0x7D29825C75521255ull, 0xC3CF17102B7F7F86ull, 0x3466E9A083914F64ull,
+    0xD81A8D2B5A4485ACull, 0xDB01602B100B9ED7ull, 0xA9038A921825F10Dull,
+    0xEDF5F1D90DCA2F6Aull, 0x54496AD67BD2634Cull, 0xDD7C01D4F5407269ull,
+};
+
+inline uint64_t read64(const byte *ptr) noexcept {
+  uint64_t retval;
+  std::memcpy(&retval, ptr, sizeof(retval));
+  return retval;
+}
+
+inline uint32_t read32(const byte *ptr) noexcept {
+  uint32_t retval;
+  std::memcpy(&retval, ptr, sizeof(retval));
+  return retval;
+}
+
+constexpr uint64_t rotl64(uint64_t val, int shift) noexcept {
+  return (val << shift) | (val >> (64 - shift));
+}
+
+constexpr uint64_t swap64(uint64_t val) noexcept {
+  val = ((val << 8) & 0xFF00FF00FF00FF00ull) |
+        ((val >> 8) & 0x00FF00FF00FF00FFull);
+  val = ((val << 16) & 0xFFFF0000FFFF0000ull) |
+        ((val >> 16) & 0x0000FFFF0000FFFFull);
+  return (val << 32) | (val >> 32);
+}
+
+/**\brief multiply two 64-bit values and fold 128-bit product to 64 bits
+ */
+inline uint64_t mul128fold64(uint64_t lhs, uint64_t rhs) noexcept {
+#if defined(__SIZEOF_INT128__)
+  __extension__ using uint128_t = unsigned __int128;
+
+  uint128_t product = uint128_t(lhs) * rhs;
+  return uint64_t(product) ^ uint64_t(product >> 64);
+#else
+  uint64_t lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+  uint64_t hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+  uint64_t lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+  uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+  uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+  return lower ^ upper;
+#endif
+}
+
+constexpr uint64_t avalanche(uint64_t hash) noexcept {
+  hash ^= hash >> 37;
+  hash *= 0x165667919E3779F9ull;
+  return hash ^ (hash >> 32);
+}
+
+inline uint64_t
+mix16(const byte *ptr, const uint64_t *secret, uint64_t seed) noexcept {
+  return mul128fold64(read64(ptr) ^ (secret[0] + seed),
+                      read64(ptr + 8) ^ (secret[1] - seed));
+}
+
+/**\brief input from 0 to 16 bytes
+ */
+inline uint64_t
+hashShort(const byte *ptr, size_t length, uint64_t seed) noexcept {
+  if (length > 8) {
+    uint64_t lo = read64(ptr) ^ (hashSecret[2] + seed);
+    uint64_t hi = read64(ptr + length - 8) ^ (hashSecret[3] - seed);
+    return avalanche(length + swap64(lo) + hi + mul128fold64(lo, hi));
+  }
+
+  if (length >= 4) {
+    uint64_t lo   = read32(ptr);
+    uint64_t hi   = read32(ptr + length - 4);
+    uint64_t hash = (hi + (lo << 32)) ^ (hashSecret[1] - seed);
+    hash ^= rotl64(hash, 49) ^ rotl64(hash, 24);
+    hash *= 0x9FB21C651E98DF25ull;
+    hash ^= (hash >> 35) + length;
+    hash *= 0x9FB21C651E98DF25ull;
+    return hash ^ (hash >> 28);
+  }
+
+  if (length > 0) {
+    uint32_t combined = (uint32_t(ptr[0]) << 16) |
+                        (uint32_t(ptr[length >> 1]) << 24) |
+                        uint32_t(ptr[length - 1]) | uint32_t(length << 8);
+    return avalanche(combined ^
+                     ((hashSecret[0] ^ (hashSecret[0] >> 32)) + seed));
+  }
+
+  return avalanche(seed ^ hashSecret[0] ^ hashSecret[1]);
+}
+
+/**\brief input from 17 to 256 bytes
+ */
+inline uint64_t
+hashMedium(const byte *ptr, size_t length, uint64_t seed) noexcept {
+  uint64_t acc    = length * prime64_1 + seed;
+  size_t   chunks = (length - 1) / 16;
+  for (size_t i = 0; i < chunks; ++i) {
+    acc += mix16(ptr + 16 * i, hashSecret + (2 * i) % 22, seed);
+  }
+  acc += mix16(ptr + length - 16, hashSecret + 22, seed);
+  return avalanche(acc);
+}
+
+/**\brief acc[i] += data[i ^ 1] + lo32(data[i] ^ secret[i]) *
+ * hi32(data[i] ^ secret[i]). SIMD and scalar versions give same result
+ */
+inline void accumulateStripe(uint64_t       *acc,
+                             const byte     *ptr,
+                             const uint64_t *secret) noexcept {
+#if defined(__AVX2__)
+  for (int i = 0; i < 2; ++i) {
+    __m256i data =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr) + i);
+    __m256i key =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret) + i);
+    __m256i dataKey = _mm256_xor_si256(data, key);
+    __m256i product =
+        _mm256_mul_epu32(dataKey, _mm256_srli_epi64(dataKey, 32));
+    __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    __m256i *accPtr = reinterpret_cast<__m256i *>(acc) + i;
+    _mm256_storeu_si256(
+        accPtr,
+        _mm256_add_epi64(_mm256_loadu_si256(accPtr),
+                         _mm256_add_epi64(product, swapped)));
+  }
+#elif defined(__SSE2__)
+  for (int i = 0; i < 4; ++i) {
+    __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr) + i);
+    __m128i key =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(secret) + i);
+    __m128i dataKey = _mm_xor_si128(data, key);
+    __m128i product = _mm_mul_epu32(dataKey, _mm_srli_epi64(dataKey, 32));
+    __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    __m128i *accPtr = reinterpret_cast<__m128i *>(acc) + i;
+    _mm_storeu_si128(accPtr,
+                     _mm_add_epi64(_mm_loadu_si128(accPtr),
+                                   _mm_add_epi64(product, swapped)));
+  }
+#else
+  for (int i = 0; i < 8; ++i) {
+    uint64_t data    = read64(ptr + 8 * i);
+    uint64_t dataKey = data ^ secret[i];
+    acc[i ^ 1] += data;
+    acc[i] += (dataKey & 0xFFFFFFFF) * (dataKey >> 32);
+  }
+#endif
+}
+
+inline void scramble(uint64_t *acc) noexcept {
+  for (int i = 0; i < 8; ++i) {
+    acc[i] = (acc[i] ^ (acc[i] >> 47) ^ hashSecret[8 + i]) * prime32_1;
+  }
+}
+
+/**\brief input more then 256 bytes, processed by stripes of 64 bytes
+ */
+inline uint64_t
+hashLong(const byte *ptr, size_t length, uint64_t seed) noexcept {
+  alignas(32) uint64_t acc[8]{prime32_3 + seed,
+                              prime64_1 - seed,
+                              prime64_2 + seed,
+                              prime64_3 - seed,
+                              prime64_4 + seed,
+                              prime32_2 - seed,
+                              prime64_5 + seed,
+                              prime32_1 - seed};
+
+  size_t blocks = (length - 1) / hashBlockLength;
+  for (size_t block = 0; block < blocks; ++block) {
+    const byte *blockPtr = ptr + block * hashBlockLength;
+    for (size_t stripe = 0; stripe < hashBlockStripes; ++stripe) {
+      accumulateStripe(acc,
+                       blockPtr + stripe * hashStripeLength,
+                       hashSecret + stripe);
+    }
+    scramble(acc);
+  }
+
+  const byte *blockPtr = ptr + blocks * hashBlockLength;
+  size_t      stripes =
+      ((length - 1) - blocks * hashBlockLength) / hashStripeLength;
+  for (size_t stripe = 0; stripe < stripes; ++stripe) {
+    accumulateStripe(acc,
+                     blockPtr + stripe * hashStripeLength,
+                     hashSecret + stripe);
+  }
+  // last stripe can overlap previous one
+  accumulateStripe(acc, ptr + length - hashStripeLength, hashSecret + 16);
+
+  uint64_t result = length * prime64_1;
+  for (int i = 0; i < 4; ++i) {
+    result += mul128fold64(acc[2 * i] ^ hashSecret[2 * i + 1],
+                           acc[2 * i + 1] ^ hashSecret[2 * i + 2]);
+  }
+  return avalanche(result);
+}
+} // namespace detail
+
+/**\brief 64-bit non-cryptographic hash of bytes. Long inputs are processed by
+ * SIMD instructions if they are available (SSE2 or AVX2), result not depends
+ * on used instructions
+ */
+inline uint64_t
+hash64(const void *data, size_t length, uint64_t seed = 0) noexcept {
+  const byte *ptr = reinterpret_cast<const byte *>(data);
+  if (length <= 16) {
+    return detail::hashShort(ptr, length, seed);
+  }
+  if (length <= 256) {
+    return detail::hashMedium(ptr, length, seed);
+  }
+  return detail::hashLong(ptr, length, seed);
+}
+
+/**\return hash of serialized bytes of the document, so documents with same
+ * values in different order have different hashes
+ */
+inline uint64_t hash64(Document doc, uint64_t seed = 0) noexcept {
+  if (doc.empty()) {
+    constexpr byte emptyDocument[MINIMAL_SIZE_OF_BSON_DOCUMENT]{
+        MINIMAL_SIZE_OF_BSON_DOCUMENT};
+    return hash64(emptyDocument, MINIMAL_SIZE_OF_BSON_DOCUMENT, seed);
+  }
+  return hash64(doc.data(), doc.length(), seed);
+}
+
+/**\brief order-insensitive hash of the document: hashes of keys and values of
+ * every node are combined by commutative operation, nested documents and
+ * arrays are hashed recursively. Documents with same values in different
+ * order have same hash
+ * \param doc valid bson document, @see Document::valid
+ */
+inline uint64_t structuralHash(Document doc, uint64_t seed = 0) noexcept {
+  uint64_t sum   = 0;
+  uint64_t count = 0;
+  for (Node node : doc) {
+    std::string_view key = node.key();
+
+    int         header = SIZE_OF_BSON_TYPE + key.size() + SIZE_OF_ZERO_BYTE;
+    const byte *value  = reinterpret_cast<const byte *>(node.data()) + header;
+    int         length = node.length() - header;
+
+    uint64_t valueHash = 0;
+    if (node.type() == bson::document_node || node.type() == bson::array_node) {
+      valueHash = structuralHash(Document{value, length}, seed);
+    } else {
+      valueHash = hash64(value, length, seed);
+    }
+
+    sum += hash64(key.data(),
+                  key.size(),
+                  valueHash ^ (uint64_t(node.type()) * detail::prime64_2));
+    ++count;
+  }
+
+  return detail::avalanche(sum ^ (count * detail::prime64_1) ^ seed);
+}
+} // namespace microbson
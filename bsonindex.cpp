@@ -0,0 +1,92 @@
+// bsonindex.cpp
+// command line tool for build secondary index of batch file and lookup record
+// numbers by it
+
+#include "bsonindex.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+void usage(const char *program) {
+  std::cerr << "usage:" << std::endl
+            << "  " << program
+            << " build <batch file> <field> <int64|double|string> <index file>"
+               " [threads]"
+            << std::endl
+            << "  " << program
+            << " find <index file> <value> [<upper value>]"
+            << std::endl;
+}
+
+template <class T>
+void printRecords(const microbson::SecondaryIndex &index,
+                  const T                         &lower,
+                  const T                         &upper) {
+  auto [first, last] = index.range(lower, upper);
+  for (size_t i = first; i < last; ++i) {
+    std::cout << index.record(i) << std::endl;
+  }
+}
+
+int build(int argc, char *argv[]) {
+  using microbson::SecondaryIndex;
+
+  SecondaryIndex::KeyType type;
+  if (std::strcmp(argv[4], "int64") == 0) {
+    type = SecondaryIndex::int64_key;
+  } else if (std::strcmp(argv[4], "double") == 0) {
+    type = SecondaryIndex::double_key;
+  } else if (std::strcmp(argv[4], "string") == 0) {
+    type = SecondaryIndex::string_key;
+  } else {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  size_t threads = argc > 6 ? std::stoul(argv[6]) : 0;
+
+  microbson::BatchReader batch{argv[2]};
+  SecondaryIndex::build(batch, argv[3], type, argv[5], threads);
+  return EXIT_SUCCESS;
+}
+
+int find(int argc, char *argv[]) {
+  using microbson::SecondaryIndex;
+
+  SecondaryIndex index{argv[2]};
+
+  const char *lower = argv[3];
+  const char *upper = argc > 4 ? argv[4] : argv[3];
+  switch (index.type()) {
+  case SecondaryIndex::int64_key:
+    printRecords(index, int64_t(std::stoll(lower)), int64_t(std::stoll(upper)));
+    break;
+  case SecondaryIndex::double_key:
+    printRecords(index, std::stod(lower), std::stod(upper));
+    break;
+  case SecondaryIndex::string_key:
+    printRecords(index, std::string_view{lower}, std::string_view{upper});
+    break;
+  }
+  return EXIT_SUCCESS;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    if (argc >= 6 && std::strcmp(argv[1], "build") == 0) {
+      return build(argc, argv);
+    }
+    if (argc >= 4 && std::strcmp(argv[1], "find") == 0) {
+      return find(argc, argv);
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  usage(argv[0]);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,553 @@
+// bsonindex.hpp
+
+#pragma once
+
+#include "bsonbatch.hpp"
+#include "microbson.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define BSON_INDEX_MAGIC "BSONSIX1"
+#define SIZE_OF_BSON_INDEX_HEADER 40
+
+namespace microbson {
+/**\brief persistent sorted index of values of one field of batch file, @see
+ * BatchReader. Every entry of the index is value of the field and record number
+ * of document in the batch file. Entries are sorted by values (and by record
+ * numbers for same values), so point and range lookups are binary searches
+ * over mapped index file.
+ *
+ * Values of int64 index are int32 and int64 values, values of double index are
+ * int32, int64 and double values (as bson::Scalar, NaN is not indexed), values
+ * of string index are strings. Documents without the field or with value of
+ * other type are not indexed.
+ *
+ * Usage:
+ * ```
+ * microbson::BatchReader batch{"data.bsonbatch"};
+ * microbson::SecondaryIndex::build(batch,
+ *                                  "user.id",
+ *                                  microbson::SecondaryIndex::int64_key,
+ *                                  "data.user_id.bsonindex");
+ * microbson::SecondaryIndex index{"data.user_id.bsonindex"};
+ * for (microbson::Document doc : index.find(batch, 42)) { ... }
+ * ```
+ */
+class SecondaryIndex final {
+public:
+  enum KeyType {
+    int64_key,
+    double_key,
+    string_key,
+  };
+
+  /**\brief builds index of the field and writes it in the file. Records of the
+   * batch file are split in equal ranges, which are read and sorted in
+   * parallel, after that sorted ranges are merged
+   * \param field path of the field, keys of nested documents and arrays must be
+   * separated by BSON_PATH_DELIMITER
+   * \param threads count of threads, if 0 then hardware concurrency is used
+   * \throw bson::SystemError if can not write the file
+   */
+  static void build(const BatchReader &batch,
+                    std::string_view   field,
+                    KeyType            type,
+                    const std::string &path,
+                    size_t             threads = 0) noexcept(false);
+
+  /**\throw bson::SystemError if can not open or map the file
+   * \throw bson::InvalidArgument if the file is not index file
+   */
+  explicit SecondaryIndex(const std::string &path) noexcept(false);
+
+  ~SecondaryIndex() noexcept;
+
+  SecondaryIndex(const SecondaryIndex &) = delete;
+  SecondaryIndex &operator=(const SecondaryIndex &) = delete;
+
+  /**\return count of entries
+   */
+  [[nodiscard]] size_t size() const noexcept { return count_; }
+
+  [[nodiscard]] KeyType type() const noexcept { return type_; }
+
+  /**\return path of indexed field
+   */
+  [[nodiscard]] std::string_view field() const noexcept { return field_; }
+
+  /**\return record number of the entry in the batch file
+   */
+  [[nodiscard]] uint64_t record(size_t entry) const noexcept {
+    uint64_t retval;
+    std::memcpy(&retval,
+                entries_ + entry * this->entrySize() + this->entrySize() -
+                    sizeof(uint64_t),
+                sizeof(uint64_t));
+    return retval;
+  }
+
+  /**\return range of entries [first, second) with values equal to the value
+   * \throw bson::BadCast if type of the value not corresponds to type of the
+   * index (integer for int64 index, number for double index, string for
+   * string index)
+   */
+  template <class T>
+  std::pair<size_t, size_t> equalRange(const T &val) const noexcept(false) {
+    Key key = this->makeKey(val);
+    return {this->lowerBound(key), this->upperBound(key)};
+  }
+
+  /**\return range of entries [first, second) with values in [lower, upper]
+   * \throw bson::BadCast if type of the values not corresponds to type of the
+   * index
+   */
+  template <class T>
+  std::pair<size_t, size_t> range(const T &lower, const T &upper) const
+      noexcept(false) {
+    size_t first = this->lowerBound(this->makeKey(lower));
+    size_t last  = this->upperBound(this->makeKey(upper));
+    return {first, std::max(first, last)};
+  }
+
+  /**\return documents with values equal to the value, in order of record
+   * numbers
+   * \param batch the batch file, for which the index was built
+   * \throw bson::BadCast if type of the value not corresponds to type of the
+   * index
+   * \throw bson::OutOfRange or bson::InvalidArgument if the index not
+   * corresponds to the batch file, @see BatchReader::at
+   */
+  template <class T>
+  std::vector<Document> find(const BatchReader &batch, const T &val) const
+      noexcept(false) {
+    return this->documents(batch, this->equalRange(val));
+  }
+
+  /**\return documents with values in [lower, upper], ordered by values
+   */
+  template <class T>
+  std::vector<Document>
+  find(const BatchReader &batch, const T &lower, const T &upper) const
+      noexcept(false) {
+    return this->documents(batch, this->range(lower, upper));
+  }
+
+private:
+  struct Key {
+    int64_t          integer = 0;
+    double           number  = 0;
+    std::string_view text;
+  };
+
+  template <class T>
+  Key makeKey(const T &val) const noexcept(false) {
+    Key retval;
+    if constexpr (std::is_same<T, bool>::value) {
+      throw bson::BadCast{};
+    } else if constexpr (std::is_arithmetic<T>::value) {
+      if (type_ == string_key ||
+          (type_ == int64_key && !std::is_integral<T>::value)) {
+        throw bson::BadCast{};
+      }
+      retval.integer = int64_t(val);
+      retval.number  = double(val);
+    } else {
+      static_assert(std::is_convertible<T, std::string_view>::value,
+                    "value can be only number or string");
+      if (type_ != string_key) {
+        throw bson::BadCast{};
+      }
+      retval.text = std::string_view{val};
+    }
+    return retval;
+  }
+
+  size_t entrySize() const noexcept {
+    return type_ == string_key ? 3 * sizeof(uint64_t) : 2 * sizeof(uint64_t);
+  }
+
+  /**\return negative, zero or positive value if value of the entry is less,
+   * equal or greater than the key
+   */
+  int compare(size_t entry, const Key &key) const noexcept;
+
+  size_t lowerBound(const Key &key) const noexcept;
+  size_t upperBound(const Key &key) const noexcept;
+
+  std::vector<Document> documents(const BatchReader        &batch,
+                                  std::pair<size_t, size_t> found) const
+      noexcept(false);
+
+private:
+  int                                 fd_;
+  std::unique_ptr<detail::MappedFile> file_;
+  KeyType                             type_;
+  std::string_view                    field_;
+  size_t                              count_;
+  const byte                         *entries_;
+  const char                         *strings_;
+};
+
+namespace detail {
+template <class K>
+struct IndexEntry {
+  K        key;
+  uint64_t record;
+
+  bool operator<(const IndexEntry &rhs) const noexcept {
+    return key < rhs.key || (!(rhs.key < key) && record < rhs.record);
+  }
+};
+
+/**\brief reads values of the field from records [begin, end) and sorts them
+ */
+template <class K>
+void collectEntries(const BatchReader          &batch,
+                    std::string_view            field,
+                    size_t                      begin,
+                    size_t                      end,
+                    std::vector<IndexEntry<K>> &entries) noexcept {
+  for (size_t i = begin; i < end; ++i) {
+    Document doc = batch[i];
+    if (doc.empty()) {
+      continue;
+    }
+
+    const byte *found = findNode(doc, field);
+    if (found == nullptr) {
+      continue;
+    }
+
+    Node           node{found};
+    bson::NodeType nodeType = node.type();
+    if constexpr (std::is_same<K, std::string_view>::value) {
+      if (nodeType == bson::string_node) {
+        entries.emplace_back(
+            IndexEntry<K>{node.value<std::string_view>(), uint64_t(i)});
+      }
+    } else if constexpr (std::is_same<K, int64_t>::value) {
+      if (nodeType == bson::int32_node) {
+        entries.emplace_back(IndexEntry<K>{node.value<int32_t>(), uint64_t(i)});
+      } else if (nodeType == bson::int64_node) {
+        entries.emplace_back(IndexEntry<K>{node.value<int64_t>(), uint64_t(i)});
+      }
+    } else {
+      if (nodeType == bson::double_node || nodeType == bson::int32_node ||
+          nodeType == bson::int64_node) {
+        double val = node.value<bson::Scalar>();
+        if (val == val) { // NaN is not ordered
+          entries.emplace_back(IndexEntry<K>{val, uint64_t(i)});
+        }
+      }
+    }
+  }
+
+  std::sort(entries.begin(), entries.end());
+}
+
+/**\brief builds sorted entries of all records by several threads
+ */
+template <class K>
+std::vector<IndexEntry<K>> sortedEntries(const BatchReader &batch,
+                                         std::string_view   field,
+                                         size_t threads) noexcept(false) {
+  threads = std::max<size_t>(1, std::min(threads, batch.size()));
+
+  std::vector<std::vector<IndexEntry<K>>> parts(threads);
+  std::vector<std::thread>                workers;
+  for (size_t i = 0; i < threads; ++i) {
+    size_t begin = batch.size() * i / threads;
+    size_t end   = batch.size() * (i + 1) / threads;
+    workers.emplace_back([&batch, field, begin, end, &part = parts[i]]() {
+      collectEntries(batch, field, begin, end, part);
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  // merge sorted parts pairwise
+  while (parts.size() > 1) {
+    std::vector<std::vector<IndexEntry<K>>> merged;
+    for (size_t i = 0; i + 1 < parts.size(); i += 2) {
+      std::vector<IndexEntry<K>> both(parts[i].size() + parts[i + 1].size());
+      std::merge(parts[i].begin(),
+                 parts[i].end(),
+                 parts[i + 1].begin(),
+                 parts[i + 1].end(),
+                 both.begin());
+      merged.emplace_back(std::move(both));
+    }
+    if (parts.size() % 2) {
+      merged.emplace_back(std::move(parts.back()));
+    }
+    parts = std::move(merged);
+  }
+  return std::move(parts.front());
+}
+
+/**\brief buffered writing in file descriptor
+ */
+class FileWriter final {
+public:
+  explicit FileWriter(int fd) noexcept
+      : fd_{fd} {}
+
+  void write(const void *data, size_t length) noexcept(false) {
+    const byte *begin = reinterpret_cast<const byte *>(data);
+    pending_.insert(pending_.end(), begin, begin + length);
+    if (pending_.size() >= (1 << 20)) {
+      this->flush();
+    }
+  }
+
+  void flush() noexcept(false) {
+    writeAll(fd_, pending_.data(), pending_.size());
+    pending_.clear();
+  }
+
+private:
+  int               fd_;
+  std::vector<byte> pending_;
+};
+
+template <class K>
+void writeIndex(int                               fd,
+                std::string_view                  field,
+                SecondaryIndex::KeyType           type,
+                const std::vector<IndexEntry<K>> &entries) noexcept(false) {
+  uint64_t stringsSize = 0;
+  if constexpr (std::is_same<K, std::string_view>::value) {
+    for (const IndexEntry<K> &entry : entries) {
+      stringsSize += entry.key.size();
+    }
+  }
+
+  byte     header[SIZE_OF_BSON_INDEX_HEADER] = {};
+  uint32_t keyType                           = type;
+  uint32_t fieldLength                       = field.size();
+  uint64_t count                             = entries.size();
+  std::memcpy(header, BSON_INDEX_MAGIC, SIZE_OF_BSON_BATCH_MAGIC);
+  std::memcpy(header + 8, &keyType, sizeof(uint32_t));
+  std::memcpy(header + 12, &fieldLength, sizeof(uint32_t));
+  std::memcpy(header + 16, &count, sizeof(uint64_t));
+  std::memcpy(header + 24, &stringsSize, sizeof(uint64_t));
+  uint32_t checksum =
+      crc32c(field.data(), field.size(), crc32c(header + 8, 24));
+  std::memcpy(header + 32, &checksum, sizeof(uint32_t));
+
+  FileWriter out{fd};
+  out.write(header, sizeof(header));
+  out.write(field.data(), field.size());
+  const byte padding[8] = {};
+  out.write(padding, (8 - field.size() % 8) % 8);
+
+  uint64_t stringOffset = 0;
+  for (const IndexEntry<K> &entry : entries) {
+    if constexpr (std::is_same<K, std::string_view>::value) {
+      uint64_t length = entry.key.size();
+      out.write(&stringOffset, sizeof(uint64_t));
+      out.write(&length, sizeof(uint64_t));
+      stringOffset += length;
+    } else {
+      out.write(&entry.key, sizeof(K));
+    }
+    out.write(&entry.record, sizeof(uint64_t));
+  }
+
+  if constexpr (std::is_same<K, std::string_view>::value) {
+    for (const IndexEntry<K> &entry : entries) {
+      out.write(entry.key.data(), entry.key.size());
+    }
+  }
+  out.flush();
+}
+
+template <class K>
+void buildIndex(const BatchReader      &batch,
+                std::string_view        field,
+                SecondaryIndex::KeyType type,
+                int                     fd,
+                size_t                  threads) noexcept(false) {
+  writeIndex(fd, field, type, sortedEntries<K>(batch, field, threads));
+}
+} // namespace detail
+
+inline void SecondaryIndex::build(const BatchReader &batch,
+                                  std::string_view   field,
+                                  KeyType            type,
+                                  const std::string &path,
+                                  size_t             threads) {
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    detail::throwSystemError("can not open index file " + path);
+  }
+
+  try {
+    switch (type) {
+    case int64_key:
+      detail::buildIndex<int64_t>(batch, field, type, fd, threads);
+      break;
+    case double_key:
+      detail::buildIndex<double>(batch, field, type, fd, threads);
+      break;
+    case string_key:
+      detail::buildIndex<std::string_view>(batch, field, type, fd, threads);
+      break;
+    }
+    if (::fsync(fd) != 0) {
+      detail::throwSystemError("can not sync index file");
+    }
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+}
+
+inline SecondaryIndex::SecondaryIndex(const std::string &path)
+    : fd_{-1}
+    , type_{int64_key}
+    , count_{0}
+    , entries_{nullptr}
+    , strings_{nullptr} {
+  fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    detail::throwSystemError("can not open index file " + path);
+  }
+
+  try {
+    file_ = std::make_unique<detail::MappedFile>(fd_);
+
+    const byte *data = file_->data();
+    size_t      size = file_->size();
+    if (size < SIZE_OF_BSON_INDEX_HEADER ||
+        std::memcmp(data, BSON_INDEX_MAGIC, SIZE_OF_BSON_BATCH_MAGIC) != 0) {
+      throw bson::InvalidArgument{"not a bson index file"};
+    }
+
+    uint32_t keyType;
+    uint32_t fieldLength;
+    uint64_t count;
+    uint64_t stringsSize;
+    uint32_t checksum;
+    std::memcpy(&keyType, data + 8, sizeof(uint32_t));
+    std::memcpy(&fieldLength, data + 12, sizeof(uint32_t));
+    std::memcpy(&count, data + 16, sizeof(uint64_t));
+    std::memcpy(&stringsSize, data + 24, sizeof(uint64_t));
+    std::memcpy(&checksum, data + 32, sizeof(uint32_t));
+    if (keyType > string_key ||
+        fieldLength > size - SIZE_OF_BSON_INDEX_HEADER ||
+        checksum != crc32c(data + SIZE_OF_BSON_INDEX_HEADER,
+                           fieldLength,
+                           crc32c(data + 8, 24))) {
+      throw bson::InvalidArgument{"damaged bson index file"};
+    }
+
+    type_  = KeyType(keyType);
+    field_ = std::string_view{
+        reinterpret_cast<const char *>(data + SIZE_OF_BSON_INDEX_HEADER),
+        fieldLength};
+
+    size_t entriesOffset =
+        SIZE_OF_BSON_INDEX_HEADER + (fieldLength + 7) / 8 * 8;
+    if (entriesOffset > size ||
+        (size - entriesOffset) / this->entrySize() < count ||
+        size - entriesOffset - count * this->entrySize() != stringsSize) {
+      throw bson::InvalidArgument{"damaged bson index file"};
+    }
+
+    count_   = count;
+    entries_ = data + entriesOffset;
+    strings_ = reinterpret_cast<const char *>(entries_ +
+                                              count_ * this->entrySize());
+  } catch (...) {
+    file_.reset();
+    ::close(fd_);
+    throw;
+  }
+}
+
+inline SecondaryIndex::~SecondaryIndex() noexcept {
+  file_.reset();
+  ::close(fd_);
+}
+
+inline int SecondaryIndex::compare(size_t     entry,
+                                   const Key &key) const noexcept {
+  const byte *current = entries_ + entry * this->entrySize();
+  switch (type_) {
+  case int64_key: {
+    int64_t val;
+    std::memcpy(&val, current, sizeof(int64_t));
+    return val < key.integer ? -1 : (val > key.integer ? 1 : 0);
+  }
+  case double_key: {
+    double val;
+    std::memcpy(&val, current, sizeof(double));
+    return val < key.number ? -1 : (val > key.number ? 1 : 0);
+  }
+  case string_key: {
+    uint64_t offset;
+    uint64_t length;
+    std::memcpy(&offset, current, sizeof(uint64_t));
+    std::memcpy(&length, current + 8, sizeof(uint64_t));
+    return std::string_view{strings_ + offset, length}.compare(key.text);
+  }
+  }
+  return 0;
+}
+
+inline size_t SecondaryIndex::lowerBound(const Key &key) const noexcept {
+  size_t first = 0;
+  size_t count = count_;
+  while (count > 0) {
+    size_t step = count / 2;
+    if (this->compare(first + step, key) < 0) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return first;
+}
+
+inline size_t SecondaryIndex::upperBound(const Key &key) const noexcept {
+  size_t first = 0;
+  size_t count = count_;
+  while (count > 0) {
+    size_t step = count / 2;
+    if (this->compare(first + step, key) <= 0) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return first;
+}
+
+inline std::vector<Document>
+SecondaryIndex::documents(const BatchReader        &batch,
+                          std::pair<size_t, size_t> found) const {
+  std::vector<Document> retval;
+  retval.reserve(found.second - found.first);
+  for (size_t i = found.first; i < found.second; ++i) {
+    retval.emplace_back(batch.at(this->record(i)));
+  }
+  return retval;
+}
+} // namespace microbson
@@ -0,0 +1,265 @@
+// bsonoverlay.hpp
+
+#pragma once
+
+#include "bsonpatch.hpp"
+#include "microbson.hpp"
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace microbson {
+/**\brief editable view of serialized document. Sets and erases are recorded as
+ * operations of `Patch`, reads of not changed values go directly to the source
+ * buffer. Serialization merges the source with the edits, unchanged nodes are
+ * copied by blocks, so cost of edits not depends on size of the document.
+ *
+ * Keys of nested documents and arrays in paths must be separated by
+ * BSON_PATH_DELIMITER. Set creates missing parent documents.
+ * \warning source buffer must live while the overlay is used. Documents,
+ * arrays, strings and binaries returned by `get` are views, which can be
+ * invalidated by next edit of same path
+ */
+class OverlayDocument final {
+public:
+  /**\param source valid bson document, @see Document::valid
+   */
+  explicit OverlayDocument(Document source) noexcept
+      : source_{source} {}
+
+  /**\throw bson::InvalidArgument if path conflicts with previous edits (set of
+   * nested value of set or erased value)
+   */
+  template <class InsertType>
+  OverlayDocument &set(std::string_view  path,
+                       const InsertType &val) noexcept(false) {
+    patch_.set(path, val);
+    this->record(path);
+    return *this;
+  }
+
+  /**\brief set null value
+   */
+  OverlayDocument &set(std::string_view path) noexcept(false) {
+    patch_.set(path);
+    this->record(path);
+    return *this;
+  }
+
+  /**\param value serialized value without type and key, for example
+   * serialized document
+   */
+  OverlayDocument &set(std::string_view    path,
+                       bson::NodeType      type,
+                       std::vector<byte> &&value) noexcept(false) {
+    patch_.set(path, type, std::move(value));
+    this->record(path);
+    return *this;
+  }
+
+  /**\brief erase of not existing value does nothing
+   */
+  OverlayDocument &erase(std::string_view path) noexcept(false) {
+    patch_.unset(path);
+    this->record(path);
+    return *this;
+  }
+
+  [[nodiscard]] bool contains(std::string_view path) const noexcept {
+    return this->find(path).type != bson::unknown_node ||
+           this->createdByEdits(path);
+  }
+
+  template <class Type>
+  [[nodiscard]] bool contains(std::string_view path) const noexcept {
+    constexpr bool nested = std::is_same<Type, Document>::value ||
+                            std::is_same<Type, Array>::value;
+    if (nested && this->createdByEdits(path)) {
+      return std::is_same<Type, Document>::value;
+    }
+
+    bson::NodeType type = this->find(path).type;
+    if constexpr (std::is_same<Type, bson::Scalar>::value) {
+      return type == bson::double_node || type == bson::int32_node ||
+             type == bson::int64_node;
+    } else {
+      return type == type_traits<Type>::node_type_code;
+    }
+  }
+
+  /**\throw bson::OutOfRange if not have the value, bson::BadCast if have not
+   * same type, or bson::InvalidArgument if requested document or array has
+   * edits of nested values (serialize the overlay for read them)
+   */
+  template <class InputType>
+  typename type_traits<InputType>::return_type
+  get(std::string_view path) const noexcept(false);
+
+  /**\return true if the overlay has some edits
+   */
+  [[nodiscard]] bool edited() const noexcept { return !edits_.empty(); }
+
+  [[nodiscard]] Document source() const noexcept { return source_; }
+
+  /**\return all recorded operations
+   */
+  [[nodiscard]] const Patch &patch() const noexcept { return patch_; }
+
+  /**\brief append merged document to the output buffer
+   * \return length of result document
+   * \throw bson::InvalidArgument if set requires document, but in source by the
+   * path is some other value
+   */
+  int serialize(std::vector<byte> &out) const noexcept(false) {
+    return patch_.apply(source_, out);
+  }
+
+  std::vector<byte> serialize() const noexcept(false) {
+    return patch_.apply(source_);
+  }
+
+private:
+  struct Value {
+    bson::NodeType type = bson::unknown_node;
+    const void    *data = nullptr;
+  };
+
+  /**\brief remember last operation of the patch as current edit by the path.
+   * Edits of nested values are overwritten by the edit
+   */
+  void record(std::string_view path) noexcept(false);
+
+  /**\return type and pointer to value by the path, or unknown_node if the value
+   * not exists or erased
+   */
+  Value find(std::string_view path) const noexcept;
+
+  /**\return true if nested values of the path are edited
+   */
+  bool nestedEdits(std::string_view path, bool onlySets) const noexcept;
+
+  /**\return true if the path not exists in the source, but will be created as
+   * parent of set value
+   */
+  bool createdByEdits(std::string_view path) const noexcept {
+    return this->find(path).type == bson::unknown_node &&
+           this->nestedEdits(path, true);
+  }
+
+private:
+  Document source_;
+  Patch    patch_;
+  /**\brief path -> index of last operation of the patch by the path
+   */
+  std::map<std::string, size_t, std::less<>> edits_;
+};
+
+inline void OverlayDocument::record(std::string_view path) {
+  std::string prefix{path};
+  prefix += BSON_PATH_DELIMITER;
+  auto first = edits_.lower_bound(prefix);
+  auto last  = first;
+  while (last != edits_.end() &&
+         std::string_view{last->first}.substr(0, prefix.size()) == prefix) {
+    ++last;
+  }
+  edits_.erase(first, last);
+
+  prefix.pop_back();
+  edits_.insert_or_assign(std::move(prefix), patch_.operations().size() - 1);
+}
+
+inline bool OverlayDocument::nestedEdits(std::string_view path,
+                                         bool             onlySets) const
+    noexcept {
+  std::string prefix{path};
+  prefix += BSON_PATH_DELIMITER;
+  for (auto iter = edits_.lower_bound(prefix);
+       iter != edits_.end() &&
+       std::string_view{iter->first}.substr(0, prefix.size()) == prefix;
+       ++iter) {
+    if (!onlySets ||
+        patch_.operations()[iter->second].type == Patch::set_operation) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline OverlayDocument::Value
+OverlayDocument::find(std::string_view path) const noexcept {
+  auto valueOf = [](const byte *node) {
+    Node view{node};
+    return Value{view.type(),
+                 node + SIZE_OF_BSON_TYPE + view.key().size() +
+                     SIZE_OF_ZERO_BYTE};
+  };
+
+  // edit of the value or of some parent document
+  for (size_t end = path.find(BSON_PATH_DELIMITER);;
+       end        = path.find(BSON_PATH_DELIMITER, end + 1)) {
+    std::string_view key = path.substr(0, end);
+    if (auto found = edits_.find(key); found != edits_.end()) {
+      const Patch::Operation &operation = patch_.operations()[found->second];
+      if (operation.type != Patch::set_operation) {
+        return Value{};
+      }
+      if (end == path.npos) {
+        return Value{operation.valueType, operation.value.data()};
+      }
+      if (operation.valueType != bson::document_node &&
+          operation.valueType != bson::array_node) {
+        return Value{};
+      }
+
+      Document    nested{operation.value.data(), int(operation.value.size())};
+      const byte *node = detail::findNode(nested, path.substr(end + 1));
+      return node ? valueOf(node) : Value{};
+    }
+
+    if (end == path.npos) {
+      break;
+    }
+  }
+
+  const byte *node = detail::findNode(source_, path);
+  return node ? valueOf(node) : Value{};
+}
+
+template <class InputType>
+inline typename type_traits<InputType>::return_type
+OverlayDocument::get(std::string_view path) const {
+  if constexpr (std::is_same<InputType, Document>::value ||
+                std::is_same<InputType, Array>::value) {
+    if (this->nestedEdits(path, false)) {
+      throw bson::InvalidArgument{"nested values are edited by path: " +
+                                  std::string{path}};
+    }
+  }
+
+  Value value = this->find(path);
+  if (value.type == bson::unknown_node) {
+    throw bson::OutOfRange{"no value by path: " + std::string{path}};
+  }
+
+  if constexpr (std::is_same<InputType, bson::Scalar>::value) {
+    switch (value.type) {
+    case bson::double_node:
+      return *reinterpret_cast<const double *>(value.data);
+    case bson::int32_node:
+      return *reinterpret_cast<const int32_t *>(value.data);
+    case bson::int64_node:
+      return *reinterpret_cast<const int64_t *>(value.data);
+    default:
+      throw bson::BadCast{};
+    }
+  } else {
+    if (value.type != type_traits<InputType>::node_type_code) {
+      throw bson::BadCast{};
+    }
+    return type_traits<InputType>::converter(value.data);
+  }
+}
+} // namespace microbson
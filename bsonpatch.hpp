@@ -0,0 +1,412 @@
+// bsonpatch.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include "minibson.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace microbson {
+/**\brief list of set, unset and rename operations, which can be applied
+ * directly to serialized bson without building minibson::Document. Keys of
+ * nested documents and arrays in paths must be separated by
+ * BSON_PATH_DELIMITER.
+ *
+ * Operations with same path are merged: last set or unset wins. Set creates
+ * missing parent documents, unset and rename of not existing values do
+ * nothing. Rename changes only key of the value (the value stays in the same
+ * parent document) and replaces existing value with same key. Paths of all
+ * operations are keys of the source document, so renames of one document are
+ * applied at once: `rename("a", "b").rename("b", "a")` swaps the values, and
+ * rename to the same key does nothing. Two renames to one key and other
+ * operations by key, which is a target of rename, are rejected.
+ * \warning unset of array item not reindex other items of the array
+ */
+class Patch final {
+public:
+  enum OperationType {
+    set_operation,
+    unset_operation,
+    rename_operation,
+  };
+
+  struct Operation {
+    OperationType type;
+    std::string   path;
+    /**\brief new key for rename operation
+     */
+    std::string name;
+    /**\brief type and serialized value (without key) for set operation
+     */
+    bson::NodeType    valueType = bson::unknown_node;
+    std::vector<byte> value;
+  };
+
+  Patch() noexcept = default;
+
+  /**\throw bson::InvalidArgument if path conflicts with previous operations
+   */
+  template <class InsertType,
+            typename = typename std::enable_if<
+                !std::is_convertible<InsertType, const char *>::value>::type>
+  Patch &set(std::string_view path, const InsertType &val) noexcept(false) {
+    minibson::UNodeValue node = minibson::UNodeValueFactory::create(val);
+
+    std::vector<byte> value(node->getSerializedSize());
+    node->serialize(value.data(), value.size());
+    return this->set(path, node->type(), std::move(value));
+  }
+
+  /**\brief for c-string
+   */
+  template <class InsertType,
+            typename = typename std::enable_if<
+                std::is_convertible<InsertType, const char *>::value>::type>
+  Patch &set(std::string_view path, InsertType val) noexcept(false) {
+    return this->set(path, std::string{val});
+  }
+
+  /**\brief set null value
+   */
+  Patch &set(std::string_view path) noexcept(false) {
+    return this->set(path, bson::null_node, std::vector<byte>{});
+  }
+
+  /**\param value serialized value without type and key
+   */
+  Patch &set(std::string_view    path,
+             bson::NodeType      type,
+             std::vector<byte> &&value) noexcept(false);
+
+  /**\throw bson::InvalidArgument if path conflicts with previous operations
+   */
+  Patch &unset(std::string_view path) noexcept(false);
+
+  /**\param name new key of the value
+   * \throw bson::InvalidArgument if the name is not valid key, or it is a
+   * target of other rename, or it has own operations
+   */
+  Patch &rename(std::string_view path, std::string_view name) noexcept(false);
+
+  [[nodiscard]] bool empty() const noexcept { return operations_.empty(); }
+
+  [[nodiscard]] const std::vector<Operation> &operations() const noexcept {
+    return operations_;
+  }
+
+  /**\brief apply the patch to source document and append result to the output
+   * buffer. Unchanged sequences of nodes are copied by blocks
+   * \param source valid bson document, @see Document::valid
+   * \return length of result document
+   * \throw bson::InvalidArgument if set operation requires document, but in
+   * source by the path is some other value
+   */
+  int apply(Document source, std::vector<byte> &out) const noexcept(false);
+
+  std::vector<byte> apply(Document source) const noexcept(false);
+
+private:
+  struct PathNode {
+    enum Action { none_action, set_action, unset_action };
+
+    Action action = none_action;
+    size_t order  = 0;
+    /**\brief index of set operation
+     */
+    size_t      operation = 0;
+    std::string rename;
+
+    std::map<std::string, PathNode, std::less<>> children;
+    /**\brief new keys of renamed children -> their keys in source document
+     */
+    std::map<std::string, std::string, std::less<>> renames;
+  };
+
+  /**\param parent if not null, then parent of the node is returned by the
+   * pointer and the node is not checked as target of renames
+   * \throw bson::InvalidArgument if the path conflicts with previous
+   * operations
+   */
+  PathNode &node(std::string_view path,
+                 PathNode       **parent = nullptr) noexcept(false);
+
+  bool containsSet(const PathNode &node) const noexcept;
+
+  void applyDocument(const byte        *source,
+                     const PathNode    &level,
+                     std::vector<byte> &out) const noexcept(false);
+
+  void appendNode(bson::NodeType     type,
+                  std::string_view   key,
+                  const void        *value,
+                  int                length,
+                  std::vector<byte> &out) const noexcept;
+
+private:
+  static constexpr byte emptyDocument_[MINIMAL_SIZE_OF_BSON_DOCUMENT]{
+      MINIMAL_SIZE_OF_BSON_DOCUMENT};
+
+  std::vector<Operation> operations_;
+  PathNode               root_;
+  size_t                 counter_ = 0;
+};
+
+inline Patch::PathNode &Patch::node(std::string_view path, PathNode **parent) {
+  PathNode *current = &root_;
+  detail::forEachKey(path, [&](std::string_view key, bool last) {
+    // value by rename target is replaced, so only the renamed value or value
+    // renamed to other key can be changed by the key
+    if (current->renames.count(key) != 0 && (!last || parent == nullptr)) {
+      auto found = current->children.find(key);
+      if (found == current->children.end() || found->second.rename.empty()) {
+        throw bson::InvalidArgument{"conflict with rename to key: " +
+                                    std::string{key}};
+      }
+    }
+
+    if (last && parent != nullptr) {
+      *parent = current;
+    }
+
+    auto [child, added] = detail::childLevel(current->children, key);
+    if (added) {
+      child.order = counter_++;
+    }
+
+    if (!last && child.action != PathNode::none_action) {
+      throw bson::InvalidArgument{"conflict of operations by key: " +
+                                  std::string{key}};
+    }
+
+    current = &child;
+    return true;
+  });
+  return *current;
+}
+
+inline Patch &Patch::set(std::string_view    path,
+                         bson::NodeType      type,
+                         std::vector<byte> &&val) {
+  PathNode &leaf = this->node(path);
+  leaf.action    = PathNode::set_action;
+  leaf.operation = operations_.size();
+  leaf.children.clear();
+  leaf.renames.clear();
+
+  operations_.emplace_back(
+      Operation{set_operation, std::string{path}, {}, type, std::move(val)});
+  return *this;
+}
+
+inline Patch &Patch::unset(std::string_view path) {
+  PathNode &leaf = this->node(path);
+  leaf.action    = PathNode::unset_action;
+  leaf.children.clear();
+  leaf.renames.clear();
+
+  operations_.emplace_back(Operation{
+      unset_operation, std::string{path}, {}, bson::unknown_node, {}});
+  return *this;
+}
+
+inline Patch &Patch::rename(std::string_view path, std::string_view name) {
+  if (name.empty() || name.find(BSON_PATH_DELIMITER) != name.npos) {
+    throw bson::InvalidArgument{"invalid key for rename: " + std::string{name}};
+  }
+
+  PathNode        *parent = nullptr;
+  PathNode        &leaf   = this->node(path, &parent);
+  std::string_view key    = path.substr(path.rfind(BSON_PATH_DELIMITER) + 1);
+
+  if (auto found = parent->renames.find(name);
+      found != parent->renames.end() && found->second != key) {
+    throw bson::InvalidArgument{"several renames to key: " + std::string{name}};
+  }
+  if (auto found = parent->children.find(name);
+      name != key && found != parent->children.end() &&
+      found->second.rename.empty()) {
+    throw bson::InvalidArgument{"conflict with operations by key: " +
+                                std::string{name}};
+  }
+
+  if (!leaf.rename.empty()) {
+    parent->renames.erase(leaf.rename);
+  }
+  leaf.rename = name;
+  parent->renames.emplace(name, key);
+
+  operations_.emplace_back(
+      Operation{rename_operation,
+                std::string{path},
+                std::string{name},
+                bson::unknown_node,
+                {}});
+  return *this;
+}
+
+inline bool Patch::containsSet(const PathNode &node) const noexcept {
+  if (node.action == PathNode::set_action) {
+    return true;
+  }
+
+  return std::any_of(node.children.begin(),
+                     node.children.end(),
+                     [this](const auto &child) {
+                       return this->containsSet(child.second);
+                     });
+}
+
+inline void Patch::appendNode(bson::NodeType     type,
+                              std::string_view   key,
+                              const void        *value,
+                              int                length,
+                              std::vector<byte> &out) const noexcept {
+  out.push_back(type);
+  out.insert(out.end(), key.begin(), key.end());
+  out.push_back('\0');
+  out.insert(out.end(),
+             reinterpret_cast<const byte *>(value),
+             reinterpret_cast<const byte *>(value) + length);
+}
+
+inline void Patch::applyDocument(const byte        *source,
+                                 const PathNode    &level,
+                                 std::vector<byte> &out) const {
+  Document doc{source, *reinterpret_cast<const int32_t *>(source)};
+
+  size_t start = out.size();
+  out.resize(start + SIZE_OF_BSON_SIZE);
+
+  // values which will be replaced by renamed values. Values by rename targets,
+  // which are renamed too, are moved to other keys instead
+  std::vector<std::string_view> replaced;
+  for (auto &[name, key] : level.renames) {
+    const PathNode &child  = level.children.find(key)->second;
+    auto            target = level.children.find(name);
+    if (child.action != PathNode::unset_action &&
+        (doc.contains(key) || this->containsSet(child)) &&
+        (target == level.children.end() || target->second.rename.empty())) {
+      replaced.emplace_back(name);
+    }
+  }
+
+  std::vector<const PathNode *> matched;
+  const byte *run = reinterpret_cast<const byte *>(source) + SIZE_OF_BSON_SIZE;
+  for (Node node : doc) {
+    const byte *begin  = reinterpret_cast<const byte *>(node.data());
+    auto        found  = level.children.find(node.key());
+    bool        remove = std::find(replaced.begin(),
+                            replaced.end(),
+                            node.key()) != replaced.end();
+    if (found == level.children.end() && !remove) {
+      continue;
+    }
+
+    // copy all untouched nodes by one block
+    out.insert(out.end(), run, begin);
+    run = begin + node.length();
+
+    if (remove) {
+      continue;
+    }
+
+    const PathNode &child = found->second;
+    matched.emplace_back(&child);
+
+    std::string_view key = child.rename.empty() ? node.key() : child.rename;
+    switch (child.action) {
+    case PathNode::unset_action:
+      break;
+    case PathNode::set_action: {
+      const Operation &operation = operations_[child.operation];
+      this->appendNode(operation.valueType,
+                       key,
+                       operation.value.data(),
+                       operation.value.size(),
+                       out);
+    } break;
+    case PathNode::none_action: {
+      const byte *value =
+          begin + SIZE_OF_BSON_TYPE + node.key().size() + SIZE_OF_ZERO_BYTE;
+      if (!child.children.empty() && (node.type() == bson::document_node ||
+                                      node.type() == bson::array_node)) {
+        this->appendNode(node.type(), key, nullptr, 0, out);
+        this->applyDocument(value, child, out);
+      } else if (this->containsSet(child)) {
+        throw bson::InvalidArgument{"not a document by key: " +
+                                    std::string{node.key()}};
+      } else {
+        this->appendNode(node.type(), key, value, run - value, out);
+      }
+    } break;
+    }
+  }
+  out.insert(out.end(),
+             run,
+             reinterpret_cast<const byte *>(source) + doc.length() -
+                 SIZE_OF_ZERO_BYTE);
+
+  // new values are appended in order of operations
+  std::vector<const PathNode *> created;
+  std::vector<std::string_view> createdKeys;
+  for (auto &[key, child] : level.children) {
+    if (std::find(matched.begin(), matched.end(), &child) == matched.end() &&
+        this->containsSet(child)) {
+      created.emplace_back(&child);
+      createdKeys.emplace_back(key);
+    }
+  }
+  std::vector<size_t> indexes(created.size());
+  for (size_t i = 0; i < indexes.size(); ++i) {
+    indexes[i] = i;
+  }
+  std::sort(indexes.begin(), indexes.end(), [&created](size_t lhs, size_t rhs) {
+    return created[lhs]->order < created[rhs]->order;
+  });
+
+  for (size_t i : indexes) {
+    const PathNode  &child = *created[i];
+    std::string_view key =
+        child.rename.empty() ? createdKeys[i] : std::string_view{child.rename};
+    if (child.action == PathNode::set_action) {
+      const Operation &operation = operations_[child.operation];
+      this->appendNode(operation.valueType,
+                       key,
+                       operation.value.data(),
+                       operation.value.size(),
+                       out);
+    } else {
+      this->appendNode(bson::document_node, key, nullptr, 0, out);
+      this->applyDocument(emptyDocument_, child, out);
+    }
+  }
+
+  out.push_back('\0');
+
+  int32_t length = out.size() - start;
+  std::memcpy(out.data() + start, &length, SIZE_OF_BSON_SIZE);
+}
+
+inline int Patch::apply(Document source, std::vector<byte> &out) const {
+  size_t start = out.size();
+  if (source.empty()) {
+    source = Document{emptyDocument_, MINIMAL_SIZE_OF_BSON_DOCUMENT};
+  }
+
+  out.reserve(start + source.length());
+  this->applyDocument(
+      reinterpret_cast<const byte *>(source.data()), root_, out);
+  return out.size() - start;
+}
+
+inline std::vector<byte> Patch::apply(Document source) const {
+  std::vector<byte> retval;
+  this->apply(source, retval);
+  return retval;
+}
+} // namespace microbson
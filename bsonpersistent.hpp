@@ -0,0 +1,559 @@
+// bsonpersistent.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include "minibson.hpp"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace minibson {
+/**\brief immutable document, which shares unchanged subtrees between versions.
+ * Nodes of the document are kept in balanced (AVL) tree, @see set and @see
+ * erase copy only path from root of the tree to changed node, so they create
+ * new version of the document by O(log n) operations and never change the
+ * original. Copy of the document is O(1), so snapshots can be given to other
+ * threads without serialization.
+ *
+ * Nested documents are also persistent, so update of nested value copies only
+ * paths in trees of all parent documents:
+ * ```
+ * minibson::PersistentDocument v1{buffer, length};
+ * minibson::PersistentDocument v2 =
+ *     v1.set("config", v1.get<minibson::PersistentDocument>("config")
+ *                          .set("timeout", 30));
+ * ```
+ * Serialized size of every subtree is cached in the tree, so @see
+ * getSerializedSize is O(1).
+ */
+class PersistentDocument final {
+public:
+  using value_ptr = std::shared_ptr<const NodeValue>;
+
+  PersistentDocument() noexcept = default;
+
+  /**\param buffer pointer to serialized bson document
+   * \param length size of buffer, need for validate the document
+   * \throw bson::InvalidArgument if can not deserialize bson
+   */
+  PersistentDocument(const void *buffer, int length) noexcept(false)
+      : PersistentDocument{Document{buffer, length}} {}
+
+  explicit PersistentDocument(microbson::Document doc) noexcept(false)
+      : PersistentDocument{Document{doc}} {}
+
+  /**\brief takes values of the document without copy. Lazy values of the
+   * document are expanded, so it allocates memory
+   */
+  explicit PersistentDocument(Document &&doc) noexcept(false);
+
+  [[nodiscard]] constexpr bson::NodeType type() const noexcept {
+    return bson::document_node;
+  }
+
+  [[nodiscard]] bool empty() const noexcept { return root_ == nullptr; }
+
+  [[nodiscard]] int size() const noexcept { return root_ ? root_->count : 0; }
+
+  [[nodiscard]] int getSerializedSize() const noexcept {
+    return SIZE_OF_BSON_SIZE + (root_ ? root_->bytes : 0) + SIZE_OF_ZERO_BYTE;
+  }
+
+  /**\throw bson::InvalidArgument if memory not enough
+   * \brief serialize in existing buffer
+   */
+  int serialize(void *buf, int bufSize) const noexcept(false);
+
+  std::vector<byte> serialize() const noexcept(false);
+
+  [[nodiscard]] bool contains(std::string_view key) const noexcept {
+    return this->find(key) != nullptr;
+  }
+
+  template <typename Type>
+  [[nodiscard]] bool contains(std::string_view key) const noexcept;
+
+  /**\return const reference for strings, arrays, binaries and documents,
+   * otherwise value
+   * \throw bson::OutOfRange if not have the value, or bson::BadCast if have not
+   * same type. Nested documents can be get only as PersistentDocument
+   */
+  template <class InputType>
+  decltype(auto) get(std::string_view key) const noexcept(false);
+
+  /**\return new version of the document with the value. Documents and arrays
+   * can be only moved in, their lazy values are expanded
+   */
+  template <class InsertType>
+  [[nodiscard]] PersistentDocument set(Key key, InsertType &&val) const
+      noexcept(false) {
+    return PersistentDocument{
+        insert(root_, key, makeValue(std::forward<InsertType>(val)))};
+  }
+
+  /**\brief set null value
+   */
+  [[nodiscard]] PersistentDocument set(Key key) const noexcept {
+    return PersistentDocument{
+        insert(root_, key, value_ptr{UNodeValueFactory::create()})};
+  }
+
+  /**\return new version of the document without the value, or same document
+   * if it not contains the key
+   */
+  [[nodiscard]] PersistentDocument erase(std::string_view key) const noexcept {
+    return PersistentDocument{remove(root_, key)};
+  }
+
+  /**\return true if both documents are same version, or one of them is copy of
+   * other
+   */
+  [[nodiscard]] bool sameVersion(const PersistentDocument &rhs) const noexcept {
+    return root_ == rhs.root_;
+  }
+
+private:
+  struct Tree;
+  using tree_ptr = std::shared_ptr<const Tree>;
+
+  struct Tree {
+    std::string key;
+    value_ptr   value;
+    tree_ptr    left;
+    tree_ptr    right;
+    int         height;
+    /**\brief count of nodes in the subtree
+     */
+    int count;
+    /**\brief serialized size of all nodes of the subtree (with types and keys)
+     */
+    int bytes;
+  };
+
+  explicit PersistentDocument(tree_ptr root) noexcept
+      : root_{std::move(root)} {}
+
+  template <class InsertType>
+  static value_ptr makeValue(InsertType &&val) noexcept(false);
+
+  static int height(const tree_ptr &tree) noexcept {
+    return tree ? tree->height : 0;
+  }
+
+  static tree_ptr make(std::string      key,
+                       value_ptr        value,
+                       tree_ptr         left,
+                       tree_ptr         right) noexcept;
+
+  /**\brief make node and restore balance, if heights of subtrees differ by 2
+   */
+  static tree_ptr balance(const std::string &key,
+                          const value_ptr   &value,
+                          const tree_ptr    &left,
+                          const tree_ptr    &right) noexcept;
+
+  static tree_ptr
+  insert(const tree_ptr &tree, Key &key, value_ptr value) noexcept;
+
+  static tree_ptr remove(const tree_ptr &tree, std::string_view key) noexcept;
+
+  static tree_ptr removeMin(const tree_ptr &tree) noexcept;
+
+  /**\brief build balanced tree from sorted nodes
+   */
+  static tree_ptr build(std::vector<std::pair<std::string, value_ptr>> &nodes,
+                        size_t                                          begin,
+                        size_t end) noexcept;
+
+  const NodeValue *find(std::string_view key) const noexcept;
+
+  static int serializeTree(const tree_ptr &tree, char *ptr, int length);
+
+private:
+  tree_ptr root_;
+};
+
+namespace detail {
+/**\brief node value of nested persistent document
+ */
+class PersistentValue final : public NodeValue {
+public:
+  explicit PersistentValue(PersistentDocument doc) noexcept
+      : doc_{std::move(doc)} {}
+
+  [[nodiscard]] bson::NodeType type() const noexcept override {
+    return bson::document_node;
+  }
+
+  [[nodiscard]] int getSerializedSize() const noexcept override {
+    return doc_.getSerializedSize();
+  }
+
+  int serialize(void *buf, int length) const override {
+    return doc_.serialize(buf, length);
+  }
+
+  [[nodiscard]] const PersistentDocument &value() const noexcept {
+    return doc_;
+  }
+
+private:
+  PersistentDocument doc_;
+};
+} // namespace detail
+
+template <>
+struct type_traits<PersistentDocument> {
+  enum { node_type_code = bson::document_node };
+  using value_type  = PersistentDocument;
+  using return_type = PersistentDocument;
+};
+
+inline PersistentDocument::PersistentDocument(Document &&doc) {
+  // persistent documents are shared between threads, so they can not contain
+  // lazy values
+  doc.expand();
+
+  std::vector<std::pair<std::string, value_ptr>> nodes;
+  nodes.reserve(doc.size());
+  for (auto iter = doc.begin(); iter != doc.end(); ++iter) {
+    UNodeValue &val = *iter;
+    if (val->type() == bson::document_node) {
+      // nested documents are also converted to persistent
+      Document &nested =
+          reinterpret_cast<NodeValueT<Document> *>(val.get())->value();
+      nodes.emplace_back(iter.key(),
+                         std::make_shared<detail::PersistentValue>(
+                             PersistentDocument{std::move(nested)}));
+    } else {
+      nodes.emplace_back(iter.key(), value_ptr{std::move(val)});
+    }
+  }
+
+  // keys of the document are already sorted
+  root_ = build(nodes, 0, nodes.size());
+}
+
+template <class InsertType>
+inline PersistentDocument::value_ptr
+PersistentDocument::makeValue(InsertType &&val) {
+  using input_type = typename std::decay<InsertType>::type;
+
+  if constexpr (std::is_same<input_type, PersistentDocument>::value) {
+    return std::make_shared<detail::PersistentValue>(
+        std::forward<InsertType>(val));
+  } else if constexpr (std::is_same<input_type, Document>::value) {
+    static_assert(std::is_rvalue_reference<InsertType &&>::value,
+                  "document can be only moved in persistent document");
+    return std::make_shared<detail::PersistentValue>(
+        PersistentDocument{std::move(val)});
+  } else if constexpr (std::is_same<input_type, Array>::value) {
+    static_assert(std::is_rvalue_reference<InsertType &&>::value,
+                  "array can be only moved in persistent document");
+    // persistent documents are shared between threads, so they can not contain
+    // lazy values
+    val.expand();
+    return value_ptr{UNodeValueFactory::create(std::move(val))};
+  } else if constexpr (std::is_convertible<input_type, const char *>::value) {
+    return value_ptr{
+        UNodeValueFactory::create(static_cast<const char *>(val))};
+  } else {
+    return value_ptr{
+        UNodeValueFactory::create(std::forward<InsertType>(val))};
+  }
+}
+
+inline PersistentDocument::tree_ptr
+PersistentDocument::make(std::string key,
+                         value_ptr   value,
+                         tree_ptr    left,
+                         tree_ptr    right) noexcept {
+  int height = std::max(PersistentDocument::height(left),
+                        PersistentDocument::height(right)) +
+               1;
+  int count = (left ? left->count : 0) + (right ? right->count : 0) + 1;
+  int bytes = (left ? left->bytes : 0) + (right ? right->bytes : 0) +
+              SIZE_OF_BSON_TYPE + key.size() + SIZE_OF_ZERO_BYTE +
+              value->getSerializedSize();
+  return std::make_shared<const Tree>(Tree{std::move(key),
+                                           std::move(value),
+                                           std::move(left),
+                                           std::move(right),
+                                           height,
+                                           count,
+                                           bytes});
+}
+
+inline PersistentDocument::tree_ptr
+PersistentDocument::balance(const std::string &key,
+                            const value_ptr   &value,
+                            const tree_ptr    &left,
+                            const tree_ptr    &right) noexcept {
+  int leftHeight  = height(left);
+  int rightHeight = height(right);
+
+  if (leftHeight > rightHeight + 1) {
+    if (height(left->left) >= height(left->right)) {
+      return make(left->key,
+                  left->value,
+                  left->left,
+                  make(key, value, left->right, right));
+    }
+
+    const tree_ptr &middle = left->right;
+    return make(middle->key,
+                middle->value,
+                make(left->key, left->value, left->left, middle->left),
+                make(key, value, middle->right, right));
+  }
+
+  if (rightHeight > leftHeight + 1) {
+    if (height(right->right) >= height(right->left)) {
+      return make(right->key,
+                  right->value,
+                  make(key, value, left, right->left),
+                  right->right);
+    }
+
+    const tree_ptr &middle = right->left;
+    return make(middle->key,
+                middle->value,
+                make(key, value, left, middle->left),
+                make(right->key, right->value, middle->right, right->right));
+  }
+
+  return make(key, value, left, right);
+}
+
+inline PersistentDocument::tree_ptr
+PersistentDocument::insert(const tree_ptr &tree,
+                           Key            &key,
+                           value_ptr       value) noexcept {
+  if (tree == nullptr) {
+    return make(key.release(), std::move(value), nullptr, nullptr);
+  }
+
+  int order = key.view().compare(tree->key);
+  if (order < 0) {
+    return balance(tree->key,
+                   tree->value,
+                   insert(tree->left, key, std::move(value)),
+                   tree->right);
+  }
+  if (order > 0) {
+    return balance(tree->key,
+                   tree->value,
+                   tree->left,
+                   insert(tree->right, key, std::move(value)));
+  }
+  return make(tree->key, std::move(value), tree->left, tree->right);
+}
+
+inline PersistentDocument::tree_ptr
+PersistentDocument::removeMin(const tree_ptr &tree) noexcept {
+  if (tree->left == nullptr) {
+    return tree->right;
+  }
+  return balance(tree->key, tree->value, removeMin(tree->left), tree->right);
+}
+
+inline PersistentDocument::tree_ptr
+PersistentDocument::remove(const tree_ptr  &tree,
+                           std::string_view key) noexcept {
+  if (tree == nullptr) {
+    return tree;
+  }
+
+  int order = key.compare(tree->key);
+  if (order < 0) {
+    tree_ptr left = remove(tree->left, key);
+    return left == tree->left
+               ? tree
+               : balance(tree->key, tree->value, left, tree->right);
+  }
+  if (order > 0) {
+    tree_ptr right = remove(tree->right, key);
+    return right == tree->right
+               ? tree
+               : balance(tree->key, tree->value, tree->left, right);
+  }
+
+  if (tree->left == nullptr) {
+    return tree->right;
+  }
+  if (tree->right == nullptr) {
+    return tree->left;
+  }
+
+  const Tree *min = tree->right.get();
+  while (min->left) {
+    min = min->left.get();
+  }
+  return balance(min->key, min->value, tree->left, removeMin(tree->right));
+}
+
+inline PersistentDocument::tree_ptr PersistentDocument::build(
+    std::vector<std::pair<std::string, value_ptr>> &nodes,
+    size_t                                          begin,
+    size_t                                          end) noexcept {
+  if (begin == end) {
+    return nullptr;
+  }
+
+  size_t   middle = begin + (end - begin) / 2;
+  tree_ptr left   = build(nodes, begin, middle);
+  tree_ptr right  = build(nodes, middle + 1, end);
+  return make(std::move(nodes[middle].first),
+              std::move(nodes[middle].second),
+              std::move(left),
+              std::move(right));
+}
+
+inline const NodeValue *
+PersistentDocument::find(std::string_view key) const noexcept {
+  BSON_STATISTICS_ADD(lookups, 1);
+
+  const Tree *current = root_.get();
+  while (current) {
+    int order = key.compare(current->key);
+    if (order == 0) {
+      return current->value.get();
+    }
+    current = order < 0 ? current->left.get() : current->right.get();
+  }
+
+  BSON_STATISTICS_ADD(misses, 1);
+  return nullptr;
+}
+
+template <typename Type>
+inline bool PersistentDocument::contains(std::string_view key) const noexcept {
+  const NodeValue *found = this->find(key);
+  if (found == nullptr) {
+    return false;
+  }
+
+  if constexpr (std::is_same<Type, bson::Scalar>::value) {
+    bson::NodeType type = found->type();
+    return type == bson::double_node || type == bson::int32_node ||
+           type == bson::int64_node;
+  } else if constexpr (std::is_same<typename type_traits<Type>::value_type,
+                                    Document>::value) {
+    // nested documents are kept only as persistent documents
+    return false;
+  } else {
+    return found->type() == type_traits<Type>::node_type_code;
+  }
+}
+
+template <class InputType>
+inline decltype(auto) PersistentDocument::get(std::string_view key) const {
+  const NodeValue *found = this->find(key);
+  if (found == nullptr) {
+    throw bson::OutOfRange{"have not value by key: " + std::string{key}};
+  }
+
+  if constexpr (std::is_same<InputType, bson::Scalar>::value) {
+    switch (found->type()) {
+    case bson::double_node:
+      return double(
+          reinterpret_cast<const NodeValueT<double> *>(found)->value());
+    case bson::int32_node:
+      return double(
+          reinterpret_cast<const NodeValueT<int32_t> *>(found)->value());
+    case bson::int64_node:
+      return double(
+          reinterpret_cast<const NodeValueT<int64_t> *>(found)->value());
+    default:
+      throw bson::BadCast{};
+    }
+  } else {
+    using value_type           = typename type_traits<InputType>::value_type;
+    using return_type          = typename type_traits<InputType>::return_type;
+    constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
+
+    // nested documents are kept only as persistent documents
+    if (found->type() != nodeTypeCode ||
+        std::is_same<value_type, Document>::value) {
+      throw bson::BadCast{};
+    }
+
+    if constexpr (std::is_same<value_type, PersistentDocument>::value) {
+      return static_cast<const detail::PersistentValue *>(found)->value();
+    } else {
+      const value_type &val =
+          reinterpret_cast<const NodeValueT<value_type> *>(found)->value();
+      if constexpr (std::is_same<value_type, return_type>::value &&
+                    !std::is_fundamental<value_type>::value) {
+        return static_cast<const value_type &>(val);
+      } else if constexpr (std::is_convertible<value_type,
+                                               return_type>::value) {
+        return return_type(val);
+      } else if constexpr (std::is_nothrow_constructible<return_type,
+                                                         value_type>::value) {
+        return return_type{val};
+      } else {
+        constexpr return_type (*converter)(const value_type &) =
+            type_traits<InputType>::converter;
+        return converter(val);
+      }
+    }
+  }
+}
+
+inline int
+PersistentDocument::serializeTree(const tree_ptr &tree, char *ptr, int length) {
+  if (tree == nullptr) {
+    return 0;
+  }
+
+  int offset = serializeTree(tree->left, ptr, length);
+
+  // serialize type and key
+  *(ptr + offset) = tree->value->type();
+  ++offset;
+  std::memcpy(ptr + offset, tree->key.c_str(), tree->key.size() + 1);
+  offset += tree->key.size() + SIZE_OF_ZERO_BYTE;
+
+  int written = tree->value->serialize(ptr + offset, length - offset);
+  offset += written;
+
+  // nested documents count their own bytes
+  BSON_STATISTICS_ADD(serializedBytes,
+                      SIZE_OF_BSON_TYPE + tree->key.size() + SIZE_OF_ZERO_BYTE +
+                          (tree->value->type() == bson::document_node ||
+                                   tree->value->type() == bson::array_node
+                               ? 0
+                               : written));
+
+  offset += serializeTree(tree->right, ptr + offset, length - offset);
+  return offset;
+}
+
+inline int PersistentDocument::serialize(void *buf, int bufSize) const {
+  int size = this->getSerializedSize();
+  if (bufSize < size) {
+    throw bson::InvalidArgument{MEMORY_ERROR};
+  }
+
+  BSON_STATISTICS_ADD(serializedBytes, (MINIMAL_SIZE_OF_BSON_DOCUMENT));
+
+  char *ptr                     = reinterpret_cast<char *>(buf);
+  *reinterpret_cast<int *>(ptr) = size;
+  int offset                    = SIZE_OF_BSON_SIZE;
+  offset += serializeTree(root_, ptr + offset, size - offset);
+  *(ptr + offset) = '\0';
+  return size;
+}
+
+inline std::vector<byte> PersistentDocument::serialize() const {
+  std::vector<byte> retval(this->getSerializedSize());
+  this->serialize(retval.data(), retval.size());
+  return retval;
+}
+} // namespace minibson
@@ -0,0 +1,207 @@
+// bsonprojection.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace microbson {
+/**\brief copies selected fields of serialized document into new serialized
+ * document without building minibson tree. Fields are selected by keys or
+ * paths, where keys of nested documents and arrays are separated by
+ * BSON_PATH_DELIMITER.
+ *
+ * In include mode result contains only the fields by the paths (and parent
+ * documents of them), in exclude mode - all fields except the fields by the
+ * paths. Sequences of kept nodes are copied by blocks, only lengths of
+ * documents are recomputed. In include mode parent documents are kept even if
+ * they not contain fields by the paths.
+ * \warning excluding of array items not reindex other items of the array
+ */
+class Projection final {
+public:
+  enum Mode {
+    include_mode,
+    exclude_mode,
+  };
+
+  /**\throw bson::InvalidArgument if some path is empty or has empty key
+   */
+  Projection(Mode mode, std::initializer_list<std::string_view> paths) noexcept(
+      false)
+      : mode_{mode} {
+    for (std::string_view path : paths) {
+      this->add(path);
+    }
+  }
+
+  Projection(Mode mode, const std::vector<std::string> &paths) noexcept(false)
+      : mode_{mode} {
+    for (std::string_view path : paths) {
+      this->add(path);
+    }
+  }
+
+  [[nodiscard]] Mode mode() const noexcept { return mode_; }
+
+  /**\return exact length of result of the projection
+   * \param doc valid bson document, @see Document::valid
+   */
+  [[nodiscard]] int getSerializedSize(Document doc) const noexcept;
+
+  /**\brief write result of the projection in the buffer
+   * \param doc valid bson document, @see Document::valid
+   * \return length of result document
+   * \throw bson::InvalidArgument if buffer is too small, @see getSerializedSize
+   */
+  int project(Document doc, void *buffer, int length) const noexcept(false);
+
+  std::vector<byte> project(Document doc) const noexcept;
+
+private:
+  struct Level {
+    /**\brief true if whole value by the path is included or excluded
+     */
+    bool                                      leaf = false;
+    std::map<std::string, Level, std::less<>> children;
+  };
+
+  void add(std::string_view path) noexcept(false);
+
+  /**\param out if nullptr then only length of result is computed
+   * \return length of result document
+   */
+  int projectDocument(Document     doc,
+                      const Level &level,
+                      byte        *out) const noexcept;
+
+private:
+  Mode  mode_;
+  Level root_;
+};
+
+inline void Projection::add(std::string_view path) {
+  Level *current = &root_;
+  detail::forEachKey(path, [&current](std::string_view key, bool last) {
+    if (key.empty()) {
+      throw bson::InvalidArgument{"empty key in projection path"};
+    }
+
+    current = &detail::childLevel(current->children, key).first;
+    if (current->leaf) {
+      return false; // parent value already selected
+    }
+
+    if (last) {
+      current->leaf = true;
+      current->children.clear();
+    }
+    return true;
+  });
+}
+
+inline int Projection::projectDocument(Document     doc,
+                                       const Level &level,
+                                       byte        *out) const noexcept {
+  int         written   = SIZE_OF_BSON_SIZE;
+  const byte *run       = nullptr;
+  int         runLength = 0;
+
+  // copy all kept nodes by one block
+  auto flush = [&]() {
+    if (out && runLength) {
+      std::memcpy(out + written, run, runLength);
+    }
+    written += runLength;
+    runLength = 0;
+  };
+
+  for (Node node : doc) {
+    const byte *begin  = reinterpret_cast<const byte *>(node.data());
+    int         length = node.length();
+
+    auto found = level.children.find(node.key());
+    bool nested =
+        node.type() == bson::document_node || node.type() == bson::array_node;
+    bool keep = mode_ == include_mode ? found != level.children.end()
+                                      : found == level.children.end() ||
+                                            !found->second.leaf;
+    if (keep && found != level.children.end() && !found->second.leaf) {
+      if (nested) {
+        flush();
+
+        int header = SIZE_OF_BSON_TYPE + node.key().size() + SIZE_OF_ZERO_BYTE;
+        if (out) {
+          std::memcpy(out + written, begin, header);
+        }
+        written += header;
+        written += this->projectDocument(Document{begin + header,
+                                                  length - header},
+                                         found->second,
+                                         out ? out + written : nullptr);
+        continue;
+      }
+
+      // path goes through value, which is not document
+      keep = mode_ == exclude_mode;
+    }
+
+    if (!keep) {
+      flush();
+      continue;
+    }
+
+    if (run + runLength != begin) {
+      flush();
+      run = begin;
+    }
+    runLength += length;
+  }
+  flush();
+
+  if (out) {
+    out[written] = '\0';
+  }
+  written += SIZE_OF_ZERO_BYTE;
+
+  if (out) {
+    int32_t docLength = written;
+    std::memcpy(out, &docLength, SIZE_OF_BSON_SIZE);
+  }
+  return written;
+}
+
+inline int Projection::getSerializedSize(Document doc) const noexcept {
+  if (doc.empty()) {
+    return MINIMAL_SIZE_OF_BSON_DOCUMENT;
+  }
+  return this->projectDocument(doc, root_, nullptr);
+}
+
+inline int Projection::project(Document doc, void *buffer, int length) const {
+  int size = this->getSerializedSize(doc);
+  if (length < size) {
+    throw bson::InvalidArgument{"buffer is too small for projection"};
+  }
+
+  byte *out = reinterpret_cast<byte *>(buffer);
+  if (doc.empty()) {
+    int32_t emptyLength = MINIMAL_SIZE_OF_BSON_DOCUMENT;
+    std::memcpy(out, &emptyLength, SIZE_OF_BSON_SIZE);
+    out[SIZE_OF_BSON_SIZE] = '\0';
+    return MINIMAL_SIZE_OF_BSON_DOCUMENT;
+  }
+  return this->projectDocument(doc, root_, out);
+}
+
+inline std::vector<byte> Projection::project(Document doc) const noexcept {
+  std::vector<byte> retval(this->getSerializedSize(doc));
+  this->project(doc, retval.data(), retval.size());
+  return retval;
+}
+} // namespace microbson
@@ -0,0 +1,317 @@
+// bsonrcu.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace microbson {
+/**\brief serialized document together with buffer, which owns it
+ */
+class OwnedDocument final {
+public:
+  /**\throw bson::InvalidArgument if the buffer not contains valid bson
+   */
+  explicit OwnedDocument(std::vector<byte> buffer) noexcept(false)
+      : buffer_{std::move(buffer)} {
+    if (!Document{buffer_.data(), int(buffer_.size())}.valid()) {
+      throw bson::InvalidArgument{"invalid bson"};
+    }
+  }
+
+  /**\brief copy serialized document in own buffer
+   * \throw bson::InvalidArgument if the buffer not contains valid bson
+   */
+  OwnedDocument(const void *data, int length) noexcept(false)
+      : OwnedDocument{std::vector<byte>(
+            reinterpret_cast<const byte *>(data),
+            reinterpret_cast<const byte *>(data) + std::max(length, 0))} {}
+
+  [[nodiscard]] Document view() const noexcept {
+    return Document{buffer_.data(), int(buffer_.size())};
+  }
+
+  [[nodiscard]] const byte *data() const noexcept { return buffer_.data(); }
+
+  [[nodiscard]] int length() const noexcept { return buffer_.size(); }
+
+private:
+  std::vector<byte> buffer_;
+};
+} // namespace microbson
+
+namespace bson {
+namespace detail {
+/**\brief expand lazy parts of the value (for example `minibson::Document`
+ * constructed with minibson::lazy), because access to them modifies the value
+ * and can not be shared between threads
+ */
+template <class T>
+auto expandShared(T &value, int) noexcept(false)
+    -> decltype(value.expand(), void()) {
+  value.expand();
+}
+
+template <class T>
+void expandShared(T &, long) noexcept {}
+
+/**\brief epochs of reading threads for safe reclamation of published values.
+ * Every thread gets own slot at first read, and releases it at exit
+ */
+class EpochDomain final {
+public:
+  struct alignas(64) Slot {
+    /**\brief epoch of the domain at moment of pin, or 0 if the thread not
+     * reads
+     */
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool>     used{true};
+    Slot                 *next = nullptr;
+    /**\brief count of nested pins, changed only by owner thread
+     */
+    int depth = 0;
+  };
+
+  static EpochDomain &instance() noexcept {
+    static EpochDomain domain;
+    return domain;
+  }
+
+  ~EpochDomain() noexcept {
+    for (Slot *slot = slots_.load(); slot;) {
+      Slot *next = slot->next;
+      delete slot;
+      slot = next;
+    }
+  }
+
+  /**\return slot of current thread
+   */
+  Slot &local() noexcept {
+    struct Registration {
+      Slot *slot;
+
+      Registration() noexcept
+          : slot{EpochDomain::instance().acquire()} {}
+      ~Registration() noexcept {
+        slot->epoch.store(0);
+        slot->used.store(false);
+      }
+    };
+
+    thread_local Registration registration;
+    return *registration.slot;
+  }
+
+  void pin(Slot &slot) noexcept {
+    if (slot.depth++ == 0) {
+      // seq_cst store is ordered before following load of published value
+      slot.epoch.store(epoch_.load());
+    }
+  }
+
+  void unpin(Slot &slot) noexcept {
+    if (--slot.depth == 0) {
+      slot.epoch.store(0);
+    }
+  }
+
+  /**\return new epoch
+   */
+  uint64_t advance() noexcept { return epoch_.fetch_add(1) + 1; }
+
+  /**\return minimal epoch of pinned threads, or max value if no thread is
+   * pinned
+   */
+  uint64_t minActive() const noexcept {
+    uint64_t retval = std::numeric_limits<uint64_t>::max();
+    for (Slot *slot = slots_.load(); slot; slot = slot->next) {
+      if (uint64_t epoch = slot->epoch.load(); epoch != 0) {
+        retval = std::min(retval, epoch);
+      }
+    }
+    return retval;
+  }
+
+private:
+  EpochDomain() noexcept = default;
+
+  Slot *acquire() noexcept {
+    for (Slot *slot = slots_.load(); slot; slot = slot->next) {
+      bool expected = false;
+      if (!slot->used.load() &&
+          slot->used.compare_exchange_strong(expected, true)) {
+        return slot;
+      }
+    }
+
+    Slot *slot = new Slot;
+    slot->next = slots_.load();
+    while (!slots_.compare_exchange_weak(slot->next, slot)) {
+    }
+    return slot;
+  }
+
+private:
+  std::atomic<uint64_t> epoch_{1};
+  std::atomic<Slot *>   slots_{nullptr};
+};
+} // namespace detail
+
+/**\brief holder of immutable value (for example frozen `minibson::Document` or
+ * `microbson::OwnedDocument`) for read-mostly data. Readers get pinned snapshot
+ * of current value without locks and without changing of reference counters:
+ * pin only writes current epoch in slot of the thread. Writers publish new
+ * values, old values are deleted when all threads, which could read them, are
+ * unpinned (epoch-based reclamation).
+ *
+ * Usage:
+ * ```
+ * bson::RcuHolder<minibson::Document> routes{std::move(doc)};
+ * // reader threads
+ * {
+ *   auto snapshot = routes.read();
+ *   snapshot->get<std::string>("default");
+ * }
+ * // control thread
+ * routes.publish(std::move(newDoc));
+ * ```
+ * \warning snapshot must be released by the thread, which took it. Long living
+ * snapshots delay reclamation of all values published after them
+ */
+template <class T>
+class RcuHolder final {
+public:
+  class Snapshot final {
+    friend RcuHolder;
+
+  public:
+    Snapshot(Snapshot &&rhs) noexcept
+        : slot_{rhs.slot_}
+        , value_{rhs.value_} {
+      rhs.slot_ = nullptr;
+    }
+
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+    Snapshot &operator=(Snapshot &&) = delete;
+
+    ~Snapshot() noexcept {
+      if (slot_) {
+        detail::EpochDomain::instance().unpin(*slot_);
+      }
+    }
+
+    /**\return nullptr if nothing was published
+     */
+    [[nodiscard]] const T *get() const noexcept { return value_; }
+    [[nodiscard]] const T &operator*() const noexcept { return *value_; }
+    [[nodiscard]] const T *operator->() const noexcept { return value_; }
+
+    explicit operator bool() const noexcept { return value_ != nullptr; }
+
+  private:
+    Snapshot(detail::EpochDomain::Slot *slot, const T *value) noexcept
+        : slot_{slot}
+        , value_{value} {}
+
+  private:
+    detail::EpochDomain::Slot *slot_;
+    const T                   *value_;
+  };
+
+  RcuHolder() noexcept
+      : current_{nullptr} {}
+
+  explicit RcuHolder(T value) noexcept(false)
+      : current_{nullptr} {
+    detail::expandShared(value, 0);
+    current_ = new T(std::move(value));
+  }
+
+  RcuHolder(const RcuHolder &) = delete;
+  RcuHolder &operator=(const RcuHolder &) = delete;
+
+  /**\warning all snapshots must be released before destruction
+   */
+  ~RcuHolder() noexcept {
+    delete current_.load();
+    for (auto &[value, epoch] : retired_) {
+      delete value;
+    }
+  }
+
+  /**\brief wait-free, except first read in the thread (registration of slot)
+   */
+  [[nodiscard]] Snapshot read() const noexcept {
+    detail::EpochDomain       &domain = detail::EpochDomain::instance();
+    detail::EpochDomain::Slot &slot   = domain.local();
+    domain.pin(slot);
+    return Snapshot{&slot, current_.load()};
+  }
+
+  /**\brief replace current value. Previous value is deleted when no thread can
+   * read it, @see reclaim. Lazy values of the value are expanded before
+   * publication
+   */
+  void publish(std::unique_ptr<T> value) noexcept(false) {
+    if (value) {
+      detail::expandShared(*value, 0);
+    }
+
+    const T *old   = current_.exchange(value.release());
+    uint64_t epoch = detail::EpochDomain::instance().advance();
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (old) {
+      retired_.emplace_back(old, epoch);
+    }
+    this->reclaimRetired();
+  }
+
+  void publish(T value) noexcept(false) {
+    this->publish(std::make_unique<T>(std::move(value)));
+  }
+
+  /**\brief delete previous values, which are not read by any thread
+   */
+  void reclaim() noexcept {
+    std::lock_guard<std::mutex> lock{mutex_};
+    this->reclaimRetired();
+  }
+
+  /**\return count of previous values, which are not deleted yet
+   */
+  [[nodiscard]] size_t retired() const noexcept {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return retired_.size();
+  }
+
+private:
+  void reclaimRetired() noexcept {
+    // value retired at epoch E can be read only by threads pinned before E
+    uint64_t minActive = detail::EpochDomain::instance().minActive();
+    auto     last      = std::partition(retired_.begin(),
+                                 retired_.end(),
+                                 [minActive](const auto &retired) {
+                                   return retired.second > minActive;
+                                 });
+    for (auto iter = last; iter != retired_.end(); ++iter) {
+      delete iter->first;
+    }
+    retired_.erase(last, retired_.end());
+  }
+
+private:
+  std::atomic<const T *>                     current_;
+  mutable std::mutex                         mutex_;
+  std::vector<std::pair<const T *, uint64_t>> retired_;
+};
+} // namespace bson
@@ -0,0 +1,421 @@
+// bsonshape.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include "minibson.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace minibson {
+/**\brief immutable descriptor of keys of documents (hidden class). Maps every
+ * key to index of slot, where document keeps the value. Shapes are shared by
+ * all documents with same keys in same order: adding or removing of key moves
+ * the document to other shape by transition, which is cached in the source
+ * shape. Removing resolves to shape, which is reached by adding of rest keys.
+ * Every shape keeps shape, from which it is added, so shapes, which are not
+ * used by documents (or by other shapes), are deleted.
+ *
+ * Shapes can be shared between threads, transition caches are guarded by
+ * mutex.
+ */
+class Shape final : public std::enable_shared_from_this<Shape> {
+  struct Private {};
+
+public:
+  using pointer = std::shared_ptr<const Shape>;
+
+  static constexpr size_t npos = size_t(-1);
+
+  explicit Shape(Private) noexcept {}
+
+  /**\return shape without keys, root of all transitions
+   */
+  [[nodiscard]] static const pointer &empty() noexcept(false) {
+    static const pointer root = std::make_shared<Shape>(Private{});
+    return root;
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return keys_.size(); }
+
+  /**\return key of the slot
+   */
+  [[nodiscard]] const std::string &key(size_t slot) const noexcept {
+    return keys_[slot];
+  }
+
+  /**\return slot of the key, or npos if the shape not contains the key. Slots
+   * not changed while the shape is same, so they can be found once per shape
+   */
+  [[nodiscard]] size_t slot(std::string_view key) const noexcept {
+    auto found = std::lower_bound(sorted_.begin(),
+                                  sorted_.end(),
+                                  key,
+                                  [this](uint32_t lhs, std::string_view rhs) {
+                                    return keys_[lhs] < rhs;
+                                  });
+    if (found != sorted_.end() && keys_[*found] == key) {
+      return *found;
+    }
+    return npos;
+  }
+
+  /**\return slots in sorted order of keys (order of serialization)
+   */
+  [[nodiscard]] const std::vector<uint32_t> &sorted() const noexcept {
+    return sorted_;
+  }
+
+  /**\return count of cached transitions to other shapes, including
+   * transitions to deleted shapes, which are not pruned yet
+   */
+  [[nodiscard]] size_t transitions() const noexcept(false) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return added_.shapes.size() + removed_.shapes.size();
+  }
+
+  /**\return shape with the key in new last slot
+   * \warning the shape must not contain the key
+   */
+  [[nodiscard]] pointer add(std::string_view key) const noexcept(false) {
+    return this->transition(added_, key, [this, key]() {
+      auto retval   = std::make_shared<Shape>(Private{});
+      retval->keys_ = keys_;
+      retval->keys_.emplace_back(key);
+      retval->sort();
+      return retval;
+    });
+  }
+
+  /**\return shape without the key, next slots are moved by one back. The
+   * shape is found by adding of rest keys to the empty shape, so it is same as
+   * shape of documents, which got same keys in same order without removing
+   * \warning the shape must contain the key
+   */
+  [[nodiscard]] pointer remove(std::string_view key) const noexcept(false) {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (pointer retval = entry(removed_, key).lock()) {
+        return retval;
+      }
+    }
+
+    pointer retval = empty();
+    for (const std::string &other : keys_) {
+      if (other != key) {
+        retval = retval->add(other);
+      }
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    entry(removed_, key) = retval;
+    return retval;
+  }
+
+private:
+  /**\brief transitions by keys. Deleted shapes are not removed from the cache
+   * immediately, so expired entries are pruned when size of the cache reaches
+   * the limit, and the limit is twice of size after pruning
+   */
+  struct Cache {
+    static constexpr size_t min_limit = 16;
+
+    std::map<std::string, std::weak_ptr<const Shape>, std::less<>> shapes;
+    size_t limit = min_limit;
+  };
+
+  /**\return entry of the cache for the key, new entries are empty
+   */
+  static std::weak_ptr<const Shape> &
+  entry(Cache &cache, std::string_view key) noexcept(false) {
+    auto found = cache.shapes.find(key);
+    if (found == cache.shapes.end()) {
+      if (cache.shapes.size() >= cache.limit) {
+        prune(cache);
+      }
+      found = cache.shapes
+                  .emplace(std::string{key}, std::weak_ptr<const Shape>{})
+                  .first;
+    }
+    return found->second;
+  }
+
+  template <class Create>
+  pointer transition(Cache           &cache,
+                     std::string_view key,
+                     Create         &&create) const noexcept(false) {
+    std::lock_guard<std::mutex>  lock{mutex_};
+    std::weak_ptr<const Shape> &cached = entry(cache, key);
+    if (pointer retval = cached.lock()) {
+      return retval;
+    }
+
+    std::shared_ptr<Shape> retval = create();
+    retval->source_               = this->shared_from_this();
+    cached                        = retval;
+    return retval;
+  }
+
+  static void prune(Cache &cache) noexcept {
+    for (auto iter = cache.shapes.begin(); iter != cache.shapes.end();) {
+      if (iter->second.expired()) {
+        iter = cache.shapes.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+    cache.limit = std::max(Cache::min_limit, cache.shapes.size() * 2);
+  }
+
+  void sort() noexcept {
+    sorted_.resize(keys_.size());
+    for (size_t i = 0; i < sorted_.size(); ++i) {
+      sorted_[i] = i;
+    }
+    std::sort(sorted_.begin(),
+              sorted_.end(),
+              [this](uint32_t lhs, uint32_t rhs) {
+                return keys_[lhs] < keys_[rhs];
+              });
+  }
+
+private:
+  std::vector<std::string> keys_;
+  std::vector<uint32_t>    sorted_;
+  /**\brief shape, from which this shape is added
+   */
+  pointer source_;
+
+  mutable std::mutex mutex_;
+  mutable Cache      added_;
+  mutable Cache      removed_;
+};
+
+/**\brief document, which keeps only values in flat array of slots. Keys are
+ * kept in shared `Shape`, so documents with same keys not store own copies of
+ * keys and own nodes of map. Access by key is binary search in the shape, and
+ * access by slot (@see Shape::slot) is indexed load:
+ * ```
+ * minibson::Shape::pointer shape = docs.front().shape();
+ * size_t                   slot  = shape->slot("id");
+ * for (const minibson::ShapedDocument &doc : docs) {
+ *   if (doc.shape() == shape) {
+ *     doc.at<int32_t>(slot);
+ *   }
+ * }
+ * ```
+ * Serialized document is same as serialized `minibson::Document` with same
+ * values. Nested documents are usual `minibson::Document`.
+ */
+class ShapedDocument final {
+public:
+  ShapedDocument() noexcept(false)
+      : shape_{Shape::empty()} {}
+
+  /**\brief move values of the document in slots. Keys are added in sorted
+   * order, so all documents with same keys get same shape
+   */
+  explicit ShapedDocument(Document &&doc) noexcept(false)
+      : shape_{Shape::empty()} {
+    slots_.reserve(doc.size());
+    for (auto iter = doc.begin(); iter != doc.end(); ++iter) {
+      shape_ = shape_->add(iter.key());
+      slots_.emplace_back(std::move(*iter));
+    }
+  }
+
+  /**\param buffer pointer to serialized bson document
+   * \param length size of buffer, need for validate the document
+   * \throw bson::InvalidArgument if can not deserialize bson
+   */
+  ShapedDocument(const void *buffer, int length) noexcept(false)
+      : ShapedDocument{Document{buffer, length}} {}
+  explicit ShapedDocument(microbson::Document doc) noexcept(false)
+      : ShapedDocument{Document{doc}} {}
+
+  ShapedDocument(const ShapedDocument &)     = delete;
+  ShapedDocument(ShapedDocument &&) noexcept = default;
+  ShapedDocument &operator=(ShapedDocument &&) noexcept = default;
+
+  [[nodiscard]] const Shape::pointer &shape() const noexcept { return shape_; }
+
+  [[nodiscard]] bool empty() const noexcept { return slots_.empty(); }
+
+  [[nodiscard]] int size() const noexcept { return slots_.size(); }
+
+  [[nodiscard]] bool contains(std::string_view key) const noexcept {
+    return shape_->slot(key) != Shape::npos;
+  }
+
+  template <class Type>
+  [[nodiscard]] bool contains(std::string_view key) const noexcept {
+    size_t slot = shape_->slot(key);
+    return slot != Shape::npos &&
+           static_cast<bool>(tryValue<Type>(slots_[slot]));
+  }
+
+  /**\throw bson::OutOfRange if not have the value, or bson::BadCast if have not
+   * same type
+   */
+  template <class InputType>
+  result_type<InputType> get(std::string_view key) const noexcept(false) {
+    size_t slot = shape_->slot(key);
+    if (slot == Shape::npos) {
+      throw bson::OutOfRange{"hame not value by key: " + std::string{key}};
+    }
+    return this->at<InputType>(slot);
+  }
+
+  /**\brief not throwing version of get
+   * \return bson::Error::out_of_range if not have the value, or
+   * bson::Error::bad_cast if have not same type
+   */
+  template <class InputType>
+  [[nodiscard]] bson::Result<result_type<InputType>>
+  try_get(std::string_view key) const noexcept {
+    size_t slot = shape_->slot(key);
+    if (slot == Shape::npos) {
+      return bson::Error::out_of_range;
+    }
+    return tryValue<InputType>(slots_[slot]);
+  }
+
+  /**\param slot slot of value in current shape
+   * \throw bson::BadCast if have not same type
+   */
+  template <class InputType>
+  result_type<InputType> at(size_t slot) const noexcept(false) {
+    bson::Result<result_type<InputType>> retval =
+        tryValue<InputType>(slots_[slot]);
+    if (!retval) {
+      throw bson::BadCast{};
+    }
+    return retval.value();
+  }
+
+  template <class InsertType,
+            typename = typename std::enable_if<
+                !std::is_convertible<InsertType, const char *>::value>::type>
+  ShapedDocument &set(std::string_view key,
+                      const InsertType &val) noexcept(false) {
+    this->assign(key, UNodeValueFactory::create(val));
+    return *this;
+  }
+
+  template <class InsertType,
+            typename = typename std::enable_if<
+                std::is_rvalue_reference<InsertType &&>::value &&
+                !std::is_convertible<InsertType, const char *>::value>::type>
+  ShapedDocument &set(std::string_view key, InsertType &&val) noexcept(false) {
+    this->assign(key, UNodeValueFactory::create(std::move(val)));
+    return *this;
+  }
+
+  /**\brief for c-string
+   */
+  template <class InsertType,
+            typename = typename std::enable_if<
+                std::is_convertible<InsertType, const char *>::value>::type>
+  ShapedDocument &set(std::string_view key, InsertType val) noexcept(false) {
+    this->assign(
+        key, UNodeValueFactory::create(reinterpret_cast<const char *>(val)));
+    return *this;
+  }
+
+  ShapedDocument &set(std::string_view key) noexcept(false) {
+    this->assign(key, UNodeValueFactory::create());
+    return *this;
+  }
+
+  /**\brief moves the document to shape without the key
+   */
+  ShapedDocument &erase(std::string_view key) noexcept(false) {
+    if (size_t slot = shape_->slot(key); slot != Shape::npos) {
+      shape_ = shape_->remove(key);
+      slots_.erase(slots_.begin() + slot);
+    }
+    return *this;
+  }
+
+  [[nodiscard]] int getSerializedSize() const noexcept {
+    int count = SIZE_OF_BSON_SIZE;
+    for (size_t slot = 0; slot < slots_.size(); ++slot) {
+      count += SIZE_OF_BSON_TYPE + shape_->key(slot).size() +
+               SIZE_OF_ZERO_BYTE + slots_[slot]->getSerializedSize();
+    }
+    return count + SIZE_OF_ZERO_BYTE;
+  }
+
+  /**\throw bson::InvalidArgument if memory not enough
+   * \brief serialize in existing buffer
+   */
+  int serialize(void *buf, int length) const noexcept(false);
+
+  std::vector<byte> serialize() const noexcept(false) {
+    std::vector<byte> retval(this->getSerializedSize());
+    this->serialize(retval.data(), retval.size());
+    return retval;
+  }
+
+private:
+  void assign(std::string_view key, UNodeValue &&val) noexcept(false) {
+    if (size_t slot = shape_->slot(key); slot != Shape::npos) {
+      slots_[slot] = std::move(val);
+    } else {
+      shape_ = shape_->add(key);
+      slots_.emplace_back(std::move(val));
+    }
+  }
+
+private:
+  Shape::pointer          shape_;
+  std::vector<UNodeValue> slots_;
+};
+
+inline int ShapedDocument::serialize(void *buf, int length) const {
+  int size = this->getSerializedSize();
+  if (length < size) {
+    throw bson::InvalidArgument{MEMORY_ERROR};
+  }
+
+  *reinterpret_cast<int *>(buf) = size;
+  char *ptr                     = reinterpret_cast<char *>(buf);
+  int   offset                  = SIZE_OF_BSON_SIZE;
+  for (uint32_t slot : shape_->sorted()) {
+    const std::string &key = shape_->key(slot);
+    const UNodeValue  &val = slots_[slot];
+
+    *(ptr + offset) = val->type();
+    ++offset;
+    std::memcpy(ptr + offset, key.c_str(), key.size() + SIZE_OF_ZERO_BYTE);
+    offset += key.size() + SIZE_OF_ZERO_BYTE;
+
+    int written =
+        val->serialize(ptr + offset, length - offset - SIZE_OF_ZERO_BYTE);
+    offset += written;
+
+    // nested documents count their own bytes
+    BSON_STATISTICS_ADD(serializedBytes,
+                        SIZE_OF_BSON_TYPE + key.size() + SIZE_OF_ZERO_BYTE +
+                            (val->type() == bson::document_node ||
+                                     val->type() == bson::array_node
+                                 ? 0
+                                 : written));
+  }
+
+  *(ptr + offset) = '\0';
+  ++offset;
+
+  BSON_STATISTICS_ADD(serializedBytes, (MINIMAL_SIZE_OF_BSON_DOCUMENT));
+
+  return offset;
+}
+} // namespace minibson
@@ -0,0 +1,693 @@
+// bsonstruct.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include <array>
+#include <bitset>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define BSON_EXPAND(x) x
+#define BSON_FOR_EACH_1(F, T, x) F(T, x)
+#define BSON_FOR_EACH_2(F, T, x, ...)                                          \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_1(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_3(F, T, x, ...)                                          \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_2(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_4(F, T, x, ...)                                          \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_3(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_5(F, T, x, ...)                                          \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_4(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_6(F, T, x, ...)                                          \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_5(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_7(F, T, x, ...)                                          \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_6(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_8(F, T, x, ...)                                          \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_7(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_9(F, T, x, ...)                                          \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_8(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_10(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_9(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_11(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_10(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_12(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_11(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_13(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_12(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_14(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_13(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_15(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_14(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_16(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_15(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_17(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_16(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_18(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_17(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_19(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_18(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_20(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_19(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_21(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_20(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_22(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_21(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_23(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_22(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_24(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_23(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_25(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_24(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_26(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_25(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_27(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_26(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_28(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_27(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_29(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_28(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_30(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_29(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_31(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_30(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_32(F, T, x, ...)                                         \
+  F(T, x), BSON_EXPAND(BSON_FOR_EACH_31(F, T, __VA_ARGS__))
+#define BSON_FOR_EACH_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12,     \
+                        _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, \
+                        _24, _25, _26, _27, _28, _29, _30, _31, _32, NAME,     \
+                        ...)                                                   \
+  NAME
+#define BSON_FOR_EACH(F, T, ...)                                               \
+  BSON_EXPAND(BSON_FOR_EACH_N(                                                 \
+                              __VA_ARGS__, BSON_FOR_EACH_32, BSON_FOR_EACH_31, \
+                              BSON_FOR_EACH_30, BSON_FOR_EACH_29,              \
+                              BSON_FOR_EACH_28, BSON_FOR_EACH_27,              \
+                              BSON_FOR_EACH_26, BSON_FOR_EACH_25,              \
+                              BSON_FOR_EACH_24, BSON_FOR_EACH_23,              \
+                              BSON_FOR_EACH_22, BSON_FOR_EACH_21,              \
+                              BSON_FOR_EACH_20, BSON_FOR_EACH_19,              \
+                              BSON_FOR_EACH_18, BSON_FOR_EACH_17,              \
+                              BSON_FOR_EACH_16, BSON_FOR_EACH_15,              \
+                              BSON_FOR_EACH_14, BSON_FOR_EACH_13,              \
+                              BSON_FOR_EACH_12, BSON_FOR_EACH_11,              \
+                              BSON_FOR_EACH_10, BSON_FOR_EACH_9,               \
+                              BSON_FOR_EACH_8, BSON_FOR_EACH_7,                \
+                              BSON_FOR_EACH_6, BSON_FOR_EACH_5,                \
+                              BSON_FOR_EACH_4, BSON_FOR_EACH_3,                \
+                              BSON_FOR_EACH_2,                                 \
+                              BSON_FOR_EACH_1)(F, T, __VA_ARGS__))
+
+#define BSON_STRUCT_FIELD(Type, member)                                        \
+  ::microbson::field(#member, &Type::member)
+
+/**\brief declare list of serialized members of the struct. Keys of values are
+ * same as names of members. Must be used in global namespace, for example:
+ * `BSON_STRUCT(some::Point, x, y)`
+ */
+#define BSON_STRUCT(Type, ...)                                                 \
+  namespace microbson {                                                        \
+  template <>                                                                  \
+  struct struct_traits<Type> {                                                 \
+    static constexpr auto fields =                                             \
+        std::make_tuple(BSON_FOR_EACH(BSON_STRUCT_FIELD, Type, __VA_ARGS__));  \
+  };                                                                           \
+  }
+
+namespace microbson {
+/**\brief must contains:
+ * - static constexpr auto fields = std::make_tuple(field("key", &T::member),
+ * ...) (required)
+ *
+ * Supported types of members: bool, integers, floating point numbers,
+ * std::string, bson::ObjectId, bson::DateTime, bson::Timestamp,
+ * bson::Decimal128, std::vector and std::optional of supported types and
+ * structs with own struct_traits. Empty optional values are not serialized,
+ * and they are not required for deserialization, so std::optional can not be
+ * item of std::vector
+ * \see BSON_STRUCT
+ */
+template <class T>
+struct struct_traits {};
+
+template <class T, class M>
+struct Field {
+  using struct_type = T;
+  using member_type = M;
+
+  std::string_view key;
+  M T::*member;
+};
+
+template <class T, class M>
+constexpr Field<T, M> field(std::string_view key, M T::*member) noexcept {
+  return Field<T, M>{key, member};
+}
+
+/**\brief result of deserialization of struct
+ */
+struct DecodeResult {
+  bson::Error error = bson::Error::none;
+  /**\brief key of value, which caused the error
+   */
+  std::string_view key;
+
+  explicit operator bool() const noexcept { return error == bson::Error::none; }
+};
+
+namespace detail {
+template <class T, class = void>
+struct is_struct : std::false_type {};
+
+template <class T>
+struct is_struct<T, std::void_t<decltype(struct_traits<T>::fields)>>
+    : std::true_type {};
+
+template <class T>
+struct is_vector : std::false_type {};
+
+template <class T, class A>
+struct is_vector<std::vector<T, A>> : std::true_type {};
+
+template <class T>
+struct is_optional : std::false_type {};
+
+template <class T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+/**\brief fixed-width bson values, which are stored as is
+ */
+template <class T>
+struct is_special
+    : std::integral_constant<bool,
+                             std::is_same<T, bson::ObjectId>::value ||
+                                 std::is_same<T, bson::DateTime>::value ||
+                                 std::is_same<T, bson::Timestamp>::value ||
+                                 std::is_same<T, bson::Decimal128>::value> {};
+
+template <class T>
+using fields_type = std::decay_t<decltype(struct_traits<T>::fields)>;
+
+template <class T, size_t I>
+using member_type =
+    typename std::tuple_element<I, fields_type<T>>::type::member_type;
+
+template <class M>
+constexpr bson::NodeType nodeType() noexcept {
+  if constexpr (std::is_same<M, bool>::value) {
+    return bson::boolean_node;
+  } else if constexpr (std::is_floating_point<M>::value) {
+    return bson::double_node;
+  } else if constexpr (std::is_integral<M>::value) {
+    constexpr bool fitsInt32 =
+        sizeof(M) < SIZE_OF_INT32_VALUE ||
+        (sizeof(M) == SIZE_OF_INT32_VALUE && std::is_signed<M>::value);
+    return fitsInt32 ? bson::int32_node : bson::int64_node;
+  } else if constexpr (std::is_same<M, std::string>::value) {
+    return bson::string_node;
+  } else if constexpr (is_vector<M>::value) {
+    // items of arrays can not be skipped without change of indexes
+    static_assert(!is_optional<typename M::value_type>::value,
+                  "std::optional is not supported as item of std::vector");
+    return bson::array_node;
+  } else if constexpr (is_optional<M>::value) {
+    return nodeType<typename M::value_type>();
+  } else if constexpr (is_special<M>::value) {
+    return static_cast<bson::NodeType>(type_traits<M>::node_type_code);
+  } else {
+    static_assert(is_struct<M>::value, "unsupported type of member");
+    return bson::document_node;
+  }
+}
+
+/**\return true if the integer value of bson fits in the integer member
+ */
+template <class M, class V>
+constexpr bool fitsInteger(V value) noexcept {
+  if constexpr (std::is_signed<M>::value) {
+    return value >= std::numeric_limits<M>::min() &&
+           value <= std::numeric_limits<M>::max();
+  } else {
+    return value >= 0 &&
+           std::make_unsigned_t<V>(value) <= std::numeric_limits<M>::max();
+  }
+}
+
+template <class T, size_t... I>
+constexpr int fixedDocumentSize(std::index_sequence<I...>) noexcept;
+
+/**\return size of serialized value, or -1 if it is not constant
+ */
+template <class M>
+constexpr int fixedValueSize() noexcept {
+  if constexpr (is_optional<M>::value) {
+    return -1; // value can be absent
+  } else if constexpr (is_struct<M>::value) {
+    return fixedDocumentSize<M>(
+        std::make_index_sequence<std::tuple_size<fields_type<M>>::value>{});
+  } else {
+    switch (nodeType<M>()) {
+    case bson::boolean_node:
+      return SIZE_OF_BOOLEAN_VALUE;
+    case bson::double_node:
+      return SIZE_OF_DOUBLE_VALUE;
+    case bson::int32_node:
+      return SIZE_OF_INT32_VALUE;
+    case bson::int64_node:
+      return SIZE_OF_INT64_VALUE;
+    case bson::objectid_node:
+    case bson::datetime_node:
+    case bson::timestamp_node:
+    case bson::decimal128_node:
+      return sizeof(M);
+    default:
+      return -1;
+    }
+  }
+}
+
+template <class T, size_t... I>
+constexpr int fixedDocumentSize(std::index_sequence<I...>) noexcept {
+  constexpr auto &fields = struct_traits<T>::fields;
+
+  const int sizes[] = {fixedValueSize<member_type<T, I>>()..., 0};
+  const int keys[]  = {int(std::get<I>(fields).key.size())..., 0};
+
+  int size = MINIMAL_SIZE_OF_BSON_DOCUMENT;
+  for (size_t i = 0; i < sizeof...(I); ++i) {
+    if (sizes[i] < 0) {
+      return -1;
+    }
+    size += SIZE_OF_BSON_TYPE + keys[i] + SIZE_OF_ZERO_BYTE + sizes[i];
+  }
+  return size;
+}
+
+inline int indexSize(size_t i) noexcept {
+  int size = 1;
+  for (; i >= 10; i /= 10) {
+    ++size;
+  }
+  return size;
+}
+
+template <class T>
+int documentSize(const T &obj) noexcept;
+
+template <class M>
+int valueSize(const M &val) noexcept {
+  if constexpr (is_optional<M>::value) {
+    return valueSize(*val);
+  } else if constexpr (is_struct<M>::value) {
+    return documentSize(val);
+  } else if constexpr (std::is_same<M, std::string>::value) {
+    return SIZE_OF_BSON_SIZE + val.size() + SIZE_OF_ZERO_BYTE;
+  } else if constexpr (is_vector<M>::value) {
+    int size = MINIMAL_SIZE_OF_BSON_DOCUMENT;
+    for (size_t i = 0; i < val.size(); ++i) {
+      const typename M::value_type &item = val[i];
+      size += SIZE_OF_BSON_TYPE + indexSize(i) + SIZE_OF_ZERO_BYTE +
+              valueSize(item);
+    }
+    return size;
+  } else {
+    return fixedValueSize<M>();
+  }
+}
+
+template <class M>
+int nodeSize(std::string_view key, const M &val) noexcept {
+  if constexpr (is_optional<M>::value) {
+    if (!val.has_value()) {
+      return 0;
+    }
+  }
+  return SIZE_OF_BSON_TYPE + key.size() + SIZE_OF_ZERO_BYTE + valueSize(val);
+}
+
+template <class T>
+int documentSize(const T &obj) noexcept {
+  if constexpr (constexpr int size = fixedValueSize<T>(); size >= 0) {
+    (void)obj;
+    return size;
+  } else {
+    return std::apply(
+        [&obj](const auto &...fields) {
+          return MINIMAL_SIZE_OF_BSON_DOCUMENT +
+                 (0 + ... + nodeSize(fields.key, obj.*(fields.member)));
+        },
+        struct_traits<T>::fields);
+  }
+}
+
+template <class T>
+byte *writeDocument(byte *ptr, const T &obj) noexcept;
+
+template <class M>
+byte *writeNode(byte *ptr, std::string_view key, const M &val) noexcept;
+
+template <class M>
+byte *writeValue(byte *ptr, const M &val) noexcept {
+  if constexpr (is_optional<M>::value) {
+    return writeValue(ptr, *val);
+  } else if constexpr (is_struct<M>::value) {
+    return writeDocument(ptr, val);
+  } else if constexpr (std::is_same<M, std::string>::value) {
+    int32_t length = val.size() + SIZE_OF_ZERO_BYTE;
+    std::memcpy(ptr, &length, SIZE_OF_BSON_SIZE);
+    std::memcpy(ptr + SIZE_OF_BSON_SIZE, val.c_str(), length);
+    return ptr + SIZE_OF_BSON_SIZE + length;
+  } else if constexpr (is_vector<M>::value) {
+    byte *start = ptr;
+    ptr += SIZE_OF_BSON_SIZE;
+    for (size_t i = 0; i < val.size(); ++i) {
+      char key[16];
+      auto [end, ec] = std::to_chars(std::begin(key), std::end(key), i);
+      (void)ec;
+
+      const typename M::value_type &item = val[i];
+      ptr = writeNode(ptr, std::string_view(key, end - key), item);
+    }
+    *ptr++         = '\0';
+    int32_t length = ptr - start;
+    std::memcpy(start, &length, SIZE_OF_BSON_SIZE);
+    return ptr;
+  } else if constexpr (std::is_same<M, bool>::value) {
+    *ptr = val ? 1 : 0;
+    return ptr + SIZE_OF_BOOLEAN_VALUE;
+  } else if constexpr (is_special<M>::value) {
+    std::memcpy(ptr, &val, sizeof(M));
+    return ptr + sizeof(M);
+  } else if constexpr (nodeType<M>() == bson::double_node) {
+    double value = val;
+    std::memcpy(ptr, &value, SIZE_OF_DOUBLE_VALUE);
+    return ptr + SIZE_OF_DOUBLE_VALUE;
+  } else if constexpr (nodeType<M>() == bson::int32_node) {
+    int32_t value = val;
+    std::memcpy(ptr, &value, SIZE_OF_INT32_VALUE);
+    return ptr + SIZE_OF_INT32_VALUE;
+  } else {
+    int64_t value = val;
+    std::memcpy(ptr, &value, SIZE_OF_INT64_VALUE);
+    return ptr + SIZE_OF_INT64_VALUE;
+  }
+}
+
+template <class M>
+byte *writeNode(byte *ptr, std::string_view key, const M &val) noexcept {
+  if constexpr (is_optional<M>::value) {
+    if (!val.has_value()) {
+      return ptr;
+    }
+  }
+
+  *ptr++ = nodeType<M>();
+  std::memcpy(ptr, key.data(), key.size());
+  ptr += key.size();
+  *ptr++ = '\0';
+  return writeValue(ptr, val);
+}
+
+template <class T>
+byte *writeDocument(byte *ptr, const T &obj) noexcept {
+  byte *start = ptr;
+  ptr += SIZE_OF_BSON_SIZE;
+  std::apply(
+      [&ptr, &obj](const auto &...fields) {
+        ((ptr = writeNode(ptr, fields.key, obj.*(fields.member))), ...);
+      },
+      struct_traits<T>::fields);
+  *ptr++ = '\0';
+
+  int32_t length = ptr - start;
+  std::memcpy(start, &length, SIZE_OF_BSON_SIZE);
+  return ptr;
+}
+
+/**\brief FNV-1a hash with seed, used for dispatch keys of struct members
+ */
+constexpr uint32_t keyHash(std::string_view key, uint32_t seed) noexcept {
+  uint32_t hash = 2166136261u ^ seed;
+  for (char c : key) {
+    hash ^= uint8_t(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**\brief compile-time perfect hash table for keys of struct members: every
+ * key has own slot in the table
+ */
+template <class T>
+class KeyTable final {
+  template <size_t... I>
+  static constexpr std::array<std::string_view, sizeof...(I)>
+  makeKeys(std::index_sequence<I...>) noexcept {
+    return {std::get<I>(struct_traits<T>::fields).key...};
+  }
+
+public:
+  static constexpr size_t count = std::tuple_size<fields_type<T>>::value;
+  static constexpr std::array<std::string_view, count> keys =
+      makeKeys(std::make_index_sequence<count>{});
+
+  static_assert(count < 0x7FFF, "too many members");
+
+  struct Table {
+    uint32_t seed = 0;
+    uint32_t mask = 0;
+    int16_t  slots[count * 8 + 1]{};
+  };
+
+  static constexpr Table build() noexcept {
+    Table table;
+    // table size is power of two, at least twice bigger then count of keys
+    for (size_t size = 2; size <= count * 8; size *= 2) {
+      if (size < count * 2) {
+        continue;
+      }
+
+      table.mask = size - 1;
+      for (uint32_t seed = 0; seed < 1024; ++seed) {
+        table.seed = seed;
+        for (size_t i = 0; i < size; ++i) {
+          table.slots[i] = -1;
+        }
+
+        bool collision = false;
+        for (size_t i = 0; i < count && !collision; ++i) {
+          int16_t &slot = table.slots[keyHash(keys[i], seed) & table.mask];
+          collision     = slot != -1;
+          slot          = i;
+        }
+        if (!collision) {
+          return table;
+        }
+      }
+    }
+
+    table.mask = 0; // not found
+    return table;
+  }
+
+  static constexpr Table table = build();
+
+  static_assert(count == 0 || table.mask != 0,
+                "can not build perfect hash for keys of the struct");
+
+  /**\return index of member by the key, or -1 if the struct has not the key
+   */
+  static int find(std::string_view key) noexcept {
+    if constexpr (count == 0) {
+      return -1;
+    } else {
+      int index = table.slots[keyHash(key, table.seed) & table.mask];
+      if (index < 0 || keys[index] != key) {
+        return -1;
+      }
+      return index;
+    }
+  }
+};
+
+template <class T>
+DecodeResult readDocument(Document doc, T &obj) noexcept(false);
+
+template <class M>
+bson::Error readValue(Node node, M &val) noexcept(false) {
+  if constexpr (is_optional<M>::value) {
+    typename M::value_type value{};
+    if (bson::Error error = readValue(node, value);
+        error != bson::Error::none) {
+      return error;
+    }
+    val = std::move(value);
+    return bson::Error::none;
+  } else {
+    if (node.type() != nodeType<M>()) {
+      return bson::Error::bad_cast;
+    }
+
+    if constexpr (is_struct<M>::value) {
+      return readDocument(node.value<Document>(), val).error;
+    } else if constexpr (std::is_same<M, std::string>::value) {
+      val = node.value<std::string_view>();
+    } else if constexpr (is_vector<M>::value) {
+      Array arr = node.value<Array>();
+      val.clear();
+      for (Node item : arr) {
+        typename M::value_type value{};
+        if (bson::Error error = readValue(item, value);
+            error != bson::Error::none) {
+          return error;
+        }
+        val.push_back(std::move(value));
+      }
+    } else if constexpr (std::is_same<M, bool>::value) {
+      val = node.value<bool>();
+    } else if constexpr (is_special<M>::value) {
+      val = node.value<M>();
+    } else if constexpr (nodeType<M>() == bson::double_node) {
+      val = node.value<double>();
+    } else if constexpr (nodeType<M>() == bson::int32_node) {
+      int32_t value = node.value<int32_t>();
+      if (!fitsInteger<M>(value)) {
+        return bson::Error::out_of_range;
+      }
+      val = static_cast<M>(value);
+    } else {
+      int64_t value = node.value<int64_t>();
+      if (!fitsInteger<M>(value)) {
+        return bson::Error::out_of_range;
+      }
+      val = static_cast<M>(value);
+    }
+    return bson::Error::none;
+  }
+}
+
+template <class T, size_t I>
+bson::Error readField(Node node, T &obj) noexcept(false) {
+  return readValue(node, obj.*(std::get<I>(struct_traits<T>::fields).member));
+}
+
+template <class T, size_t... I>
+constexpr std::array<bson::Error (*)(Node, T &), sizeof...(I)>
+makeReaders(std::index_sequence<I...>) noexcept {
+  return {&readField<T, I>...};
+}
+
+template <class T, size_t... I>
+std::bitset<sizeof...(I)> makeRequired(std::index_sequence<I...>) noexcept {
+  std::bitset<sizeof...(I)> retval;
+  ((retval[I] = !is_optional<member_type<T, I>>::value), ...);
+  return retval;
+}
+
+template <class T, size_t... I>
+void resetOptional(T &obj, std::index_sequence<I...>) noexcept {
+  auto reset = [](auto &val) {
+    if constexpr (is_optional<std::decay_t<decltype(val)>>::value) {
+      val.reset();
+    }
+  };
+  (reset(obj.*(std::get<I>(struct_traits<T>::fields).member)), ...);
+}
+template <class T>
+DecodeResult readDocument(Document doc, T &obj) noexcept(false) {
+  using key_table     = KeyTable<T>;
+  using sequence_type = std::make_index_sequence<key_table::count>;
+
+  static constexpr auto readers = makeReaders<T>(sequence_type{});
+
+  resetOptional(obj, sequence_type{});
+
+  std::bitset<key_table::count> found;
+  for (Node node : doc) {
+    std::string_view key   = node.key();
+    int              index = key_table::find(key);
+    if (index < 0) { // unknown values are skipped
+      continue;
+    }
+
+    if (bson::Error error = readers[index](node, obj);
+        error != bson::Error::none) {
+      return DecodeResult{error, key_table::keys[index]};
+    }
+    found[index] = true;
+  }
+
+  if (std::bitset<key_table::count> missing =
+          makeRequired<T>(sequence_type{}) & ~found;
+      missing.any()) {
+    for (size_t i = 0; i < key_table::count; ++i) {
+      if (missing[i]) {
+        return DecodeResult{bson::Error::out_of_range, key_table::keys[i]};
+      }
+    }
+  }
+
+  return DecodeResult{};
+}
+} // namespace detail
+
+/**\return size of serialized struct if all its members have fixed size (also
+ * in nested structs), otherwise -1
+ */
+template <class T>
+constexpr int fixedSerializedSize() noexcept {
+  return detail::fixedValueSize<T>();
+}
+
+/**\return count of bytes, needed for serialization of the struct
+ */
+template <class T,
+          typename = typename std::enable_if<detail::is_struct<T>::value>::type>
+[[nodiscard]] int getSerializedSize(const T &obj) noexcept {
+  return detail::documentSize(obj);
+}
+
+/**\brief serialize the struct directly in the buffer
+ * \return count of serialized bytes
+ * \throw bson::InvalidArgument if memory not enough
+ */
+template <class T,
+          typename = typename std::enable_if<detail::is_struct<T>::value>::type>
+int serialize(const T &obj, void *buf, int length) noexcept(false) {
+  if (length < detail::documentSize(obj)) {
+    throw bson::InvalidArgument{"not enough memory in buffer"};
+  }
+
+  byte *end = detail::writeDocument(reinterpret_cast<byte *>(buf), obj);
+  return end - reinterpret_cast<byte *>(buf);
+}
+
+template <class T,
+          typename = typename std::enable_if<detail::is_struct<T>::value>::type>
+std::vector<byte> serialize(const T &obj) noexcept(false) {
+  std::vector<byte> retval(detail::documentSize(obj));
+  detail::writeDocument(retval.data(), obj);
+  return retval;
+}
+
+/**\brief read members of the struct from the document by one pass. Members
+ * are found by compile-time perfect hash of keys, unknown values are skipped
+ * \param doc valid bson document, @see Document::valid
+ * \return bson::Error::out_of_range if some not optional value not found or
+ * integer value not fits in type of the member, bson::Error::bad_cast if value
+ * have different type. Values of the struct can be partially changed in case
+ * of error
+ */
+template <class T,
+          typename = typename std::enable_if<detail::is_struct<T>::value>::type>
+DecodeResult deserialize(Document doc, T &obj) noexcept(false) {
+  return detail::readDocument(doc, obj);
+}
+} // namespace microbson
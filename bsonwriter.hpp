@@ -0,0 +1,307 @@
+// bsonwriter.hpp
+
+#pragma once
+
+#include "microbson.hpp"
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef BSON_WRITER_MAX_DEPTH
+#  define BSON_WRITER_MAX_DEPTH 100
+#endif
+
+namespace microbson {
+/**\brief DOM-free bson builder, which appends typed values directly into the
+ * output buffer. Length prefixes of documents and arrays are written when
+ * scope is closed. Result is same as serialized minibson::Document with same
+ * values in same order.
+ *
+ * Values in documents must be appended with keys, values in arrays - without,
+ * keys of arrays are generated automatically.
+ * \warning the writer not check keys on uniqueness
+ */
+class BsonWriter final {
+public:
+  /**\brief start new document at the end of the buffer
+   */
+  explicit BsonWriter(std::vector<byte> &out) noexcept(false)
+      : out_{out}
+      , depth_{0} {
+    this->open(bson::document_node);
+  }
+
+  BsonWriter(const BsonWriter &) = delete;
+  BsonWriter &operator=(const BsonWriter &) = delete;
+
+  /**\return true if all scopes, including the root document, are closed
+   */
+  [[nodiscard]] bool finished() const noexcept { return depth_ == 0; }
+
+  /**\return depth of current scope, 1 for root document
+   */
+  [[nodiscard]] int depth() const noexcept { return depth_; }
+
+  /**\throw bson::InvalidArgument if current scope is array
+   */
+  BsonWriter &append(std::string_view key, double val) noexcept(false) {
+    return this->appendFixed(bson::double_node, key, val);
+  }
+  BsonWriter &append(std::string_view key, int32_t val) noexcept(false) {
+    return this->appendFixed(bson::int32_node, key, val);
+  }
+  BsonWriter &append(std::string_view key, int64_t val) noexcept(false) {
+    return this->appendFixed(bson::int64_node, key, val);
+  }
+  BsonWriter &append(std::string_view key, bool val) noexcept(false) {
+    return this->appendFixed(bson::boolean_node, key, byte(val ? 1 : 0));
+  }
+  BsonWriter &append(std::string_view key, bson::ObjectId val) noexcept(false) {
+    return this->appendFixed(bson::objectid_node, key, val);
+  }
+  BsonWriter &append(std::string_view key, bson::DateTime val) noexcept(false) {
+    return this->appendFixed(bson::datetime_node, key, val);
+  }
+  BsonWriter &append(std::string_view key,
+                     bson::Timestamp  val) noexcept(false) {
+    return this->appendFixed(bson::timestamp_node, key, val);
+  }
+  BsonWriter &append(std::string_view key,
+                     bson::Decimal128 val) noexcept(false) {
+    return this->appendFixed(bson::decimal128_node, key, val);
+  }
+  BsonWriter &append(std::string_view key, std::string_view val) noexcept(
+      false) {
+    this->appendKey(bson::string_node, key);
+    this->appendString(val);
+    return *this;
+  }
+  BsonWriter &append(std::string_view key, const char *val) noexcept(false) {
+    return this->append(key, std::string_view{val});
+  }
+  BsonWriter &append(std::string_view key,
+                     const std::string &val) noexcept(false) {
+    return this->append(key, std::string_view{val});
+  }
+  BsonWriter &append(std::string_view key, Binary val) noexcept(false) {
+    this->appendKey(bson::binary_node, key);
+    this->appendBinary(val);
+    return *this;
+  }
+  /**\brief copy serialized document as is
+   */
+  BsonWriter &append(std::string_view key, const Document &val) noexcept(
+      false) {
+    this->appendKey(val.type(), key);
+    this->appendDocument(val);
+    return *this;
+  }
+  /**\brief append null value
+   */
+  BsonWriter &appendNull(std::string_view key) noexcept(false) {
+    this->appendKey(bson::null_node, key);
+    return *this;
+  }
+
+  /**\brief append value in array
+   * \throw bson::InvalidArgument if current scope is not array
+   */
+  BsonWriter &append(double val) noexcept(false) {
+    return this->appendFixed(bson::double_node, val);
+  }
+  BsonWriter &append(int32_t val) noexcept(false) {
+    return this->appendFixed(bson::int32_node, val);
+  }
+  BsonWriter &append(int64_t val) noexcept(false) {
+    return this->appendFixed(bson::int64_node, val);
+  }
+  BsonWriter &append(bool val) noexcept(false) {
+    return this->appendFixed(bson::boolean_node, byte(val ? 1 : 0));
+  }
+  BsonWriter &append(bson::ObjectId val) noexcept(false) {
+    return this->appendFixed(bson::objectid_node, val);
+  }
+  BsonWriter &append(bson::DateTime val) noexcept(false) {
+    return this->appendFixed(bson::datetime_node, val);
+  }
+  BsonWriter &append(bson::Timestamp val) noexcept(false) {
+    return this->appendFixed(bson::timestamp_node, val);
+  }
+  BsonWriter &append(bson::Decimal128 val) noexcept(false) {
+    return this->appendFixed(bson::decimal128_node, val);
+  }
+  BsonWriter &append(std::string_view val) noexcept(false) {
+    this->appendIndex(bson::string_node);
+    this->appendString(val);
+    return *this;
+  }
+  BsonWriter &append(const char *val) noexcept(false) {
+    return this->append(std::string_view{val});
+  }
+  BsonWriter &append(const std::string &val) noexcept(false) {
+    return this->append(std::string_view{val});
+  }
+  BsonWriter &append(Binary val) noexcept(false) {
+    this->appendIndex(bson::binary_node);
+    this->appendBinary(val);
+    return *this;
+  }
+  BsonWriter &append(const Document &val) noexcept(false) {
+    this->appendIndex(val.type());
+    this->appendDocument(val);
+    return *this;
+  }
+  /**\brief append null value in array
+   */
+  BsonWriter &appendNull() noexcept(false) {
+    this->appendIndex(bson::null_node);
+    return *this;
+  }
+
+  /**\brief open nested document, all next values will be appended in it
+   * until @see close
+   */
+  BsonWriter &openDocument(std::string_view key) noexcept(false) {
+    this->appendKey(bson::document_node, key);
+    return this->open(bson::document_node);
+  }
+  BsonWriter &openArray(std::string_view key) noexcept(false) {
+    this->appendKey(bson::array_node, key);
+    return this->open(bson::array_node);
+  }
+
+  /**\brief open nested document in array
+   */
+  BsonWriter &openDocument() noexcept(false) {
+    this->appendIndex(bson::document_node);
+    return this->open(bson::document_node);
+  }
+  BsonWriter &openArray() noexcept(false) {
+    this->appendIndex(bson::array_node);
+    return this->open(bson::array_node);
+  }
+
+  /**\brief close current scope and write its length
+   * \throw bson::OutOfRange if all scopes already closed
+   */
+  BsonWriter &close() noexcept(false) {
+    if (depth_ == 0) {
+      throw bson::OutOfRange{"all scopes already closed"};
+    }
+
+    const Scope &scope = scopes_[--depth_];
+    out_.push_back('\0');
+
+    int32_t length = out_.size() - scope.offset;
+    std::memcpy(out_.data() + scope.offset, &length, SIZE_OF_BSON_SIZE);
+    return *this;
+  }
+
+  /**\brief close all opened scopes
+   * \return length of the root document
+   */
+  int finish() noexcept(false) {
+    size_t rootOffset = depth_ ? scopes_[0].offset : out_.size();
+    while (depth_) {
+      this->close();
+    }
+    return out_.size() - rootOffset;
+  }
+
+private:
+  struct Scope {
+    size_t         offset;
+    bson::NodeType type;
+    int            index;
+  };
+
+  BsonWriter &open(bson::NodeType type) noexcept(false) {
+    if (depth_ == BSON_WRITER_MAX_DEPTH) {
+      throw bson::OutOfRange{"too deep nesting"};
+    }
+
+    scopes_[depth_++] = Scope{out_.size(), type, 0};
+    out_.resize(out_.size() + SIZE_OF_BSON_SIZE);
+    return *this;
+  }
+
+  void appendKey(bson::NodeType type, std::string_view key) noexcept(false) {
+    if (depth_ == 0 || scopes_[depth_ - 1].type != bson::document_node) {
+      throw bson::InvalidArgument{"values with keys can be appended only in "
+                                  "document"};
+    }
+
+    out_.push_back(type);
+    out_.insert(out_.end(), key.begin(), key.end());
+    out_.push_back('\0');
+  }
+
+  void appendIndex(bson::NodeType type) noexcept(false) {
+    if (depth_ == 0 || scopes_[depth_ - 1].type != bson::array_node) {
+      throw bson::InvalidArgument{"values without keys can be appended only in "
+                                  "array"};
+    }
+
+    char key[16];
+    auto [end, ec] = std::to_chars(
+        std::begin(key), std::end(key), scopes_[depth_ - 1].index);
+    (void)ec;
+    ++scopes_[depth_ - 1].index;
+
+    out_.push_back(type);
+    out_.insert(out_.end(), key, end);
+    out_.push_back('\0');
+  }
+
+  template <class T>
+  BsonWriter &appendFixed(bson::NodeType   type,
+                          std::string_view key,
+                          T                val) noexcept(false) {
+    this->appendKey(type, key);
+    this->appendRaw(&val, sizeof(val));
+    return *this;
+  }
+
+  template <class T>
+  BsonWriter &appendFixed(bson::NodeType type, T val) noexcept(false) {
+    this->appendIndex(type);
+    this->appendRaw(&val, sizeof(val));
+    return *this;
+  }
+
+  void appendRaw(const void *data, size_t length) noexcept {
+    const byte *ptr = reinterpret_cast<const byte *>(data);
+    out_.insert(out_.end(), ptr, ptr + length);
+  }
+
+  void appendString(std::string_view val) noexcept {
+    int32_t length = val.size() + SIZE_OF_ZERO_BYTE;
+    this->appendRaw(&length, SIZE_OF_BSON_SIZE);
+    this->appendRaw(val.data(), val.size());
+    out_.push_back('\0');
+  }
+
+  void appendBinary(Binary val) noexcept {
+    this->appendRaw(&val.second, SIZE_OF_BSON_SIZE);
+    out_.push_back('\0'); // binary subtype
+    this->appendRaw(val.first, val.second);
+  }
+
+  void appendDocument(const Document &val) noexcept {
+    if (val.empty()) {
+      static constexpr byte emptyDocument[MINIMAL_SIZE_OF_BSON_DOCUMENT]{
+          MINIMAL_SIZE_OF_BSON_DOCUMENT};
+      this->appendRaw(emptyDocument, MINIMAL_SIZE_OF_BSON_DOCUMENT);
+    } else {
+      this->appendRaw(val.data(), val.length());
+    }
+  }
+
+private:
+  std::vector<byte> &out_;
+  Scope              scopes_[BSON_WRITER_MAX_DEPTH];
+  int                depth_;
+};
+} // namespace microbson
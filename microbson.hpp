@@ -3,22 +3,33 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 
 #define SIZE_OF_BSON_TYPE 1
 #define SIZE_OF_ZERO_BYTE 1
 #define SIZE_OF_BSON_SIZE 4
 #define SIZE_OF_BSON_SUBTYPE 1
 
+#define BSON_PATH_DELIMITER '.'
+
 #define SIZE_OF_BOOLEAN_VALUE 1
 #define SIZE_OF_INT32_VALUE 4
 #define SIZE_OF_INT64_VALUE 8
 #define SIZE_OF_DOUBLE_VALUE 8
 #define SIZE_OF_NULL_VALUE 0
+#define SIZE_OF_OBJECTID_VALUE 12
+#define SIZE_OF_DATETIME_VALUE 8
+#define SIZE_OF_TIMESTAMP_VALUE 8
+#define SIZE_OF_DECIMAL128_VALUE 16
 
 #define MINIMAL_SIZE_OF_BSON_DOCUMENT SIZE_OF_BSON_SIZE + SIZE_OF_ZERO_BYTE
 
@@ -32,6 +43,14 @@
   MINIMAL_SIZE_OF_BSON_NODE + SIZE_OF_DOUBLE_VALUE
 #define MINIMAL_SIZE_OF_BSON_BOOLEAN_NODE                                      \
   MINIMAL_SIZE_OF_BSON_NODE + SIZE_OF_BOOLEAN_VALUE
+#define MINIMAL_SIZE_OF_BSON_OBJECTID_NODE                                     \
+  MINIMAL_SIZE_OF_BSON_NODE + SIZE_OF_OBJECTID_VALUE
+#define MINIMAL_SIZE_OF_BSON_DATETIME_NODE                                     \
+  MINIMAL_SIZE_OF_BSON_NODE + SIZE_OF_DATETIME_VALUE
+#define MINIMAL_SIZE_OF_BSON_TIMESTAMP_NODE                                    \
+  MINIMAL_SIZE_OF_BSON_NODE + SIZE_OF_TIMESTAMP_VALUE
+#define MINIMAL_SIZE_OF_BSON_DECIMAL128_NODE                                   \
+  MINIMAL_SIZE_OF_BSON_NODE + SIZE_OF_DECIMAL128_VALUE
 #define MINIMAL_SIZE_OF_BSON_STRING_NODE                                       \
   MINIMAL_SIZE_OF_BSON_NODE + 1 + SIZE_OF_ZERO_BYTE
 #define MINIMAL_SIZE_OF_BSON_BINARY_NODE                                       \
@@ -39,6 +58,16 @@
 #define MINIMAL_SIZE_OF_BSON_DOCUMENT_NODE                                     \
   MINIMAL_SIZE_OF_BSON_NODE + MINIMAL_SIZE_OF_BSON_DOCUMENT
 
+/**\brief hot-path counters are compiled only if BSON_STATISTICS is defined
+ * before including the header, otherwise the macro expands to nothing
+ */
+#ifdef BSON_STATISTICS
+#  define BSON_STATISTICS_ADD(counter, value)                                  \
+    (::bson::Statistics::local().counter += (value))
+#else
+#  define BSON_STATISTICS_ADD(counter, value)
+#endif
+
 namespace bson {
 class Exception {
 public:
@@ -79,21 +108,232 @@ public:
   }
 };
 
+/**\brief error codes for functions, which not throw exceptions. Every code
+ * corresponds to the exception, which throws same throwing function
+ */
+enum class Error {
+  none             = 0,
+  bad_cast         = 1, // @see BadCast
+  invalid_argument = 2, // @see InvalidArgument
+  out_of_range     = 3, // @see OutOfRange
+};
+
+/**\brief value or error code, returned by not throwing functions (`try_get`,
+ * `try_at`). Failure not allocates memory. References are stored as pointers,
+ * so the value must outlive the result
+ */
+template <class T>
+class Result final {
+  using storage_type =
+      typename std::conditional<std::is_reference<T>::value,
+                                const std::remove_reference_t<T> *,
+                                T>::type;
+
+public:
+  using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+
+  Result(Error error) noexcept
+      : error_{error} {}
+
+  Result(T value) noexcept(std::is_nothrow_move_constructible<T>::value)
+      : error_{Error::none} {
+    if constexpr (std::is_reference<T>::value) {
+      value_ = &value;
+    } else {
+      value_.emplace(std::move(value));
+    }
+  }
+
+  explicit operator bool() const noexcept { return error_ == Error::none; }
+
+  [[nodiscard]] Error error() const noexcept { return error_; }
+
+  /**\warning the result must contain value
+   */
+  [[nodiscard]] const value_type &value() const noexcept {
+    if constexpr (std::is_reference<T>::value) {
+      return **value_;
+    } else {
+      return *value_;
+    }
+  }
+
+  [[nodiscard]] const value_type &operator*() const noexcept {
+    return this->value();
+  }
+  [[nodiscard]] const value_type *operator->() const noexcept {
+    return &this->value();
+  }
+
+  /**\return the value, or `other` in case of error
+   */
+  [[nodiscard]] value_type value_or(value_type other) const noexcept(
+      std::is_nothrow_copy_constructible<value_type>::value) {
+    return error_ == Error::none ? this->value() : other;
+  }
+
+private:
+  std::optional<storage_type> value_;
+  Error                       error_;
+};
+
 enum NodeType {
-  double_node   = 0x01,
-  string_node   = 0x02,
-  document_node = 0x03,
-  array_node    = 0x04,
-  binary_node   = 0x05,
-  boolean_node  = 0x08,
-  null_node     = 0x0A,
-  int32_node    = 0x10,
-  int64_node    = 0x12,
-  unknown_node  = 0xFF
+  double_node     = 0x01,
+  string_node     = 0x02,
+  document_node   = 0x03,
+  array_node      = 0x04,
+  binary_node     = 0x05,
+  objectid_node   = 0x07,
+  boolean_node    = 0x08,
+  datetime_node   = 0x09,
+  null_node       = 0x0A,
+  int32_node      = 0x10,
+  timestamp_node  = 0x11,
+  int64_node      = 0x12,
+  decimal128_node = 0x13,
+  unknown_node    = 0xFF
 };
 
 enum Scalar {}; // special value for scalars
 
+/**\brief 12-byte object identifier, bytes are stored as is
+ */
+struct ObjectId {
+  std::array<uint8_t, SIZE_OF_OBJECTID_VALUE> bytes;
+
+  /**\return 24 lowercase hex digits
+   */
+  [[nodiscard]] std::string toString() const noexcept {
+    constexpr char digits[] = "0123456789abcdef";
+
+    std::string retval(2 * bytes.size(), '\0');
+    for (size_t i = 0; i < bytes.size(); ++i) {
+      retval[2 * i]     = digits[bytes[i] >> 4];
+      retval[2 * i + 1] = digits[bytes[i] & 0x0F];
+    }
+    return retval;
+  }
+
+  bool operator==(const ObjectId &rhs) const noexcept {
+    return bytes == rhs.bytes;
+  }
+  bool operator!=(const ObjectId &rhs) const noexcept {
+    return bytes != rhs.bytes;
+  }
+};
+
+/**\brief UTC datetime as milliseconds since the Unix epoch
+ */
+struct DateTime {
+  int64_t milliseconds;
+
+  static DateTime
+  fromTimePoint(std::chrono::system_clock::time_point time) noexcept {
+    return DateTime{std::chrono::duration_cast<std::chrono::milliseconds>(
+                        time.time_since_epoch())
+                        .count()};
+  }
+
+  [[nodiscard]] std::chrono::system_clock::time_point toTimePoint() const
+      noexcept {
+    return std::chrono::system_clock::time_point{
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::milliseconds{milliseconds})};
+  }
+
+  bool operator==(const DateTime &rhs) const noexcept {
+    return milliseconds == rhs.milliseconds;
+  }
+  bool operator!=(const DateTime &rhs) const noexcept {
+    return milliseconds != rhs.milliseconds;
+  }
+};
+
+/**\brief internal MongoDB timestamp: increment in low 32 bits, seconds since
+ * the Unix epoch in high 32 bits
+ */
+struct Timestamp {
+  uint32_t increment;
+  uint32_t seconds;
+
+  bool operator==(const Timestamp &rhs) const noexcept {
+    return increment == rhs.increment && seconds == rhs.seconds;
+  }
+  bool operator!=(const Timestamp &rhs) const noexcept {
+    return !(*this == rhs);
+  }
+};
+
+/**\brief IEEE 754-2008 128-bit decimal, stored as raw bits
+ */
+struct Decimal128 {
+  uint64_t low;
+  uint64_t high;
+
+  bool operator==(const Decimal128 &rhs) const noexcept {
+    return low == rhs.low && high == rhs.high;
+  }
+  bool operator!=(const Decimal128 &rhs) const noexcept {
+    return !(*this == rhs);
+  }
+};
+
+static_assert(sizeof(ObjectId) == SIZE_OF_OBJECTID_VALUE &&
+                  sizeof(DateTime) == SIZE_OF_DATETIME_VALUE &&
+                  sizeof(Timestamp) == SIZE_OF_TIMESTAMP_VALUE &&
+                  sizeof(Decimal128) == SIZE_OF_DECIMAL128_VALUE,
+              "fixed-width values must have same size as serialized");
+
+/**\brief per-thread counters of hot-path operations for both flavours.
+ * Collected only if BSON_STATISTICS is defined, otherwise all counters are
+ * always 0
+ */
+struct Statistics {
+  uint64_t nodesVisited    = 0; // nodes compared by key during lookups
+  uint64_t lookups         = 0; // calls of get/contains/at
+  uint64_t misses          = 0; // lookups which not found the key
+  uint64_t validations     = 0; // checked documents (nested included)
+  uint64_t bytesScanned    = 0; // bytes touched by validation
+  uint64_t nodesAllocated  = 0; // minibson nodes created on heap
+  uint64_t serializedBytes = 0; // bytes written by minibson serialization
+
+  Statistics &operator+=(const Statistics &rhs) noexcept {
+    nodesVisited += rhs.nodesVisited;
+    lookups += rhs.lookups;
+    misses += rhs.misses;
+    validations += rhs.validations;
+    bytesScanned += rhs.bytesScanned;
+    nodesAllocated += rhs.nodesAllocated;
+    serializedBytes += rhs.serializedBytes;
+    return *this;
+  }
+
+  /**\return counters of current thread
+   */
+  [[nodiscard]] static Statistics snapshot() noexcept {
+#ifdef BSON_STATISTICS
+    return local();
+#else
+    return Statistics{};
+#endif
+  }
+
+  /**\brief set all counters of current thread to 0
+   */
+  static void reset() noexcept {
+#ifdef BSON_STATISTICS
+    local() = Statistics{};
+#endif
+  }
+
+#ifdef BSON_STATISTICS
+  [[nodiscard]] static Statistics &local() noexcept {
+    static thread_local Statistics counters;
+    return counters;
+  }
+#endif
+};
+
 // needed for prevent warning about enum compare
 [[nodiscard]] constexpr bool operator==(NodeType lhs, int rhs) noexcept {
   return int(lhs) == rhs;
@@ -169,6 +409,18 @@ public:
     case bson::int64_node:
       result += SIZE_OF_INT64_VALUE;
       break;
+    case bson::objectid_node:
+      result += SIZE_OF_OBJECTID_VALUE;
+      break;
+    case bson::datetime_node:
+      result += SIZE_OF_DATETIME_VALUE;
+      break;
+    case bson::timestamp_node:
+      result += SIZE_OF_TIMESTAMP_VALUE;
+      break;
+    case bson::decimal128_node:
+      result += SIZE_OF_DECIMAL128_VALUE;
+      break;
     default:
       result = 0;
       break;
@@ -198,6 +450,13 @@ public:
     return converter(offset);
   }
 
+  /**\brief not throwing version of value
+   * \return bson::Error::bad_cast if can not convert
+   */
+  template <class InputType>
+  [[nodiscard]] bson::Result<typename type_traits<InputType>::return_type>
+  try_value() const noexcept;
+
   [[nodiscard]] const void *data() const noexcept { return data_; }
 
   template <class InputType>
@@ -229,6 +488,26 @@ public:
         return false;
       }
       break;
+    case bson::objectid_node:
+      if (maxLength < MINIMAL_SIZE_OF_BSON_OBJECTID_NODE) {
+        return false;
+      }
+      break;
+    case bson::datetime_node:
+      if (maxLength < MINIMAL_SIZE_OF_BSON_DATETIME_NODE) {
+        return false;
+      }
+      break;
+    case bson::timestamp_node:
+      if (maxLength < MINIMAL_SIZE_OF_BSON_TIMESTAMP_NODE) {
+        return false;
+      }
+      break;
+    case bson::decimal128_node:
+      if (maxLength < MINIMAL_SIZE_OF_BSON_DECIMAL128_NODE) {
+        return false;
+      }
+      break;
     case bson::string_node:
       if (maxLength < MINIMAL_SIZE_OF_BSON_STRING_NODE) {
         return false;
@@ -393,6 +672,14 @@ public:
   typename type_traits<InputType>::return_type get(std::string_view key) const
       noexcept(false);
 
+  /**\brief not throwing version of get, for optional values
+   * \return bson::Error::out_of_range if value not found, or
+   * bson::Error::bad_cast if value have different type
+   */
+  template <class InputType>
+  [[nodiscard]] bson::Result<typename type_traits<InputType>::return_type>
+  try_get(std::string_view key) const noexcept;
+
 private:
   const byte *data_;
   int         bufferLength_;
@@ -409,9 +696,20 @@ public:
   template <class InputType>
   typename type_traits<InputType>::return_type at(int i) const noexcept(false);
 
+  /**\brief not throwing version of at
+   * \return bson::Error::out_of_range if no value by index `i`, or
+   * bson::Error::bad_cast if value have different type
+   */
+  template <class InputType>
+  [[nodiscard]] bson::Result<typename type_traits<InputType>::return_type>
+  try_at(int i) const noexcept;
+
   template <class T>
   T get(std::string_view) const = delete;
 
+  template <class T>
+  bson::Result<T> try_get(std::string_view) const = delete;
+
   template <class T>
   bool contains(std::string_view) const noexcept = delete;
   bool contains(std::string_view) const noexcept = delete;
@@ -426,6 +724,105 @@ public:
   }
 };
 
+/**\brief mutable view over serialized bson. Allows update values in place
+ * only if it not change length of the document (fixed width values, or
+ * strings and binaries with same length)
+ */
+class MutableDocument final : public Document {
+public:
+  MutableDocument() noexcept = default;
+
+  /**\param data pointer to writable buffer with serialized bson
+   * \param length size of the buffer
+   * \warning as Document it don't check input buffer on containing valid bson
+   */
+  MutableDocument(void *data, int length) noexcept
+      : Document{data, length} {}
+
+  /**\param path key of the value. Keys of nested documents and arrays must be
+   * separated by BSON_PATH_DELIMITER, for example: `a.b.0`
+   * \throw bson::OutOfRange if value not found, bson::BadCast if value have
+   * different type or the update change length of the value
+   */
+  template <class InputType,
+            typename = typename std::enable_if<
+                !std::is_convertible<InputType, const char *>::value>::type>
+  MutableDocument &set(std::string_view path,
+                       const InputType &val) noexcept(false);
+
+  /**\brief for c-string
+   */
+  template <class InputType,
+            typename = typename std::enable_if<
+                std::is_convertible<InputType, const char *>::value>::type>
+  MutableDocument &set(std::string_view path, InputType val) noexcept(false) {
+    return this->set<std::string_view>(path, std::string_view{val});
+  }
+
+private:
+  /**\return pointer to value of node by the path
+   * \throw bson::OutOfRange if value not found, bson::BadCast if node have
+   * different type
+   */
+  byte *find(std::string_view path, int nodeTypeCode) const noexcept(false);
+};
+
+/**\brief reusable lookup of value by the key in documents with same layout.
+ * Remembers position of the key in previous document and checks it first in
+ * next document, in case of miss scans the document from begin. Check of the
+ * cached position costs one node: type and key of the node must match, and
+ * the node must fit in the document
+ * \warning documents must have same shape: same keys and types of nodes
+ * before the key. Otherwise the cached position can point inside of value of
+ * some previous node (for example string or binary), which contains same bytes
+ * as the node
+ */
+class Lookup final {
+public:
+  explicit Lookup(std::string_view key) noexcept
+      : key_{key} {}
+
+  [[nodiscard]] const std::string &key() const noexcept { return key_; }
+
+  /**\throw bson::OutOfRange if value not found or bson::BadCast if value have
+   * different type
+   */
+  template <class InputType>
+  typename type_traits<InputType>::return_type
+  get(const Document &doc) noexcept(false);
+
+  [[nodiscard]] bool contains(const Document &doc) noexcept {
+    return this->find(doc) != nullptr;
+  }
+
+  /**\return index of the node in the document, where value was found last time
+   */
+  [[nodiscard]] int position() const noexcept { return position_; }
+
+  /**\return count of lookups, where value was found at the cached position
+   */
+  [[nodiscard]] uint64_t hits() const noexcept { return hits_; }
+
+  /**\return count of lookups, which required scan of the document
+   */
+  [[nodiscard]] uint64_t misses() const noexcept { return misses_; }
+
+  void resetStatistics() noexcept { hits_ = misses_ = 0; }
+
+private:
+  /**\return pointer to node with the key or nullptr
+   */
+  const byte *find(const Document &doc) noexcept;
+
+private:
+  std::string key_;
+  int         offset_   = 0;
+  int         position_ = 0;
+  int         type_     = bson::unknown_node;
+  uint64_t    hits_     = 0;
+  uint64_t    misses_   = 0;
+};
+
 template <>
 struct type_traits<double> {
   enum { node_type_code = bson::double_node };
@@ -536,6 +933,56 @@ struct type_traits<Binary> {
   }
 };
 
+/**\brief fixed-width values are copied from the buffer without any parsing
+ */
+template <>
+struct type_traits<bson::ObjectId> {
+  enum { node_type_code = bson::objectid_node };
+  using value_type  = bson::ObjectId;
+  using return_type = bson::ObjectId;
+  static bson::ObjectId converter(const void *ptr) {
+    bson::ObjectId retval;
+    std::memcpy(&retval, ptr, SIZE_OF_OBJECTID_VALUE);
+    return retval;
+  }
+};
+
+template <>
+struct type_traits<bson::DateTime> {
+  enum { node_type_code = bson::datetime_node };
+  using value_type  = bson::DateTime;
+  using return_type = bson::DateTime;
+  static bson::DateTime converter(const void *ptr) {
+    bson::DateTime retval;
+    std::memcpy(&retval, ptr, SIZE_OF_DATETIME_VALUE);
+    return retval;
+  }
+};
+
+template <>
+struct type_traits<bson::Timestamp> {
+  enum { node_type_code = bson::timestamp_node };
+  using value_type  = bson::Timestamp;
+  using return_type = bson::Timestamp;
+  static bson::Timestamp converter(const void *ptr) {
+    bson::Timestamp retval;
+    std::memcpy(&retval, ptr, SIZE_OF_TIMESTAMP_VALUE);
+    return retval;
+  }
+};
+
+template <>
+struct type_traits<bson::Decimal128> {
+  enum { node_type_code = bson::decimal128_node };
+  using value_type  = bson::Decimal128;
+  using return_type = bson::Decimal128;
+  static bson::Decimal128 converter(const void *ptr) {
+    bson::Decimal128 retval;
+    std::memcpy(&retval, ptr, SIZE_OF_DECIMAL128_VALUE);
+    return retval;
+  }
+};
+
 /**\brief Special Case for get some scalar (int32, int64 or double) as double
  */
 template <>
@@ -543,6 +990,72 @@ struct type_traits<bson::Scalar> {
   using value_type  = bson::Scalar;
   using return_type = double;
 };
+
+namespace detail {
+/**\brief split the path by BSON_PATH_DELIMITER and call `func(key, last)` for
+ * every key, where `last` is true for the last key. The walk is stopped if
+ * func returns false
+ * \return false if the walk was stopped
+ */
+template <class Func>
+bool forEachKey(std::string_view path, Func &&func) noexcept(false) {
+  for (;;) {
+    std::string_view key  = path.substr(0, path.find(BSON_PATH_DELIMITER));
+    bool             last = key.size() == path.size();
+    if (!func(key, last)) {
+      return false;
+    }
+    if (last) {
+      return true;
+    }
+    path.remove_prefix(key.size() + 1 /*delimiter*/);
+  }
+}
+
+/**\brief find child level of trie of paths by the key, or add new one
+ * \return the child and true if it was added
+ */
+template <class Children>
+std::pair<typename Children::mapped_type &, bool>
+childLevel(Children &children, std::string_view key) noexcept(false) {
+  using level_type = typename Children::mapped_type;
+
+  if (auto found = children.find(key); found != children.end()) {
+    return {found->second, false};
+  }
+  return {children.emplace(std::string{key}, level_type{}).first->second,
+          true};
+}
+
+/**\param path keys of nested documents and arrays separated by
+ * BSON_PATH_DELIMITER
+ * \return pointer to node by the path or nullptr
+ */
+inline const byte *findNode(Document doc, std::string_view path) noexcept {
+  const byte *retval = nullptr;
+  forEachKey(path, [&doc, &retval](std::string_view key, bool last) {
+    auto found = std::find_if(doc.begin(), doc.end(), [key](Node node) {
+      return node.key() == key;
+    });
+    if (found == doc.end()) {
+      return false;
+    }
+
+    Node node = *found;
+    if (last) {
+      retval = reinterpret_cast<const byte *>(node.data());
+    } else if (node.type() == bson::document_node) {
+      doc = node.value<Document>();
+    } else if (node.type() == bson::array_node) {
+      doc = node.value<Array>();
+    } else {
+      return false;
+    }
+    return true;
+  });
+  return retval;
+}
+} // namespace detail
 } // namespace microbson
 
 namespace std {
@@ -566,6 +1079,9 @@ inline bool Document::valid() const noexcept {
     return false;
   }
 
+  BSON_STATISTICS_ADD(validations, 1);
+  BSON_STATISTICS_ADD(bytesScanned, data_ ? MINIMAL_SIZE_OF_BSON_DOCUMENT : 0);
+
   auto end = this->end();
   for (auto i = this->begin(); i != end; ++i) {
     Node node      = *i;
@@ -591,6 +1107,26 @@ inline bool Document::valid() const noexcept {
         return false;
       }
       break;
+    case bson::objectid_node:
+      if (!node.valid<bson::ObjectId>(maxLength)) {
+        return false;
+      }
+      break;
+    case bson::datetime_node:
+      if (!node.valid<bson::DateTime>(maxLength)) {
+        return false;
+      }
+      break;
+    case bson::timestamp_node:
+      if (!node.valid<bson::Timestamp>(maxLength)) {
+        return false;
+      }
+      break;
+    case bson::decimal128_node:
+      if (!node.valid<bson::Decimal128>(maxLength)) {
+        return false;
+      }
+      break;
     case bson::double_node:
       if (!node.valid<double>(maxLength)) {
         return false;
@@ -619,6 +1155,14 @@ inline bool Document::valid() const noexcept {
     default:
       return false;
     }
+
+    // nested documents count their own bytes, so here only header of the node
+    BSON_STATISTICS_ADD(bytesScanned,
+                        node.type() == bson::array_node ||
+                                node.type() == bson::document_node
+                            ? SIZE_OF_BSON_TYPE + node.key().size() +
+                                  SIZE_OF_ZERO_BYTE
+                            : node.length());
   }
 
   return true;
@@ -627,11 +1171,13 @@ inline bool Document::valid() const noexcept {
 template <class InputType>
 inline bool Document::contains(std::string_view key) const noexcept {
   constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
+  BSON_STATISTICS_ADD(lookups, 1);
 
   if (auto found = std::find_if(
           this->begin(),
           this->end(),
           [key](Node node) {
+            BSON_STATISTICS_ADD(nodesVisited, 1);
             if (node.key() ==
                 key) { // we not need check here, because in bson can not
                        // contains two or more values with same key
@@ -644,15 +1190,19 @@ inline bool Document::contains(std::string_view key) const noexcept {
     if ((*found).type() == nodeTypeCode) {
       return true; // only with same key and type
     }
+  } else {
+    BSON_STATISTICS_ADD(misses, 1);
   }
 
   return false;
 }
 
 inline bool Document::contains(std::string_view key) const noexcept {
+  BSON_STATISTICS_ADD(lookups, 1);
   if (auto found = std::find_if(this->begin(),
                                 this->end(),
                                 [key](Node node) {
+                                  BSON_STATISTICS_ADD(nodesVisited, 1);
                                   if (node.key() == key) {
                                     return true;
                                   }
@@ -663,15 +1213,18 @@ inline bool Document::contains(std::string_view key) const noexcept {
     return true;
   }
 
+  BSON_STATISTICS_ADD(misses, 1);
   return false;
 }
 
 template <class InputType>
 inline typename type_traits<InputType>::return_type
 Document::get(std::string_view key) const {
+  BSON_STATISTICS_ADD(lookups, 1);
   if (auto found = std::find_if(this->begin(),
                                 this->end(),
                                 [key](Node node) {
+                                  BSON_STATISTICS_ADD(nodesVisited, 1);
                                   if (node.key() == key) {
                                     return true;
                                   }
@@ -681,22 +1234,84 @@ Document::get(std::string_view key) const {
       found != this->end()) {
     return (*found).template value<InputType>();
   } else {
+    BSON_STATISTICS_ADD(misses, 1);
     throw bson::OutOfRange{"no value by key: " + std::string{key}};
   }
 }
 
 template <class InputType>
 inline typename type_traits<InputType>::return_type Array::at(int i) const {
-  auto iter = this->begin();
-  for (int counter = 0; iter != this->end() && counter < i; ++iter, ++counter)
+  BSON_STATISTICS_ADD(lookups, 1);
+  auto iter    = this->begin();
+  int  counter = 0;
+  for (; iter != this->end() && counter < i; ++iter, ++counter)
     ;
+  BSON_STATISTICS_ADD(nodesVisited, counter);
   if (iter != this->end()) {
     return (*iter).template value<InputType>();
   } else {
+    BSON_STATISTICS_ADD(misses, 1);
     throw bson::OutOfRange{"no value by index: " + std::to_string(i)};
   }
 }
 
+template <class InputType>
+inline bson::Result<typename type_traits<InputType>::return_type>
+Document::try_get(std::string_view key) const noexcept {
+  BSON_STATISTICS_ADD(lookups, 1);
+  for (Node node : *this) {
+    BSON_STATISTICS_ADD(nodesVisited, 1);
+    if (node.key() == key) {
+      return node.template try_value<InputType>();
+    }
+  }
+
+  BSON_STATISTICS_ADD(misses, 1);
+  return bson::Error::out_of_range;
+}
+
+template <class InputType>
+inline bson::Result<typename type_traits<InputType>::return_type>
+Array::try_at(int i) const noexcept {
+  BSON_STATISTICS_ADD(lookups, 1);
+  auto iter    = this->begin();
+  int  counter = 0;
+  for (; iter != this->end() && counter < i; ++iter, ++counter)
+    ;
+  BSON_STATISTICS_ADD(nodesVisited, counter);
+  if (iter != this->end() && i >= 0) {
+    return (*iter).template try_value<InputType>();
+  }
+
+  BSON_STATISTICS_ADD(misses, 1);
+  return bson::Error::out_of_range;
+}
+
+template <class InputType>
+inline bson::Result<typename type_traits<InputType>::return_type>
+Node::try_value() const noexcept {
+  const byte *offset =
+      data_ + SIZE_OF_BSON_TYPE + this->key().size() + SIZE_OF_ZERO_BYTE;
+
+  if constexpr (std::is_same<InputType, bson::Scalar>::value) {
+    switch (this->type()) {
+    case bson::double_node:
+      return *reinterpret_cast<const double *>(offset);
+    case bson::int32_node:
+      return double(*reinterpret_cast<const int32_t *>(offset));
+    case bson::int64_node:
+      return double(*reinterpret_cast<const int64_t *>(offset));
+    default:
+      return bson::Error::bad_cast;
+    }
+  } else {
+    if (this->type() != type_traits<InputType>::node_type_code) {
+      return bson::Error::bad_cast;
+    }
+    return type_traits<InputType>::converter(offset);
+  }
+}
+
 /**\brief special case if we need get some number and we don't care about type
  * of it
  */
@@ -721,10 +1336,12 @@ Node::value<bson::Scalar>() const noexcept(false) {
 template <>
 inline bool Document::contains<bson::Scalar>(std::string_view key) const
     noexcept {
+  BSON_STATISTICS_ADD(lookups, 1);
   if (auto found = std::find_if(
           this->begin(),
           this->end(),
           [key](Node node) {
+            BSON_STATISTICS_ADD(nodesVisited, 1);
             if (node.key() ==
                 key) { // we not need check here, because in bson can not
                        // contains two or more values with same key
@@ -739,8 +1356,127 @@ inline bool Document::contains<bson::Scalar>(std::string_view key) const
                                      type == bson::int64_node) {
       return true;
     }
+  } else {
+    BSON_STATISTICS_ADD(misses, 1);
   }
 
   return false;
 }
+
+inline byte *MutableDocument::find(std::string_view path,
+                                   int              nodeTypeCode) const {
+  const byte *found = detail::findNode(*this, path);
+  if (found == nullptr) {
+    throw bson::OutOfRange{"no value by path: " + std::string{path}};
+  }
+
+  Node node{found};
+  if (node.type() != nodeTypeCode) {
+    throw bson::BadCast{};
+  }
+
+  // buffer was given as mutable in constructor, so we can cast it back
+  return const_cast<byte *>(found) + SIZE_OF_BSON_TYPE + node.key().size() +
+         SIZE_OF_ZERO_BYTE;
+}
+
+template <class InputType, typename>
+inline MutableDocument &MutableDocument::set(std::string_view path,
+                                             const InputType &val) {
+  using value_type           = typename type_traits<InputType>::value_type;
+  constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
+
+  byte *offset = this->find(path, nodeTypeCode);
+
+  if constexpr (std::is_same<value_type, std::string_view>::value) {
+    std::string_view str{val};
+    if (*reinterpret_cast<const int32_t *>(offset) !=
+        int32_t(str.size() + SIZE_OF_ZERO_BYTE)) {
+      throw bson::BadCast{};
+    }
+    std::memcpy(offset + SIZE_OF_BSON_SIZE, str.data(), str.size());
+  } else if constexpr (std::is_same<value_type, Binary>::value) {
+    Binary bin{val};
+    if (*reinterpret_cast<const int32_t *>(offset) != bin.second) {
+      throw bson::BadCast{};
+    }
+    std::memcpy(offset + SIZE_OF_BSON_SIZE + SIZE_OF_BSON_SUBTYPE,
+                bin.first,
+                bin.second);
+  } else if constexpr (std::is_same<value_type, bool>::value) {
+    *offset = val ? 1 : 0;
+  } else {
+    static_assert(std::is_arithmetic<value_type>::value ||
+                      std::is_same<value_type, bson::ObjectId>::value ||
+                      std::is_same<value_type, bson::DateTime>::value ||
+                      std::is_same<value_type, bson::Timestamp>::value ||
+                      std::is_same<value_type, bson::Decimal128>::value,
+                  "only fixed width values can be updated in place");
+    value_type value = val;
+    std::memcpy(offset, &value, sizeof(value));
+  }
+
+  return *this;
+}
+
+inline const byte *Lookup::find(const Document &doc) noexcept {
+  const byte *data = reinterpret_cast<const byte *>(doc.data());
+
+  // check the cached position: type, key and terminating zero of the key, then
+  // the node must end before terminating zero of the document
+  int header    = SIZE_OF_BSON_TYPE + key_.size() + SIZE_OF_ZERO_BYTE;
+  int available = doc.length() - SIZE_OF_ZERO_BYTE - offset_;
+  if (offset_ && header <= available && data[offset_] == type_ &&
+      std::memcmp(data + offset_ + SIZE_OF_BSON_TYPE,
+                  key_.c_str(),
+                  key_.size() + SIZE_OF_ZERO_BYTE) == 0) {
+    // size of value is checked before computing length of the node, because
+    // the length can overflow
+    int32_t size = 0;
+    if (type_ == bson::document_node || type_ == bson::array_node ||
+        type_ == bson::string_node || type_ == bson::binary_node) {
+      size = -1;
+      if (header + SIZE_OF_BSON_SIZE <= available) {
+        std::memcpy(&size, data + offset_ + header, SIZE_OF_BSON_SIZE);
+      }
+    }
+
+    int length = size >= 0 && size <= available ? Node{data + offset_}.length()
+                                                : 0;
+    if (length >= header && length <= available) {
+      ++hits_;
+      BSON_STATISTICS_ADD(lookups, 1);
+      BSON_STATISTICS_ADD(nodesVisited, 1);
+      return data + offset_;
+    }
+  }
+
+  ++misses_;
+  BSON_STATISTICS_ADD(lookups, 1);
+
+  int position = 0;
+  for (auto i = doc.begin(), end = doc.end(); i != end; ++i, ++position) {
+    BSON_STATISTICS_ADD(nodesVisited, 1);
+    if (Node node = *i; node.key() == key_) {
+      const byte *found = reinterpret_cast<const byte *>(node.data());
+      offset_           = found - data;
+      position_         = position;
+      type_             = node.type();
+      return found;
+    }
+  }
+
+  BSON_STATISTICS_ADD(misses, 1);
+  return nullptr;
+}
+
+template <class InputType>
+inline typename type_traits<InputType>::return_type
+Lookup::get(const Document &doc) {
+  if (const byte *found = this->find(doc)) {
+    return Node{found}.value<InputType>();
+  }
+
+  throw bson::OutOfRange{"no value by key: " + key_};
+}
 } // namespace microbson
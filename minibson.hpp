@@ -113,6 +113,34 @@ struct type_traits<Binary> {
   using return_type = Binary;
 };
 
+template <>
+struct type_traits<bson::ObjectId> {
+  enum { node_type_code = bson::objectid_node };
+  using value_type  = bson::ObjectId;
+  using return_type = bson::ObjectId;
+};
+
+template <>
+struct type_traits<bson::DateTime> {
+  enum { node_type_code = bson::datetime_node };
+  using value_type  = bson::DateTime;
+  using return_type = bson::DateTime;
+};
+
+template <>
+struct type_traits<bson::Timestamp> {
+  enum { node_type_code = bson::timestamp_node };
+  using value_type  = bson::Timestamp;
+  using return_type = bson::Timestamp;
+};
+
+template <>
+struct type_traits<bson::Decimal128> {
+  enum { node_type_code = bson::decimal128_node };
+  using value_type  = bson::Decimal128;
+  using return_type = bson::Decimal128;
+};
+
 /**\brief Special Case for get some scalar value as double
  */
 template <>
@@ -136,6 +164,10 @@ public:
   /**\return count of bytes, needed for serialization
    */
   [[nodiscard]] virtual int getSerializedSize() const noexcept = 0;
+
+  /**\return true for not expanded nested document or array, @see Lazy
+   */
+  [[nodiscard]] virtual bool lazy() const noexcept { return false; }
 };
 
 using UNodeValue = std::unique_ptr<NodeValue>;
@@ -152,7 +184,11 @@ public:
         std::is_same<T, double>::value || std::is_same<T, std::string>::value ||
         std::is_same<T, Document>::value || std::is_same<T, Array>::value ||
         std::is_same<T, Binary>::value || std::is_same<T, bool>::value ||
-        std::is_same<T, int32_t>::value || std::is_same<T, int64_t>::value);
+        std::is_same<T, int32_t>::value || std::is_same<T, int64_t>::value ||
+        std::is_same<T, bson::ObjectId>::value ||
+        std::is_same<T, bson::DateTime>::value ||
+        std::is_same<T, bson::Timestamp>::value ||
+        std::is_same<T, bson::Decimal128>::value);
   }
   explicit NodeValueT(T &&val) noexcept
       : val_{std::move(val)} {
@@ -161,7 +197,11 @@ public:
         std::is_same<T, double>::value || std::is_same<T, std::string>::value ||
         std::is_same<T, Document>::value || std::is_same<T, Array>::value ||
         std::is_same<T, Binary>::value || std::is_same<T, bool>::value ||
-        std::is_same<T, int32_t>::value || std::is_same<T, int64_t>::value);
+        std::is_same<T, int32_t>::value || std::is_same<T, int64_t>::value ||
+        std::is_same<T, bson::ObjectId>::value ||
+        std::is_same<T, bson::DateTime>::value ||
+        std::is_same<T, bson::Timestamp>::value ||
+        std::is_same<T, bson::Decimal128>::value);
   }
 
   [[nodiscard]] inline bson::NodeType type() const noexcept override {
@@ -238,6 +278,7 @@ public:
             typename = typename std::enable_if<
                 std::is_rvalue_reference<InputType &&>::value>::type>
   [[nodiscard]] static UNodeValue create(InputType &&val) noexcept {
+    BSON_STATISTICS_ADD(nodesAllocated, 1);
     using value_type  = typename type_traits<InputType>::value_type;
     using return_type = typename type_traits<InputType>::return_type;
 
@@ -258,6 +299,7 @@ public:
 
   template <class InputType>
   [[nodiscard]] static UNodeValue create(const InputType &val) noexcept {
+    BSON_STATISTICS_ADD(nodesAllocated, 1);
     using value_type  = typename type_traits<InputType>::value_type;
     using return_type = typename type_traits<InputType>::return_type;
 
@@ -275,6 +317,7 @@ public:
   }
 
   [[nodiscard]] static UNodeValue create() noexcept {
+    BSON_STATISTICS_ADD(nodesAllocated, 1);
     return std::make_unique<NodeValueT<void>>();
   }
 };
@@ -321,15 +364,180 @@ public:
   std::vector<byte> buf_;
 };
 
+/**\brief key argument for set values in document. Keeps view of the key, or
+ * the key string itself if it was given as rvalue, so owned strings are moved
+ * in the document without copy
+ */
+class Key final {
+public:
+  Key(const char *key) noexcept
+      : view_{key}
+      , owned_{false} {}
+  Key(std::string_view key) noexcept
+      : view_{key}
+      , owned_{false} {}
+  Key(const std::string &key) noexcept
+      : view_{key}
+      , owned_{false} {}
+  Key(std::string &&key) noexcept
+      : string_{std::move(key)}
+      , owned_{true} {}
+
+  [[nodiscard]] std::string_view view() const noexcept {
+    return owned_ ? std::string_view{string_} : view_;
+  }
+
+  /**\return owned string, or copy of the viewed key
+   */
+  [[nodiscard]] std::string release() noexcept {
+    return owned_ ? std::move(string_) : std::string{view_};
+  }
+
+private:
+  std::string_view view_;
+  std::string      string_;
+  bool             owned_;
+};
+
+/**\brief tag for lazy deserialization: nested documents and arrays keep view
+ * of source bytes and are expanded (by one level) only at first access to them
+ * by `get`, `at` or iterators. Not touched nested values are serialized by copy
+ * of source bytes.
+ * \warning source buffer must live while the document contains not expanded
+ * values. Expansion changes the document, so even const access to lazy
+ * document is not thread-safe
+ */
+struct Lazy {};
+inline constexpr Lazy lazy{};
+
+/**\brief not expanded nested document or array, @see Lazy
+ */
+class LazyValue final : public NodeValue {
+public:
+  /**\param view valid serialized document or array
+   */
+  LazyValue(bson::NodeType type, microbson::Document view) noexcept
+      : type_{type}
+      , view_{view} {}
+
+  [[nodiscard]] bson::NodeType type() const noexcept override { return type_; }
+
+  [[nodiscard]] int getSerializedSize() const noexcept override {
+    return view_.length();
+  }
+
+  int serialize(void *buf, int length) const override {
+    int size = view_.length();
+    if (length < size) {
+      throw bson::InvalidArgument{MEMORY_ERROR};
+    }
+
+    std::memcpy(buf, view_.data(), size);
+    BSON_STATISTICS_ADD(serializedBytes, size);
+    return size;
+  }
+
+  [[nodiscard]] bool lazy() const noexcept override { return true; }
+
+  /**\param lazyNested if true, then nested values of result are also lazy
+   * \return Document or Array with content of the view
+   */
+  [[nodiscard]] UNodeValue expand(bool lazyNested = true) const
+      noexcept(false);
+
+private:
+  bson::NodeType      type_;
+  microbson::Document view_;
+};
+
+/**\brief replace lazy node by expanded value, if the node has requested type
+ * (document or array). Nodes are owned by non-const containers, so the
+ * replacement is not visible for users of the document
+ * \return the node
+ */
+template <int nodeTypeCode>
+const UNodeValue &materialize(const UNodeValue &node) noexcept(false);
+
+/**\brief type of value returned by `try_get` and `try_at`: reference for
+ * values, which are kept in the tree as is, otherwise converted value
+ */
+template <class InputType>
+using result_type = typename std::conditional<
+    std::is_same<typename type_traits<InputType>::return_type,
+                 typename type_traits<InputType>::value_type>::value &&
+        !std::is_fundamental<InputType>::value,
+    const typename type_traits<InputType>::return_type &,
+    typename type_traits<InputType>::return_type>::type;
+
+/**\return value of the node, or bson::Error::bad_cast if the node has other
+ * type. Type is checked before expansion of lazy value, so failure not
+ * allocates memory. Expansion of lazy value of requested type allocates nodes
+ * (source bytes are already validated), and as in UNodeValueFactory lack of
+ * memory is not reported
+ */
+template <class InputType>
+bson::Result<result_type<InputType>> tryValue(const UNodeValue &node) noexcept {
+  using value_type  = typename type_traits<InputType>::value_type;
+  using return_type = typename type_traits<InputType>::return_type;
+
+  if constexpr (std::is_same<InputType, bson::Scalar>::value) {
+    switch (node->type()) {
+    case bson::double_node:
+      return reinterpret_cast<const NodeValueT<double> *>(node.get())->value();
+    case bson::int32_node:
+      return double(
+          reinterpret_cast<const NodeValueT<int32_t> *>(node.get())->value());
+    case bson::int64_node:
+      return double(
+          reinterpret_cast<const NodeValueT<int64_t> *>(node.get())->value());
+    default:
+      return bson::Error::bad_cast;
+    }
+  } else {
+    constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
+    if (node->type() != nodeTypeCode) {
+      return bson::Error::bad_cast;
+    }
+
+    const value_type &value =
+        reinterpret_cast<const NodeValueT<value_type> *>(
+            materialize<nodeTypeCode>(node).get())
+            ->value();
+    if constexpr (std::is_reference<result_type<InputType>>::value ||
+                  std::is_convertible<value_type, return_type>::value) {
+      return value;
+    } else if constexpr (std::is_nothrow_constructible<return_type,
+                                                       value_type>::value) {
+      return return_type{value};
+    } else {
+      constexpr return_type (*converter)(const value_type &) =
+          type_traits<InputType>::converter;
+
+      return converter(value);
+    }
+  }
+}
+
 class Document final {
-  using container_type = std::map<std::string, UNodeValue>;
+  friend class Array;
+  friend class LazyValue;
+
+  /**\brief transparent comparator allows lookups by std::string_view without
+   * creating temporary strings
+   */
+  using container_type = std::map<std::string, UNodeValue, std::less<>>;
   using node_type      = container_type::node_type;
 
 public:
   /**\brief extract node from document without relocation. After the operation
    * the document not contains the node
    */
-  node_type extract(const std::string &key) { return doc_.extract(key); }
+  node_type extract(std::string_view key) {
+    if (auto found = doc_.find(key); found != doc_.end()) {
+      return doc_.extract(found);
+    }
+    return node_type{};
+  }
   /**\brief move some document node in the document
    * \see extract
    */
@@ -341,12 +549,32 @@ public:
    * \param length size of buffer, need for validate the document
    * \throw bson::InvalidArgument if can not deserialize bson
    */
-  Document(const void *buffer, int length) noexcept(false) {
-    microbson::Document doc{buffer, length};
-    this->deserialize(doc);
-  }
+  Document(const void *buffer, int length) noexcept(false)
+      : Document{microbson::Document{buffer, length}} {}
   explicit Document(microbson::Document doc) noexcept(false) {
-    this->deserialize(doc);
+    if (this->deserialize(doc) != bson::Error::none) {
+      throw bson::InvalidArgument{"invalid bson"};
+    }
+  }
+  /**\brief deserialize only first level of the document, @see Lazy
+   * \throw bson::InvalidArgument if can not deserialize bson
+   */
+  Document(const void *buffer, int length, Lazy) noexcept(false)
+      : Document{microbson::Document{buffer, length}, lazy} {}
+  Document(microbson::Document doc, Lazy) noexcept(false) {
+    if (this->deserialize(doc, true) != bson::Error::none) {
+      throw bson::InvalidArgument{"invalid bson"};
+    }
+  }
+  /**\brief not throwing version of constructor
+   * \param error bson::Error::invalid_argument if can not deserialize bson, in
+   * this case the document is empty
+   */
+  Document(const void *buffer, int length, bson::Error &error) noexcept
+      : Document{microbson::Document{buffer, length}, error} {}
+  Document(microbson::Document doc, bson::Error &error) noexcept
+      : doc_{} {
+    error = this->deserialize(doc);
   }
 
   Document(const Document &)        = delete;
@@ -359,6 +587,11 @@ public:
 
   [[nodiscard]] bool empty() const noexcept { return doc_.empty(); }
 
+  /**\brief expand all lazy values of the tree, after that the tree not
+   * depends on source buffer and can be read from several threads
+   */
+  void expand() noexcept(false);
+
   [[nodiscard]] int getSerializedSize() const noexcept {
     int count = SIZE_OF_BSON_SIZE;
     for (auto &[key, val] : doc_) {
@@ -390,12 +623,14 @@ public:
                        typename type_traits<InputType>::value_type>::value &&
           !std::is_fundamental<InputType>::value>::type>
   const typename type_traits<InputType>::return_type &
-  get(const std::string &key) const noexcept(false) {
+  get(std::string_view key) const noexcept(false) {
     using value_type           = typename type_traits<InputType>::value_type;
     constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
 
+    BSON_STATISTICS_ADD(lookups, 1);
+
     if (auto found = doc_.find(key); found != doc_.end()) {
-      if (found->second->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(found->second)->type() == nodeTypeCode) {
         return reinterpret_cast<const NodeValueT<value_type> *>(
                    found->second.get())
             ->value();
@@ -403,6 +638,7 @@ public:
         throw bson::BadCast{};
       }
     } else {
+      BSON_STATISTICS_ADD(misses, 1);
       throw bson::OutOfRange{"hame not value by key: " + std::string{key}};
     }
   }
@@ -412,18 +648,21 @@ public:
                 typename type_traits<InputType>::return_type,
                 typename type_traits<InputType>::value_type>::value>::type>
   typename type_traits<InputType>::return_type &
-  get(const std::string &key) noexcept(false) {
+  get(std::string_view key) noexcept(false) {
     using value_type           = typename type_traits<InputType>::value_type;
     constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
 
+    BSON_STATISTICS_ADD(lookups, 1);
+
     if (auto found = doc_.find(key); found != doc_.end()) {
-      if (found->second->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(found->second)->type() == nodeTypeCode) {
         return reinterpret_cast<NodeValueT<value_type> *>(found->second.get())
             ->value();
       } else {
         throw bson::BadCast{};
       }
     } else {
+      BSON_STATISTICS_ADD(misses, 1);
       throw bson::OutOfRange{"hame not value by key: " + std::string{key}};
     }
   }
@@ -434,14 +673,16 @@ public:
           !std::is_same<typename type_traits<InputType>::return_type,
                         typename type_traits<InputType>::value_type>::value ||
           std::is_fundamental<InputType>::value>::type>
-  typename type_traits<InputType>::return_type get(const std::string &key) const
+  typename type_traits<InputType>::return_type get(std::string_view key) const
       noexcept(false) {
     using value_type           = typename type_traits<InputType>::value_type;
     using return_type          = typename type_traits<InputType>::return_type;
     constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
 
+    BSON_STATISTICS_ADD(lookups, 1);
+
     if (auto found = doc_.find(key); found != doc_.end()) {
-      if (found->second->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(found->second)->type() == nodeTypeCode) {
         if constexpr (std::is_convertible<value_type, return_type>::value) {
           return reinterpret_cast<const NodeValueT<value_type> *>(
                      found->second.get())
@@ -463,15 +704,33 @@ public:
         throw bson::BadCast{};
       }
     } else {
+      BSON_STATISTICS_ADD(misses, 1);
       throw bson::OutOfRange{"hame not value by key: " + std::string{key}};
     }
   }
 
+  /**\brief not throwing version of get, for optional values
+   * \return bson::Error::out_of_range if not have the value, or
+   * bson::Error::bad_cast if have not same type
+   */
+  template <class InputType>
+  [[nodiscard]] bson::Result<result_type<InputType>>
+  try_get(std::string_view key) const noexcept {
+    BSON_STATISTICS_ADD(lookups, 1);
+
+    if (auto found = doc_.find(key); found != doc_.end()) {
+      return tryValue<InputType>(found->second);
+    }
+
+    BSON_STATISTICS_ADD(misses, 1);
+    return bson::Error::out_of_range;
+  }
+
   template <class InsertType,
             typename = typename std::enable_if<
                 !std::is_convertible<InsertType, const char *>::value>::type>
-  Document &set(std::string_view key, const InsertType &val) noexcept {
-    doc_.insert_or_assign(std::string{key}, UNodeValueFactory::create(val));
+  Document &set(Key key, const InsertType &val) noexcept {
+    this->assign(key, UNodeValueFactory::create(val));
     return *this;
   }
 
@@ -479,9 +738,8 @@ public:
             typename = typename std::enable_if<
                 std::is_rvalue_reference<InsertType &&>::value &&
                 !std::is_convertible<InsertType, const char *>::value>::type>
-  Document &set(std::string_view key, InsertType &&val) noexcept {
-    doc_.insert_or_assign(std::string{key},
-                          UNodeValueFactory::create(std::move(val)));
+  Document &set(Key key, InsertType &&val) noexcept {
+    this->assign(key, UNodeValueFactory::create(std::move(val)));
     return *this;
   }
 
@@ -490,58 +748,62 @@ public:
   template <class InsertType,
             typename = typename std::enable_if<
                 std::is_convertible<InsertType, const char *>::value>::type>
-  Document &set(std::string_view key, InsertType val) noexcept {
-    doc_.insert_or_assign(
-        std::string{key},
-        UNodeValueFactory::create(reinterpret_cast<const char *>(val)));
+  Document &set(Key key, InsertType val) noexcept {
+    this->assign(
+        key, UNodeValueFactory::create(reinterpret_cast<const char *>(val)));
     return *this;
   }
 
-  Document &set(std::string_view key) noexcept {
-    doc_.insert_or_assign(std::string{key}, UNodeValueFactory::create());
+  Document &set(Key key) noexcept {
+    this->assign(key, UNodeValueFactory::create());
     return *this;
   }
 
   template <class InputType, class InsertType>
-  Document &set(std::string key, const InsertType &val) noexcept {
+  Document &set(Key key, const InsertType &val) noexcept {
     using value_type  = typename type_traits<InputType>::value_type;
     using return_type = typename type_traits<InputType>::return_type;
 
     if constexpr (std::is_nothrow_constructible<value_type,
                                                 InsertType>::value) {
-      doc_.insert_or_assign(std::move(key),
-                            UNodeValueFactory::create(value_type(val)));
+      this->assign(key, UNodeValueFactory::create(value_type(val)));
     } else {
       constexpr value_type (*back_converter)(const return_type &) =
           type_traits<InputType>::back_converter;
 
-      doc_.insert_or_assign(std::move(key),
-                            UNodeValueFactory::create(back_converter(val)));
+      this->assign(key, UNodeValueFactory::create(back_converter(val)));
     }
 
     return *this;
   }
 
-  [[nodiscard]] bool contains(const std::string &key) const noexcept {
+  [[nodiscard]] bool contains(std::string_view key) const noexcept {
+    BSON_STATISTICS_ADD(lookups, 1);
     if (auto found = doc_.find(key); found != doc_.end()) {
       return true;
     }
+    BSON_STATISTICS_ADD(misses, 1);
     return false;
   }
 
   template <typename Type>
-  [[nodiscard]] bool contains(const std::string &key) const noexcept {
+  [[nodiscard]] bool contains(std::string_view key) const noexcept {
     constexpr int nodeTypeCode = type_traits<Type>::node_type_code;
 
+    BSON_STATISTICS_ADD(lookups, 1);
+
     if (auto found = doc_.find(key);
         found != doc_.end() && found->second->type() == nodeTypeCode) {
       return true;
     }
+    BSON_STATISTICS_ADD(misses, 1);
     return false;
   }
 
-  Document &erase(const std::string &key) noexcept(false) {
-    doc_.erase(key);
+  Document &erase(std::string_view key) noexcept(false) {
+    if (auto found = doc_.find(key); found != doc_.end()) {
+      doc_.erase(found);
+    }
     return *this;
   }
 
@@ -597,7 +859,7 @@ public:
       using value_type           = typename type_traits<InputType>::value_type;
       constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
 
-      if (imp_->second->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(imp_->second)->type() == nodeTypeCode) {
         return reinterpret_cast<NodeValueT<value_type> *>(imp_->second.get())
             ->value();
       }
@@ -616,7 +878,7 @@ public:
       using return_type          = typename type_traits<InputType>::return_type;
       constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
 
-      if (imp_->second->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(imp_->second)->type() == nodeTypeCode) {
         if constexpr (std::is_convertible<value_type, return_type>::value) {
           return reinterpret_cast<const NodeValueT<value_type> *>(
                      imp_->second.get())
@@ -701,7 +963,7 @@ public:
       using value_type           = typename type_traits<InputType>::value_type;
       constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
 
-      if (imp_->second->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(imp_->second)->type() == nodeTypeCode) {
         return reinterpret_cast<const NodeValueT<value_type> *>(
                    imp_->second.get())
             ->value();
@@ -721,7 +983,7 @@ public:
       using return_type          = typename type_traits<InputType>::return_type;
       constexpr int nodeTypeCode = type_traits<InputType>::node_type_code;
 
-      if (imp_->second->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(imp_->second)->type() == nodeTypeCode) {
         if constexpr (std::is_convertible<value_type, return_type>::value) {
           return reinterpret_cast<const NodeValueT<value_type> *>(
                      imp_->second.get())
@@ -764,23 +1026,74 @@ public:
   }
 
 private:
-  void deserialize(microbson::Document doc) noexcept(false);
+  /**\param validated true if the document is already validated, for example
+   * as nested value of validated document, in this case validation is skipped
+   * \return bson::Error::invalid_argument if the document is not valid
+   */
+  bson::Error deserialize(microbson::Document doc,
+                          bool                lazyNested = false,
+                          bool                validated  = false) noexcept;
+
+  /**\param doc valid document, @see microbson::Document::valid
+   */
+  static Document fromValidated(microbson::Document doc,
+                                bool lazyNested) noexcept(false) {
+    Document retval;
+    retval.deserialize(doc, lazyNested, true);
+    return retval;
+  }
+
+  /**\brief replace value by the key or insert new node. New string for the key
+   * is created only if the document not contains the key
+   */
+  void assign(Key &key, UNodeValue &&val) noexcept {
+    std::string_view view  = key.view();
+    auto             found = doc_.lower_bound(view);
+    if (found != doc_.end() && found->first == view) {
+      found->second = std::move(val);
+    } else {
+      doc_.emplace_hint(found, key.release(), std::move(val));
+    }
+  }
 
 private:
-  container_type doc_;
+  // mutable for expand lazy values by const access, @see materialize
+  mutable container_type doc_;
 };
 
 class Array final {
+  friend class Document;
+  friend class LazyValue;
+
   using container_type = std::vector<UNodeValue>;
 
 public:
   Array() noexcept = default;
-  Array(const void *buffer, int length) noexcept(false) {
-    microbson::Array arr{buffer, length};
-    this->deserialize(arr);
-  }
+  Array(const void *buffer, int length) noexcept(false)
+      : Array{microbson::Array{buffer, length}} {}
   explicit Array(microbson::Array arr) noexcept(false) {
-    this->deserialize(arr);
+    if (this->deserialize(arr) != bson::Error::none) {
+      throw bson::InvalidArgument{"invalid bson"};
+    }
+  }
+  /**\brief deserialize only first level of the array, @see Lazy
+   */
+  Array(const void *buffer, int length, Lazy) noexcept(false)
+      : Array{microbson::Array{buffer, length}, lazy} {}
+  Array(microbson::Array arr, Lazy) noexcept(false) {
+    if (this->deserialize(arr, true) != bson::Error::none) {
+      throw bson::InvalidArgument{"invalid bson"};
+    }
+  }
+  /**\brief not throwing version of constructor
+   * \param error bson::Error::invalid_argument if can not deserialize bson, in
+   * this case the array is empty
+   */
+  Array(const void *buffer, int length, bson::Error &error) noexcept
+      : Array{microbson::Array{buffer, length}, error} {}
+  Array(microbson::Array arr, bson::Error &error) noexcept
+      : arr_{} {
+    error = this->deserialize(arr);
   }
 
   Array(const Array &)     = delete;
@@ -793,6 +1106,11 @@ public:
 
   [[nodiscard]] bool empty() const noexcept { return arr_.empty(); }
 
+  /**\brief expand all lazy values of the tree, after that the tree not
+   * depends on source buffer and can be read from several threads
+   */
+  void expand() noexcept(false);
+
   [[nodiscard]] int getSerializedSize() const noexcept {
     int count = SIZE_OF_BSON_SIZE;
     for (size_t i = 0; i < arr_.size(); ++i) {
@@ -847,7 +1165,7 @@ public:
       throw bson::OutOfRange{"have not value by index: " + std::to_string(i)};
     }
 
-    if (arr_[i]->type() != nodeTypeCode) {
+    if (materialize<nodeTypeCode>(arr_[i])->type() != nodeTypeCode) {
       throw bson::BadCast{};
     }
 
@@ -867,7 +1185,7 @@ public:
       throw bson::OutOfRange{"have not value by index: " + std::to_string(i)};
     }
 
-    if (arr_[i]->type() != nodeTypeCode) {
+    if (materialize<nodeTypeCode>(arr_[i])->type() != nodeTypeCode) {
       throw bson::BadCast{};
     }
 
@@ -889,7 +1207,7 @@ public:
       throw bson::OutOfRange{"have not value by index: " + std::to_string(i)};
     }
 
-    if (arr_[i]->type() != nodeTypeCode) {
+    if (materialize<nodeTypeCode>(arr_[i])->type() != nodeTypeCode) {
       throw bson::BadCast{};
     }
 
@@ -911,6 +1229,20 @@ public:
     }
   }
 
+  /**\brief not throwing version of at
+   * \return bson::Error::out_of_range if not have value by the index, or
+   * bson::Error::bad_cast if have not same type
+   */
+  template <class InputType>
+  [[nodiscard]] bson::Result<result_type<InputType>>
+  try_at(int i) const noexcept {
+    if (i < 0 || size_t(i) >= arr_.size()) {
+      return bson::Error::out_of_range;
+    }
+
+    return tryValue<InputType>(arr_[i]);
+  }
+
   template <class InsertType,
             typename = typename std::enable_if<
                 std::is_rvalue_reference<InsertType &&>::value &&
@@ -1027,7 +1359,7 @@ public:
 
       imp_iter_type iter = imp_ + num_;
 
-      if ((*iter)->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(*iter)->type() == nodeTypeCode) {
         return reinterpret_cast<NodeValueT<value_type> *>((*iter).get())
             ->value();
       }
@@ -1048,7 +1380,7 @@ public:
 
       imp_iter_type iter = imp_ + num_;
 
-      if ((*iter)->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(*iter)->type() == nodeTypeCode) {
         if constexpr (std::is_convertible<value_type, return_type>::value) {
           return reinterpret_cast<const NodeValueT<value_type> *>((*iter).get())
               ->value();
@@ -1137,7 +1469,7 @@ public:
 
       imp_iter_type iter = imp_ + num_;
 
-      if ((*iter)->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(*iter)->type() == nodeTypeCode) {
         return reinterpret_cast<const NodeValueT<value_type> *>((*iter).get())
             ->value();
       }
@@ -1158,7 +1490,7 @@ public:
 
       imp_iter_type iter = imp_ + num_;
 
-      if ((*iter)->type() == nodeTypeCode) {
+      if (materialize<nodeTypeCode>(*iter)->type() == nodeTypeCode) {
         if constexpr (std::is_convertible<value_type, return_type>::value) {
           return reinterpret_cast<const NodeValueT<value_type> *>((*iter).get())
               ->value();
@@ -1203,16 +1535,35 @@ public:
   }
 
 private:
-  void deserialize(microbson::Array arr) noexcept(false);
+  /**\param validated true if the array is already validated, for example as
+   * nested value of validated document, in this case validation is skipped
+   * \return bson::Error::invalid_argument if the array is not valid
+   */
+  bson::Error deserialize(microbson::Array arr,
+                          bool             lazyNested = false,
+                          bool             validated  = false) noexcept;
+
+  /**\param arr valid array, @see microbson::Array::valid
+   */
+  static Array fromValidated(microbson::Array arr,
+                             bool             lazyNested) noexcept(false) {
+    Array retval;
+    retval.deserialize(arr, lazyNested, true);
+    return retval;
+  }
 
 private:
-  container_type arr_;
+  // mutable for expand lazy values by const access, @see materialize
+  mutable container_type arr_;
 };
 
-inline void Document::deserialize(microbson::Document doc) noexcept(false) {
-  // first validate doc
-  if (!doc.valid()) {
-    throw bson::InvalidArgument{"invalid bson"};
+inline bson::Error Document::deserialize(microbson::Document doc,
+                                         bool                lazyNested,
+                                         bool                validated)
+    noexcept {
+  // first validate doc, nested values are validated with it
+  if (!validated && !doc.valid()) {
+    return bson::Error::invalid_argument;
   }
 
   for (microbson::Node node : doc) {
@@ -1232,6 +1583,22 @@ inline void Document::deserialize(microbson::Document doc) noexcept(false) {
       doc_.emplace(node.key(),
                    UNodeValueFactory::create(node.value<int64_t>()));
       break;
+    case bson::objectid_node:
+      doc_.emplace(node.key(),
+                   UNodeValueFactory::create(node.value<bson::ObjectId>()));
+      break;
+    case bson::datetime_node:
+      doc_.emplace(node.key(),
+                   UNodeValueFactory::create(node.value<bson::DateTime>()));
+      break;
+    case bson::timestamp_node:
+      doc_.emplace(node.key(),
+                   UNodeValueFactory::create(node.value<bson::Timestamp>()));
+      break;
+    case bson::decimal128_node:
+      doc_.emplace(node.key(),
+                   UNodeValueFactory::create(node.value<bson::Decimal128>()));
+      break;
     case bson::double_node:
       doc_.emplace(node.key(), UNodeValueFactory::create(node.value<double>()));
       break;
@@ -1239,14 +1606,29 @@ inline void Document::deserialize(microbson::Document doc) noexcept(false) {
       doc_.emplace(node.key(), UNodeValueFactory::create());
       break;
     case bson::array_node:
-      doc_.emplace(
-          node.key(),
-          UNodeValueFactory::create(Array{node.value<microbson::Array>()}));
+      if (lazyNested) {
+        BSON_STATISTICS_ADD(nodesAllocated, 1);
+        doc_.emplace(node.key(),
+                     std::make_unique<LazyValue>(
+                         bson::array_node, node.value<microbson::Array>()));
+        break;
+      }
+      doc_.emplace(node.key(),
+                   UNodeValueFactory::create(Array::fromValidated(
+                       node.value<microbson::Array>(), false)));
       break;
     case bson::document_node:
+      if (lazyNested) {
+        BSON_STATISTICS_ADD(nodesAllocated, 1);
+        doc_.emplace(node.key(),
+                     std::make_unique<LazyValue>(
+                         bson::document_node,
+                         node.value<microbson::Document>()));
+        break;
+      }
       doc_.emplace(node.key(),
-                   UNodeValueFactory::create(
-                       Document{node.value<microbson::Document>()}));
+                   UNodeValueFactory::create(Document::fromValidated(
+                       node.value<microbson::Document>(), false)));
       break;
     case bson::binary_node:
       doc_.emplace(
@@ -1254,11 +1636,11 @@ inline void Document::deserialize(microbson::Document doc) noexcept(false) {
           UNodeValueFactory::create(Binary{node.value<microbson::Binary>()}));
       break;
     default:
-      throw bson::InvalidArgument{"unknown node by key: " +
-                                  std::string{node.key()}};
-      break;
+      // unknown types are not passed by validation
+      return bson::Error::invalid_argument;
     }
   }
+  return bson::Error::none;
 }
 
 inline int Document::serialize(void *buf, int length) const noexcept(false) {
@@ -1278,7 +1660,17 @@ inline int Document::serialize(void *buf, int length) const noexcept(false) {
     std::strcpy(ptr + offset, key.c_str());
     offset += key.size() + SIZE_OF_ZERO_BYTE;
 
-    offset += val->serialize(ptr + offset, length - offset - SIZE_OF_ZERO_BYTE);
+    int written =
+        val->serialize(ptr + offset, length - offset - SIZE_OF_ZERO_BYTE);
+    offset += written;
+
+    // nested documents count their own bytes
+    BSON_STATISTICS_ADD(serializedBytes,
+                        SIZE_OF_BSON_TYPE + key.size() + SIZE_OF_ZERO_BYTE +
+                            (val->type() == bson::document_node ||
+                                     val->type() == bson::array_node
+                                 ? 0
+                                 : written));
   }
 
   *(ptr + offset) = '\0';
@@ -1288,6 +1680,8 @@ inline int Document::serialize(void *buf, int length) const noexcept(false) {
     throw std::runtime_error{"invalid serialization"}; // TODO is it needed?
   }
 
+  BSON_STATISTICS_ADD(serializedBytes, (MINIMAL_SIZE_OF_BSON_DOCUMENT));
+
   return offset;
 }
 
@@ -1298,10 +1692,12 @@ inline std::vector<byte> Document::serialize() const {
   return retval;
 }
 
-inline void Array::deserialize(microbson::Array arr) {
-  // first validate doc
-  if (!arr.valid()) {
-    throw bson::InvalidArgument{"invalid bson"};
+inline bson::Error Array::deserialize(microbson::Array arr,
+                                      bool             lazyNested,
+                                      bool             validated) noexcept {
+  // first validate doc, nested values are validated with it
+  if (!validated && !arr.valid()) {
+    return bson::Error::invalid_argument;
   }
 
   arr_.reserve(arr.size());
@@ -1320,6 +1716,22 @@ inline void Array::deserialize(microbson::Array arr) {
     case bson::int64_node:
       arr_.emplace_back(UNodeValueFactory::create(node.value<int64_t>()));
       break;
+    case bson::objectid_node:
+      arr_.emplace_back(
+          UNodeValueFactory::create(node.value<bson::ObjectId>()));
+      break;
+    case bson::datetime_node:
+      arr_.emplace_back(
+          UNodeValueFactory::create(node.value<bson::DateTime>()));
+      break;
+    case bson::timestamp_node:
+      arr_.emplace_back(
+          UNodeValueFactory::create(node.value<bson::Timestamp>()));
+      break;
+    case bson::decimal128_node:
+      arr_.emplace_back(
+          UNodeValueFactory::create(node.value<bson::Decimal128>()));
+      break;
     case bson::double_node:
       arr_.emplace_back(UNodeValueFactory::create(node.value<double>()));
       break;
@@ -1327,23 +1739,35 @@ inline void Array::deserialize(microbson::Array arr) {
       arr_.emplace_back(UNodeValueFactory::create());
       break;
     case bson::array_node:
-      arr_.emplace_back(
-          UNodeValueFactory::create(Array{node.value<microbson::Array>()}));
+      if (lazyNested) {
+        BSON_STATISTICS_ADD(nodesAllocated, 1);
+        arr_.emplace_back(std::make_unique<LazyValue>(
+            bson::array_node, node.value<microbson::Array>()));
+        break;
+      }
+      arr_.emplace_back(UNodeValueFactory::create(
+          Array::fromValidated(node.value<microbson::Array>(), false)));
       break;
     case bson::document_node:
+      if (lazyNested) {
+        BSON_STATISTICS_ADD(nodesAllocated, 1);
+        arr_.emplace_back(std::make_unique<LazyValue>(
+            bson::document_node, node.value<microbson::Document>()));
+        break;
+      }
       arr_.emplace_back(UNodeValueFactory::create(
-          Document{node.value<microbson::Document>()}));
+          Document::fromValidated(node.value<microbson::Document>(), false)));
       break;
     case bson::binary_node:
       arr_.emplace_back(
           UNodeValueFactory::create(Binary{node.value<microbson::Binary>()}));
       break;
     default:
-      throw bson::InvalidArgument{"unknown node by index: " +
-                                  std::string{node.key()}};
-      break;
+      // unknown types are not passed by validation
+      return bson::Error::invalid_argument;
     }
   }
+  return bson::Error::none;
 }
 
 inline int Array::serialize(void *buf, int length) const {
@@ -1366,7 +1790,17 @@ inline int Array::serialize(void *buf, int length) const {
     std::strcpy(ptr + offset, key.c_str());
     offset += key.size() + SIZE_OF_ZERO_BYTE;
 
-    offset += val->serialize(ptr + offset, length - offset - SIZE_OF_ZERO_BYTE);
+    int written =
+        val->serialize(ptr + offset, length - offset - SIZE_OF_ZERO_BYTE);
+    offset += written;
+
+    // nested documents count their own bytes
+    BSON_STATISTICS_ADD(serializedBytes,
+                        SIZE_OF_BSON_TYPE + key.size() + SIZE_OF_ZERO_BYTE +
+                            (val->type() == bson::document_node ||
+                                     val->type() == bson::array_node
+                                 ? 0
+                                 : written));
   }
 
   *(ptr + offset) = '\0';
@@ -1376,6 +1810,8 @@ inline int Array::serialize(void *buf, int length) const {
     throw std::runtime_error{"invalid serialization"}; // TODO is it needed?
   }
 
+  BSON_STATISTICS_ADD(serializedBytes, (MINIMAL_SIZE_OF_BSON_DOCUMENT));
+
   return offset;
 }
 
@@ -1393,7 +1829,8 @@ inline std::vector<byte> Array::serialize() const {
  */
 template <>
 inline typename type_traits<bson::Scalar>::return_type
-Document::get<bson::Scalar>(const std::string &key) const noexcept(false) {
+Document::get<bson::Scalar>(std::string_view key) const noexcept(false) {
+  BSON_STATISTICS_ADD(lookups, 1);
   if (auto found = doc_.find(key); found != doc_.end()) {
     const NodeValue *node = found->second.get();
     switch (node->type()) {
@@ -1407,7 +1844,8 @@ Document::get<bson::Scalar>(const std::string &key) const noexcept(false) {
       throw bson::BadCast{};
     }
   } else {
-    throw bson::OutOfRange{"have not value by key: " + key};
+    BSON_STATISTICS_ADD(misses, 1);
+    throw bson::OutOfRange{"have not value by key: " + std::string{key}};
   }
 }
 /**\brief special case if we need get some number and we don't care about type
@@ -1434,17 +1872,69 @@ Array::at<bson::Scalar>(int i) const noexcept(false) {
 }
 
 template <>
-inline bool Document::contains<bson::Scalar>(const std::string &key) const
+inline bool Document::contains<bson::Scalar>(std::string_view key) const
     noexcept {
+  BSON_STATISTICS_ADD(lookups, 1);
   if (auto found = doc_.find(key); found != doc_.end()) {
     if (auto type = found->second->type(); type == bson::double_node ||
                                            type == bson::int32_node ||
                                            type == bson::int64_node) {
       return true;
     }
+  } else {
+    BSON_STATISTICS_ADD(misses, 1);
   }
   return false;
 }
+
+inline UNodeValue LazyValue::expand(bool lazyNested) const noexcept(false) {
+  BSON_STATISTICS_ADD(nodesAllocated, 1);
+  // the view is validated with the source document
+  if (type_ == bson::array_node) {
+    microbson::Array arr{view_.data(), view_.length()};
+    return std::make_unique<NodeValueT<Array>>(
+        Array::fromValidated(arr, lazyNested));
+  }
+  return std::make_unique<NodeValueT<Document>>(
+      Document::fromValidated(view_, lazyNested));
+}
+
+/**\brief replace all lazy nodes in the subtree by expanded values
+ */
+inline void expandAll(UNodeValue &node) noexcept(false) {
+  if (node->lazy()) {
+    node = static_cast<const LazyValue *>(node.get())->expand(false);
+  } else if (node->type() == bson::document_node) {
+    reinterpret_cast<NodeValueT<Document> *>(node.get())->value().expand();
+  } else if (node->type() == bson::array_node) {
+    reinterpret_cast<NodeValueT<Array> *>(node.get())->value().expand();
+  }
+}
+
+inline void Document::expand() noexcept(false) {
+  for (auto &[key, val] : doc_) {
+    expandAll(val);
+  }
+}
+
+inline void Array::expand() noexcept(false) {
+  for (UNodeValue &val : arr_) {
+    expandAll(val);
+  }
+}
+
+template <int nodeTypeCode>
+inline const UNodeValue &materialize(const UNodeValue &node) noexcept(false) {
+  if constexpr (nodeTypeCode == bson::document_node ||
+                nodeTypeCode == bson::array_node) {
+    // value of other type is not expanded, so type mismatch not allocates
+    if (node->lazy() && node->type() == nodeTypeCode) {
+      const_cast<UNodeValue &>(node) =
+          static_cast<const LazyValue *>(node.get())->expand();
+    }
+  }
+  return node;
+}
 } // namespace minibson
 
 namespace std {
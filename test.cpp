@@ -1,9 +1,31 @@
 // test.cpp
 
+#include "bsonarray.hpp"
+#include "bsonbatch.hpp"
+#include "bsoncache.hpp"
+#include "bsoncolumns.hpp"
+#include "bsondiff.hpp"
+#include "bsonfilter.hpp"
+#include "bsonhash.hpp"
+#include "bsonindex.hpp"
+#include "bsonoverlay.hpp"
+#include "bsonpatch.hpp"
+#include "bsonpersistent.hpp"
+#include "bsonprojection.hpp"
+#include "bsonshape.hpp"
+#include "bsonrcu.hpp"
+#include "bsonstruct.hpp"
+#include "bsonwriter.hpp"
 #include "microbson.hpp"
 #include "minibson.hpp"
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <new>
+#include <thread>
 
 #define SOME_BUF_STR "some buf str"
 
@@ -16,6 +38,62 @@
     }                                                                          \
   }
 
+// expected value of counter, counters are always 0 if BSON_STATISTICS is not
+// defined
+uint64_t counted([[maybe_unused]] uint64_t value) {
+#ifdef BSON_STATISTICS
+  return value;
+#else
+  return 0;
+#endif
+}
+
+// count of allocations in current thread, for check allocation-free operations
+thread_local size_t allocations = 0;
+
+// replacements are not inlined, otherwise gcc pairs std::malloc of inlined
+// operator new with operator delete and reports mismatched deallocation
+[[gnu::noinline]] void *operator new(size_t size) {
+  ++allocations;
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] void *operator new(size_t size, std::align_val_t align) {
+  ++allocations;
+  size_t step    = size_t(align);
+  size_t rounded = size ? (size + step - 1) / step * step : step;
+  if (void *ptr = std::aligned_alloc(step, rounded)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+[[gnu::noinline]] void operator delete(void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new[](size_t size, std::align_val_t align) {
+  return operator new(size, align);
+}
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, std::align_val_t align) noexcept {
+  operator delete(ptr, align);
+}
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t align) noexcept {
+  operator delete(ptr, align);
+}
+void operator delete[](void *ptr, size_t, std::align_val_t align) noexcept {
+  operator delete(ptr, align);
+}
+
 // type placeholder for custom type_traits for microbson
 struct String {};
 
@@ -49,12 +127,87 @@ struct type_traits<String> {
 };
 } // namespace minibson
 
+namespace test {
+struct Point {
+  double  x;
+  int32_t y;
+  bool    visible;
+};
+
+struct Narrow {
+  int16_t  small;
+  uint32_t count;
+  uint64_t total;
+};
+
+struct Shape {
+  std::string                name;
+  Point                      center;
+  std::vector<Point>         points;
+  std::vector<std::string>   tags;
+  std::optional<int64_t>     id;
+  std::optional<std::string> comment;
+};
+} // namespace test
+
+BSON_STRUCT(test::Point, x, y, visible)
+BSON_STRUCT(test::Shape, name, center, points, tags, id, comment)
+BSON_STRUCT(test::Narrow, small, count, total)
+
 void minibson_test();
 void microbson_test();
+void statistics_test();
+void mutable_test();
+void patch_test();
+void writer_test();
+void struct_test();
+void lookup_test();
+void diff_test();
+void hash_test();
+void cache_test();
+void projection_test();
+void filter_test();
+void columns_test();
+void aggregate_test();
+void decode_test();
+void special_types_test();
+void batch_test();
+void index_test();
+void heterogeneous_lookup_test();
+void persistent_test();
+void rcu_test();
+void lazy_test();
+void overlay_test();
+void try_get_test();
+void shape_test();
 
 int main() {
   minibson_test();
   microbson_test();
+  statistics_test();
+  mutable_test();
+  patch_test();
+  writer_test();
+  struct_test();
+  lookup_test();
+  diff_test();
+  hash_test();
+  cache_test();
+  projection_test();
+  filter_test();
+  columns_test();
+  aggregate_test();
+  decode_test();
+  special_types_test();
+  batch_test();
+  index_test();
+  heterogeneous_lookup_test();
+  persistent_test();
+  rcu_test();
+  lazy_test();
+  overlay_test();
+  try_get_test();
+  shape_test();
 
   return EXIT_SUCCESS;
 }
@@ -172,7 +325,7 @@ void minibson_test() {
 
   assert(arr.size() == 10);
 
-  auto iter = arr.begin();
+  [[maybe_unused]] auto iter = arr.begin();
   assert((iter).type() == bson::int32_node);
   assert((++iter).type() == bson::int64_node);
   assert((++iter).type() == bson::double_node);
@@ -373,12 +526,13 @@ void microbson_test() {
   assert(a.at<bson::Scalar>(1) == 1);
   assert(a.at<bson::Scalar>(2) == 2);
 
-  microbson::Binary binary = doc.get<microbson::Binary>("binary");
+  [[maybe_unused]] microbson::Binary binary =
+      doc.get<microbson::Binary>("binary");
   assert(binary.first != nullptr);
   assert(binary.second == sizeof(SOME_BUF_STR));
 
   // new type
-  std::string_view s = doc.get<String>("binary");
+  [[maybe_unused]] std::string_view s = doc.get<String>("binary");
   assert(s == SOME_BUF_STR);
 
   assert((reinterpret_cast<const char *>(binary.first)) ==
@@ -431,3 +585,1915 @@ void microbson_test() {
   assert(emptyDoc.length() == 0);
   assert(std::distance(emptyDoc.begin(), emptyDoc.end()) == 0);
 }
+
+void statistics_test() {
+  minibson::Document d;
+  d.set("a", 1);
+  d.set("b", std::move(minibson::Document().set("c", 2)));
+
+  bson::Statistics::reset();
+  std::vector<uint8_t> buffer = d.serialize();
+
+  bson::Statistics stats = bson::Statistics::snapshot();
+  assert(stats.serializedBytes == counted(buffer.size()));
+
+  microbson::Document doc{buffer.data(), int(buffer.size())};
+  assert(doc.valid());
+  assert(doc.get<microbson::Document>("b").get<int32_t>("c") == 2);
+  assert(!doc.contains("z"));
+
+  stats = bson::Statistics::snapshot();
+  assert(stats.validations == counted(2));
+  assert(stats.bytesScanned == counted(buffer.size()));
+  assert(stats.lookups == counted(3));
+  assert(stats.misses == counted(1));
+  assert(stats.nodesVisited == counted(5));
+
+  bson::Statistics::reset();
+  minibson::Document copy{buffer.data(), int(buffer.size())};
+  stats = bson::Statistics::snapshot();
+  assert(stats.nodesAllocated == counted(3));
+  // nested documents are validated once, with the root
+  assert(stats.validations == counted(2));
+
+  minibson::Document lazy{buffer.data(), int(buffer.size()), minibson::lazy};
+  assert(lazy.get<minibson::Document>("b").get<int32_t>("c") == 2);
+  assert(bson::Statistics::snapshot().validations == counted(4));
+
+  bson::Statistics::reset();
+  stats = bson::Statistics::snapshot();
+  assert(stats.lookups == 0 && stats.nodesAllocated == 0);
+
+  // nested values of other documents count their own bytes too
+  minibson::PersistentDocument persistent{buffer.data(), int(buffer.size())};
+  minibson::ShapedDocument     shaped{buffer.data(), int(buffer.size())};
+  bson::Statistics::reset();
+  assert(persistent.serialize() == buffer);
+  assert(shaped.serialize() == buffer);
+  assert(bson::Statistics::snapshot().serializedBytes ==
+         counted(2 * buffer.size()));
+}
+
+void mutable_test() {
+  minibson::Document d;
+  d.set("counter", 1);
+  d.set("timestamp", int64_t{10});
+  d.set("ratio", 0.5);
+  d.set("flag", false);
+  d.set("status", "ok");
+  d.set("nested", std::move(minibson::Document().set("value", 3)));
+  d.set("array", std::move(minibson::Array{}.push_back(1).push_back(2)));
+
+  std::vector<uint8_t>      buffer = d.serialize();
+  microbson::MutableDocument doc{buffer.data(), int(buffer.size())};
+
+  doc.set("counter", 2)
+      .set<int64_t>("timestamp", 20)
+      .set("ratio", 1.5)
+      .set("flag", true)
+      .set("status", "no")
+      .set("nested.value", 4)
+      .set("array.1", 5);
+
+  CHECK_EXCEPT(doc.set("status", "too long"), bson::BadCast);
+  CHECK_EXCEPT(doc.set("counter", 1.0), bson::BadCast);
+  CHECK_EXCEPT(doc.set("not exists", 1), bson::OutOfRange);
+  CHECK_EXCEPT(doc.set("counter.value", 1), bson::OutOfRange);
+
+  assert(doc.valid());
+  assert(doc.get<int32_t>("counter") == 2);
+  assert(doc.get<int64_t>("timestamp") == 20);
+  assert(doc.get<double>("ratio") == 1.5);
+  assert(doc.get<bool>("flag") == true);
+  assert(doc.get<std::string_view>("status") == "no");
+  assert(doc.get<microbson::Document>("nested").get<int32_t>("value") == 4);
+  assert(doc.get<microbson::Array>("array").at<int32_t>(1) == 5);
+}
+
+void patch_test() {
+  minibson::Document d;
+  d.set("a", 1);
+  d.set("b", "text");
+  d.set("c", std::move(minibson::Document().set("d", 2).set("e", 3)));
+  d.set("f", 4.0);
+  d.set("g", true);
+
+  std::vector<uint8_t> buffer = d.serialize();
+  microbson::Document  source{buffer.data(), int(buffer.size())};
+
+  microbson::Patch patch;
+  patch.set("b", std::string{"longer text"})
+      .unset("c.d")
+      .set("c.x", int64_t{5})
+      .rename("f", "renamed")
+      .set("h.i.j", "created")
+      .unset("not exists")
+      .set("null");
+
+  std::vector<uint8_t> result = patch.apply(source);
+  microbson::Document  doc{result.data(), int(result.size())};
+  assert(doc.valid());
+  assert(doc.size() == 7);
+  assert(doc.get<int32_t>("a") == 1);
+  assert(doc.get<std::string_view>("b") == "longer text");
+  assert(!doc.contains("f"));
+  assert(doc.get<double>("renamed") == 4.0);
+  assert(doc.get<bool>("g") == true);
+  assert(doc.contains<void>("null"));
+
+  microbson::Document c = doc.get<microbson::Document>("c");
+  assert(c.size() == 2);
+  assert(c.get<int32_t>("e") == 3);
+  assert(c.get<int64_t>("x") == 5);
+  assert(doc.get<microbson::Document>("h")
+             .get<microbson::Document>("i")
+             .get<std::string_view>("j") == "created");
+
+  // rename replaces existing value
+  microbson::Patch replace;
+  replace.rename("a", "g");
+  result = replace.apply(source);
+  doc    = microbson::Document{result.data(), int(result.size())};
+  assert(doc.valid());
+  assert(doc.size() == 4);
+  assert(doc.get<int32_t>("g") == 1);
+
+  // renames are applied at once, so values can be swapped
+  microbson::Patch swap;
+  swap.rename("a", "b").rename("b", "a");
+  result = swap.apply(source);
+  doc    = microbson::Document{result.data(), int(result.size())};
+  assert(doc.valid());
+  assert(doc.size() == 5);
+  assert(doc.get<int32_t>("b") == 1);
+  assert(doc.get<std::string_view>("a") == "text");
+
+  microbson::Patch chain;
+  chain.rename("a", "b").rename("b", "f");
+  result = chain.apply(source);
+  doc    = microbson::Document{result.data(), int(result.size())};
+  assert(doc.valid());
+  assert(doc.size() == 4);
+  assert(doc.get<int32_t>("b") == 1);
+  assert(doc.get<std::string_view>("f") == "text");
+
+  // rename to same key does nothing
+  assert(microbson::Patch{}.rename("a", "a").apply(source) == buffer);
+
+  // value by rename target can not be changed, and can not be renamed twice
+  CHECK_EXCEPT(microbson::Patch{}.rename("a", "b").set("b", 7),
+               bson::InvalidArgument);
+  CHECK_EXCEPT(microbson::Patch{}.rename("a", "z").set("z", 7),
+               bson::InvalidArgument);
+  CHECK_EXCEPT(microbson::Patch{}.rename("a", "z").set("z.y", 7),
+               bson::InvalidArgument);
+  CHECK_EXCEPT(microbson::Patch{}.set("z", 7).rename("a", "z"),
+               bson::InvalidArgument);
+  CHECK_EXCEPT(microbson::Patch{}.rename("a", "z").rename("b", "z"),
+               bson::InvalidArgument);
+
+  // set and rename of same value renames the new value
+  microbson::Patch setRenamed;
+  setRenamed.rename("a", "z").set("a", 7).set("y", 8).rename("y", "b");
+  result = setRenamed.apply(source);
+  doc    = microbson::Document{result.data(), int(result.size())};
+  assert(doc.valid());
+  assert(doc.size() == 5);
+  assert(doc.get<int32_t>("z") == 7);
+  assert(doc.get<int32_t>("b") == 8);
+  assert(!doc.contains("a") && !doc.contains("y"));
+
+  // can not set value in not a document
+  microbson::Patch invalid;
+  invalid.set("a.b", 1);
+  CHECK_EXCEPT(invalid.apply(source), bson::InvalidArgument);
+  CHECK_EXCEPT(invalid.set("a", 1).set("a.b", 2), bson::InvalidArgument);
+
+  // empty patch copies the document
+  assert(microbson::Patch{}.apply(source) == buffer);
+}
+
+void writer_test() {
+  // minibson serializes values ordered by keys
+  minibson::Document d;
+  d.set("array",
+        std::move(minibson::Array{}
+                      .push_back(0)
+                      .push_back("string")
+                      .push_back(std::move(minibson::Document{}.set("a", 1)))));
+  d.set("binary", minibson::Binary(&SOME_BUF_STR, sizeof(SOME_BUF_STR)));
+  d.set("boolean", true);
+  d.set("document", std::move(minibson::Document().set("a", 3).set("b", 4)));
+  d.set("float", 30.20);
+  d.set("int32", 1);
+  d.set("int64", 140737488355328);
+  d.set("null");
+  d.set("string", "text");
+
+  std::vector<uint8_t> expected = d.serialize();
+
+  std::vector<uint8_t>  buffer;
+  microbson::BsonWriter writer{buffer};
+  writer.openArray("array")
+      .append(0)
+      .append("string")
+      .openDocument()
+      .append("a", 1)
+      .close()
+      .close()
+      .append("binary", microbson::Binary{&SOME_BUF_STR, sizeof(SOME_BUF_STR)})
+      .append("boolean", true)
+      .openDocument("document")
+      .append("a", 3)
+      .append("b", 4)
+      .close()
+      .append("float", 30.20)
+      .append("int32", 1)
+      .append("int64", int64_t{140737488355328})
+      .appendNull("null")
+      .append("string", "text");
+  assert(!writer.finished());
+  [[maybe_unused]] int length = writer.finish();
+  assert(length == int(expected.size()));
+  assert(writer.finished());
+  assert(buffer == expected);
+
+  CHECK_EXCEPT(writer.close(), bson::OutOfRange);
+
+  // copy serialized documents
+  std::vector<uint8_t>  copy;
+  microbson::BsonWriter copyWriter{copy};
+  microbson::Document   doc{buffer.data(), int(buffer.size())};
+  copyWriter.append("document", doc.get<microbson::Document>("document"));
+  CHECK_EXCEPT(copyWriter.append(1), bson::InvalidArgument);
+  copyWriter.openArray("array");
+  CHECK_EXCEPT(copyWriter.append("key", 1), bson::InvalidArgument);
+  copyWriter.finish();
+
+  microbson::Document copyDoc{copy.data(), int(copy.size())};
+  assert(copyDoc.valid());
+  assert(copyDoc.get<microbson::Document>("document").get<int32_t>("b") == 4);
+  assert(copyDoc.get<microbson::Array>("array").size() == 0);
+}
+
+void struct_test() {
+  static_assert(microbson::fixedSerializedSize<test::Point>() ==
+                4 + (3 + 8) + (3 + 4) + (9 + 1) + 1);
+  static_assert(microbson::fixedSerializedSize<test::Shape>() == -1);
+
+  test::Shape shape{"shape",
+                    {1.5, 2, true},
+                    {{0, 0, false}, {3, 4, true}},
+                    {"a", "b"},
+                    42,
+                    std::nullopt};
+
+  minibson::Document d;
+  d.set("name", "shape");
+  d.set("center",
+        std::move(minibson::Document{}
+                      .set("x", 1.5)
+                      .set("y", 2)
+                      .set("visible", true)));
+  d.set("id", int64_t{42});
+  d.set("tags", std::move(minibson::Array{}.push_back("a").push_back("b")));
+
+  std::vector<uint8_t> buffer = microbson::serialize(shape);
+  assert(int(buffer.size()) == microbson::getSerializedSize(shape));
+
+  microbson::Document doc{buffer.data(), int(buffer.size())};
+  assert(doc.valid());
+  assert(int(buffer.size()) ==
+         d.getSerializedSize() + 1 /*type*/ + 7 /*key*/ +
+             doc.get<microbson::Array>("points").length());
+  assert(doc.size() == 5);
+  assert(!doc.contains("comment"));
+  assert(doc.get<std::string_view>("name") == "shape");
+  assert(doc.get<int64_t>("id") == 42);
+  assert(doc.get<microbson::Document>("center").get<double>("x") == 1.5);
+  assert(doc.get<microbson::Document>("center").get<int32_t>("y") == 2);
+  assert(doc.get<microbson::Document>("center").get<bool>("visible"));
+  assert(doc.get<microbson::Array>("points").size() == 2);
+  assert(doc.get<microbson::Array>("points")
+             .at<microbson::Document>(1)
+             .get<int32_t>("y") == 4);
+  assert(doc.get<microbson::Array>("tags").at<std::string_view>(1) == "b");
+
+  // deserialization
+  test::Shape decoded{};
+  decoded.comment = "will be reset";
+  assert(microbson::deserialize(doc, decoded));
+  assert(decoded.name == "shape");
+  assert(decoded.center.x == 1.5 && decoded.center.y == 2);
+  assert(decoded.points.size() == 2 && decoded.points[1].y == 4);
+  assert(decoded.tags == shape.tags);
+  assert(decoded.id == 42);
+  assert(!decoded.comment.has_value());
+
+  // unknown values are skipped
+  d.set("unknown", 1);
+  d.set("points", minibson::Array{});
+  std::vector<uint8_t> other = d.serialize();
+  assert(microbson::deserialize(
+      microbson::Document{other.data(), int(other.size())}, decoded));
+  assert(decoded.points.empty());
+
+  d.set("name", 1);
+  other                       = d.serialize();
+  microbson::DecodeResult res = microbson::deserialize(
+      microbson::Document{other.data(), int(other.size())}, decoded);
+  assert(!res && res.error == bson::Error::bad_cast && res.key == "name");
+
+  d.erase("name");
+  other = d.serialize();
+  res   = microbson::deserialize(
+      microbson::Document{other.data(), int(other.size())}, decoded);
+  assert(!res && res.error == bson::Error::out_of_range && res.key == "name");
+
+  // integers, which not fit in the member, are not narrowed
+  test::Narrow narrow{};
+  auto readNarrow = [&narrow](int32_t small, int64_t count, int64_t total) {
+    minibson::Document values;
+    values.set("small", small).set("count", count).set("total", total);
+    std::vector<uint8_t> bytes = values.serialize();
+    return microbson::deserialize(
+        microbson::Document{bytes.data(), int(bytes.size())}, narrow);
+  };
+  assert(readNarrow(-32768, 4294967295, 0));
+  assert(narrow.small == -32768 && narrow.count == 4294967295);
+  res = readNarrow(32768, 0, 0);
+  assert(res.error == bson::Error::out_of_range && res.key == "small");
+  res = readNarrow(0, 4294967296, 0);
+  assert(res.error == bson::Error::out_of_range && res.key == "count");
+  res = readNarrow(0, -1, 0);
+  assert(res.error == bson::Error::out_of_range && res.key == "count");
+  res = readNarrow(0, 0, -1);
+  assert(res.error == bson::Error::out_of_range && res.key == "total");
+
+  uint8_t point[microbson::fixedSerializedSize<test::Point>()];
+  assert(microbson::serialize(shape.center, point, sizeof(point)) ==
+         sizeof(point));
+  CHECK_EXCEPT(microbson::serialize(shape.center, point, sizeof(point) - 1),
+               bson::InvalidArgument);
+}
+
+void lookup_test() {
+  std::vector<std::vector<uint8_t>> buffers;
+  for (int i = 0; i < 3; ++i) {
+    minibson::Document d;
+    d.set("a", i);
+    d.set("b", std::string(i + 1, 'b'));
+    d.set("c", i * 2);
+    buffers.emplace_back(d.serialize());
+  }
+
+  microbson::Lookup lookup{"c"};
+  for (int i = 0; i < 3; ++i) {
+    microbson::Document doc{buffers[i].data(), int(buffers[i].size())};
+    assert(lookup.get<int32_t>(doc) == i * 2);
+    assert(lookup.position() == 2);
+  }
+  // position of `c` differs in every document, because `b` have different
+  // length
+  assert(lookup.hits() == 0);
+  assert(lookup.misses() == 3);
+
+  microbson::Document last{buffers[2].data(), int(buffers[2].size())};
+  assert(lookup.get<bson::Scalar>(last) == 4);
+  assert(lookup.contains(last));
+  assert(lookup.hits() == 2);
+
+  microbson::Lookup notExists{"z"};
+  assert(!notExists.contains(last));
+  CHECK_EXCEPT(notExists.get<int32_t>(last), bson::OutOfRange);
+  CHECK_EXCEPT(lookup.get<double>(last), bson::BadCast);
+
+  lookup.resetStatistics();
+  assert(lookup.hits() == 0 && lookup.misses() == 0);
+
+  // cached node, which not fits in the document, is not used
+  minibson::Document longDoc;
+  longDoc.set("a", std::string(20, 'a'));
+  longDoc.set("c", 5);
+  std::vector<uint8_t> longBuffer = longDoc.serialize();
+
+  minibson::Document shortDoc;
+  shortDoc.set("c", 7);
+  std::vector<uint8_t> shortBuffer = shortDoc.serialize();
+
+  microbson::Document first{longBuffer.data(), int(longBuffer.size())};
+  microbson::Document second{shortBuffer.data(), int(shortBuffer.size())};
+  assert(lookup.get<int32_t>(first) == 5);
+  assert(lookup.get<int32_t>(second) == 7);
+  assert(lookup.hits() == 0 && lookup.misses() == 2);
+  assert(lookup.get<int32_t>(second) == 7);
+  assert(lookup.hits() == 1);
+}
+
+void diff_test() {
+  minibson::Document d;
+  d.set("same", std::move(minibson::Document{}.set("a", 1).set("b", "text")));
+  d.set("changed", std::move(minibson::Document{}.set("a", 1).set("b", 2)));
+  d.set("array",
+        std::move(minibson::Array{}.push_back(1).push_back(2).push_back(3)));
+  d.set("removed", true);
+  d.set("type", 1);
+  std::vector<uint8_t> from = d.serialize();
+
+  d.set("changed", std::move(minibson::Document{}.set("a", 1).set("b", 3)));
+  d.set("array", std::move(minibson::Array{}.push_back(1).push_back(5)));
+  d.erase("removed");
+  d.set("type", "string");
+  d.set("added", 1.5);
+  std::vector<uint8_t> to = d.serialize();
+
+  microbson::Document fromDoc{from.data(), int(from.size())};
+  microbson::Document toDoc{to.data(), int(to.size())};
+
+  assert(microbson::diff(fromDoc, fromDoc).empty());
+
+  microbson::Patch patch = microbson::diff(fromDoc, toDoc);
+  assert(patch.operations().size() == 6);
+  for ([[maybe_unused]] const microbson::Patch::Operation &operation :
+       patch.operations()) {
+    assert(operation.path.find("same") == std::string::npos);
+  }
+
+  std::vector<uint8_t> result = patch.apply(fromDoc);
+  microbson::Document  doc{result.data(), int(result.size())};
+  assert(doc.valid());
+
+  // patched document have same values, but maybe in other order
+  minibson::Document expected{toDoc};
+  minibson::Document actual{doc};
+  assert(actual.serialize() == expected.serialize());
+}
+
+void hash_test() {
+  std::vector<uint8_t> first;
+  microbson::BsonWriter{first}
+      .append("a", 1)
+      .append("b", "text")
+      .openDocument("c")
+      .append("x", 1.5)
+      .append("y", true)
+      .close()
+      .finish();
+
+  std::vector<uint8_t> second;
+  microbson::BsonWriter{second}
+      .openDocument("c")
+      .append("y", true)
+      .append("x", 1.5)
+      .close()
+      .append("b", "text")
+      .append("a", 1)
+      .finish();
+
+  microbson::Document firstDoc{first.data(), int(first.size())};
+  microbson::Document secondDoc{second.data(), int(second.size())};
+
+  assert(microbson::hash64(firstDoc) != microbson::hash64(secondDoc));
+  assert(microbson::structuralHash(firstDoc) ==
+         microbson::structuralHash(secondDoc));
+  assert(microbson::structuralHash(firstDoc) !=
+         microbson::structuralHash(firstDoc, 1));
+  assert(microbson::hash64(microbson::Document{}) ==
+         microbson::hash64(minibson::Document{}.serialize().data(), 5));
+
+  std::vector<uint8_t> third;
+  microbson::BsonWriter{third}.append("a", 1).append("b", "texT").finish();
+  assert(microbson::structuralHash(
+             microbson::Document{third.data(), int(third.size())}) !=
+         microbson::structuralHash(firstDoc));
+
+  // long inputs are hashed by stripes, every byte must change the hash
+  std::vector<uint8_t> binary(5000);
+  for (size_t i = 0; i < binary.size(); ++i) {
+    binary[i] = i * 131 + 7;
+  }
+  [[maybe_unused]] uint64_t hash =
+      microbson::hash64(binary.data(), binary.size());
+  assert(hash == microbson::hash64(binary.data(), binary.size()));
+  for (size_t i : {0, 100, 1023, 1024, 4935, 4999}) {
+    binary[i] ^= 1;
+    assert(microbson::hash64(binary.data(), binary.size()) != hash);
+    binary[i] ^= 1;
+  }
+  for (size_t length = 1; length < 300; ++length) {
+    assert(microbson::hash64(binary.data(), length) !=
+           microbson::hash64(binary.data(), length - 1));
+  }
+}
+
+void cache_test() {
+  std::vector<uint8_t> heartbeat =
+      minibson::Document{}.set("type", "heartbeat").set("seq", 1).serialize();
+  std::vector<uint8_t> config =
+      minibson::Document{}.set("type", "config").set("value", 1.5).serialize();
+
+  // budget for exactly two documents
+  minibson::ParseCache probe{1024};
+  probe.get(heartbeat.data(), heartbeat.size());
+  probe.get(config.data(), config.size());
+  minibson::ParseCache cache{probe.memoryUsage()};
+
+  minibson::ParseCache::value_type first =
+      cache.get(heartbeat.data(), heartbeat.size());
+  assert(first->get<std::string>("type") == "heartbeat");
+  assert(cache.misses() == 1 && cache.hits() == 0);
+
+  // byte-identical payload in other buffer shares same tree
+  std::vector<uint8_t>             copy   = heartbeat;
+  minibson::ParseCache::value_type second = cache.get(
+      microbson::Document{copy.data(), int(copy.size())});
+  assert(first == second);
+  assert(cache.hits() == 1);
+
+  cache.get(config.data(), config.size());
+  assert(cache.size() == 2);
+  assert(cache.memoryUsage() <= cache.memoryBudget());
+
+  // least recently used document is evicted
+  std::vector<uint8_t> other = minibson::Document{}
+                                   .set("type", "heartbeat")
+                                   .set("seq", 2)
+                                   .serialize();
+  cache.get(heartbeat.data(), heartbeat.size());
+  cache.get(other.data(), other.size());
+  assert(cache.size() == 2);
+  assert(cache.memoryUsage() <= cache.memoryBudget());
+  assert(cache.get(heartbeat.data(), heartbeat.size()) == first);
+  cache.get(config.data(), config.size());
+  assert(cache.misses() == 4);
+
+  // evicted document still alive
+  assert(first->get<int>("seq") == 1);
+
+  CHECK_EXCEPT(cache.get(heartbeat.data(), 4), bson::InvalidArgument);
+
+  cache.clear();
+  assert(cache.size() == 0 && cache.memoryUsage() == 0);
+}
+
+void projection_test() {
+  std::vector<uint8_t> buffer;
+  microbson::BsonWriter{buffer}
+      .append("id", 1)
+      .append("status", "ok")
+      .openDocument("payload")
+      .append("a", 1.5)
+      .append("b", "secret")
+      .openArray("c")
+      .append(1)
+      .append(2)
+      .close()
+      .close()
+      .append("trace", "long trace")
+      .append("latency", int64_t{300})
+      .finish();
+  microbson::Document doc{buffer.data(), int(buffer.size())};
+
+  microbson::Projection include{
+      microbson::Projection::include_mode,
+      {"id", "payload.a", "payload.c.1", "id.x", "no"}};
+  std::vector<uint8_t> included = include.project(doc);
+  assert(int(included.size()) == include.getSerializedSize(doc));
+
+  std::vector<uint8_t> expected;
+  microbson::BsonWriter{expected}
+      .append("id", 1)
+      .openDocument("payload")
+      .append("a", 1.5)
+      .openArray("c")
+      .close()
+      .close()
+      .finish();
+  microbson::Document result{included.data(), int(included.size())};
+  assert(result.valid());
+  microbson::Array items =
+      result.get<microbson::Document>("payload").get<microbson::Array>("c");
+  // array item keeps its key
+  assert(items.length() == 12);
+  assert((*items.begin()).key() == "1" &&
+         (*items.begin()).value<int32_t>() == 2);
+  // expected document without int32 item `1` of the array
+  assert(included.size() == expected.size() + 7);
+  assert(!result.contains("status") && !result.contains("payload.b"));
+
+  microbson::Projection exclude{microbson::Projection::exclude_mode,
+                                std::vector<std::string>{"payload.b",
+                                                         "trace",
+                                                         "status.x"}};
+  std::vector<uint8_t>  excluded(exclude.getSerializedSize(doc));
+  [[maybe_unused]] int written =
+      exclude.project(doc, excluded.data(), excluded.size());
+  assert(written == int(excluded.size()));
+
+  minibson::Document erased{doc};
+  erased.get<minibson::Document>("payload").erase("b");
+  erased.erase("trace");
+  minibson::Document actual{excluded.data(), int(excluded.size())};
+  assert(actual.serialize() == erased.serialize());
+
+  CHECK_EXCEPT(exclude.project(doc, excluded.data(), excluded.size() - 1),
+               bson::InvalidArgument);
+  CHECK_EXCEPT(
+      (microbson::Projection{microbson::Projection::include_mode, {"a..b"}}),
+      bson::InvalidArgument);
+
+  assert(include.project(microbson::Document{}).size() ==
+         MINIMAL_SIZE_OF_BSON_DOCUMENT);
+}
+
+void filter_test() {
+  using microbson::where;
+
+  std::vector<std::vector<uint8_t>> buffers(4);
+  microbson::BsonWriter{buffers[0]}
+      .append("status", "ok")
+      .append("latency", 300)
+      .openArray("tags")
+      .append("x")
+      .append("y")
+      .close()
+      .finish();
+  microbson::BsonWriter{buffers[1]}
+      .append("status", "ok")
+      .append("latency", 250.0)
+      .openArray("tags")
+      .append("x")
+      .close()
+      .finish();
+  microbson::BsonWriter{buffers[2]}
+      .append("latency", int64_t{1000})
+      .append("status", "ok")
+      .openDocument("meta")
+      .append("region", "eu-west")
+      .append("retry", true)
+      .close()
+      .finish();
+  microbson::BsonWriter{buffers[3]}
+      .append("status", "error")
+      .append("latency", "slow")
+      .openArray("tags")
+      .append(7)
+      .close()
+      .finish();
+
+  std::vector<microbson::Document> docs;
+  for (const std::vector<uint8_t> &buffer : buffers) {
+    docs.emplace_back(buffer.data(), int(buffer.size()));
+  }
+
+  microbson::Filter filter{where("status") == "ok" && where("latency") > 250 &&
+                           where("tags").contains("x")};
+  assert(filter.fields() == 3);
+  [[maybe_unused]] size_t before = allocations;
+  assert(filter.match(docs[0]));
+  assert(!filter.match(docs[1]));
+  assert(!filter.match(docs[2]));
+  assert(!filter.match(docs[3]));
+  assert(allocations == before);
+
+  bool                    result[4];
+  [[maybe_unused]] size_t matched =
+      microbson::Filter{where("latency") >= 250 || where("meta.retry") == true}
+          .match(docs.data(), docs.size(), result);
+  assert(matched == 3);
+  assert(result[0] && result[1] && result[2] && !result[3]);
+
+  // number comparison not depends on type of number
+  assert(microbson::Filter{where("latency") == 250}.match(docs[1]));
+  assert(microbson::Filter{where("latency") < int64_t{1001}}.match(docs[2]));
+
+  // values of other types never match comparisons
+  assert(!microbson::Filter{where("latency") < 1}.match(docs[3]));
+  assert(!microbson::Filter{where("latency") != 1}.match(docs[3]));
+  assert(microbson::Filter{!(where("latency") == 1)}.match(docs[3]));
+  assert(!microbson::Filter{where("meta.region") != "eu"}.match(docs[0]));
+  assert(microbson::Filter{!(where("meta.region") == "eu")}.match(docs[0]));
+  assert(microbson::Filter{where("latency") != 1}.match(docs[2]));
+  assert(!microbson::Filter{where("latency") != 1000}.match(docs[2]));
+  assert(microbson::Filter{where("tags").contains(7)}.match(docs[3]));
+
+  assert(microbson::Filter{where("meta.region").contains("eu") &&
+                           !where("tags").exists()}
+             .match(docs[2]));
+  assert(!microbson::Filter{where("meta.region") > "z"}.match(docs[2]));
+  assert(!microbson::Filter{where("meta.retry").exists()}.match(docs[0]));
+  assert(!microbson::Filter{where("status").exists()}.match(
+      microbson::Document{}));
+
+  // found fields of big filters are kept in heap
+  microbson::Expression many = where("status") == "error";
+  for (size_t i = 0; i < microbson::Filter::stack_slots; ++i) {
+    many = many || where("field" + std::to_string(i)).exists();
+  }
+  microbson::Filter bigFilter{many};
+  assert(bigFilter.fields() > microbson::Filter::stack_slots);
+  assert(bigFilter.match(docs[3]) && !bigFilter.match(docs[0]));
+}
+
+void columns_test() {
+  using microbson::ColumnExtractor;
+
+  // rows with missing values, values of other types and nested fields
+  std::vector<std::vector<uint8_t>> buffers(20);
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    microbson::BsonWriter writer{buffers[i]};
+    if (i % 3 == 0) {
+      writer.append("latency", int32_t(i));
+    } else if (i % 3 == 1) {
+      writer.append("latency", i * 0.5);
+    }
+    if (i % 5 != 0) {
+      writer.append("host", "host-" + std::to_string(i));
+    }
+    writer.openDocument("meta").append("seq", int64_t(i) * 10).close();
+    writer.finish();
+  }
+
+  std::vector<microbson::Document> docs;
+  for (const std::vector<uint8_t> &buffer : buffers) {
+    docs.emplace_back(buffer.data(), int(buffer.size()));
+  }
+
+  ColumnExtractor columns{{{"latency", ColumnExtractor::double_column},
+                           {"latency", ColumnExtractor::int64_column},
+                           {"host", ColumnExtractor::string_column},
+                           {"meta.seq", ColumnExtractor::int64_column}},
+                          docs.size()};
+  assert(columns.size() == 4 && columns.rows() == docs.size());
+
+  CHECK_EXCEPT(columns.extract(docs.data(), 0, docs.size()),
+               bson::InvalidArgument);
+  CHECK_EXCEPT(columns.measure(docs.data(), 3, docs.size()),
+               bson::InvalidArgument);
+  CHECK_EXCEPT(columns.measure(docs.data(), 0, docs.size() + 1),
+               bson::InvalidArgument);
+
+  // disjoint ranges, as if they are processed by different threads
+  columns.measure(docs.data(), 8, docs.size());
+  columns.measure(docs.data(), 0, 8);
+  columns.allocate();
+  columns.extract(docs.data(), 16, docs.size());
+  columns.extract(docs.data(), 0, 16);
+
+  [[maybe_unused]] const ColumnExtractor::Column &doubles  = columns.column(0);
+  [[maybe_unused]] const ColumnExtractor::Column &integers = columns.column(1);
+  [[maybe_unused]] const ColumnExtractor::Column &hosts    = columns.column(2);
+  [[maybe_unused]] const ColumnExtractor::Column &seqs     = columns.column(3);
+  for (size_t i = 0; i < docs.size(); ++i) {
+    assert(doubles.valid(i) == (i % 3 != 2));
+    assert(doubles.doubles[i] == (i % 3 == 0 ? double(i)
+                                  : i % 3 == 1 ? i * 0.5
+                                               : 0));
+    assert(integers.valid(i) == (i % 3 == 0));
+    assert(integers.integers[i] == (i % 3 == 0 ? int64_t(i) : 0));
+    assert(hosts.valid(i) == (i % 5 != 0));
+    assert(hosts.string(i) ==
+           (i % 5 != 0 ? "host-" + std::to_string(i) : std::string{}));
+    assert(seqs.valid(i) && seqs.integers[i] == int64_t(i) * 10);
+  }
+}
+
+void aggregate_test() {
+  // sizes cross boundaries of runs with same stride
+  for (int size : {0, 1, 7, 10, 11, 100, 101, 1234}) {
+    std::vector<uint8_t> doubles;
+    std::vector<uint8_t> ints;
+    std::vector<uint8_t> longs;
+    microbson::BsonWriter doublesWriter{doubles};
+    microbson::BsonWriter intsWriter{ints};
+    microbson::BsonWriter longsWriter{longs};
+    doublesWriter.openArray("a");
+    intsWriter.openArray("a");
+    longsWriter.openArray("a");
+
+    double  sum = 0;
+    int64_t min = 0;
+    int64_t max = 0;
+    for (int i = 0; i < size; ++i) {
+      int32_t val = (i * 7919) % 1000 - 500;
+      doublesWriter.append(val * 0.5);
+      intsWriter.append(val);
+      longsWriter.append(int64_t(val) * 10000000000);
+      sum += val;
+      min = i ? std::min<int64_t>(min, val) : val;
+      max = i ? std::max<int64_t>(max, val) : val;
+    }
+    doublesWriter.finish();
+    intsWriter.finish();
+    longsWriter.finish();
+
+    microbson::Aggregate result =
+        microbson::aggregate(microbson::Document{doubles.data(),
+                                                 int(doubles.size())}
+                                 .get<microbson::Array>("a"));
+    assert(result.count == size_t(size));
+    assert(result.sum == sum * 0.5);
+    assert(size == 0 || (result.min == min * 0.5 && result.max == max * 0.5));
+    assert(size != 0 || (result.min != result.min &&
+                         result.mean() != result.mean()));
+
+    result = microbson::aggregate(
+        microbson::Document{ints.data(), int(ints.size())}
+            .get<microbson::Array>("a"));
+    assert(result.count == size_t(size) && result.sum == sum);
+    assert(size == 0 || (result.min == min && result.max == max));
+    assert(size == 0 || result.mean() == sum / size);
+
+    result = microbson::aggregate(
+        microbson::Document{longs.data(), int(longs.size())}
+            .get<microbson::Array>("a"));
+    assert(result.count == size_t(size) && result.sum == sum * 10000000000);
+    assert(size == 0 ||
+           (result.min == min * 1e10 && result.max == max * 1e10));
+  }
+
+  // integer sums, which not fit in int64, are continued as double
+  std::vector<uint8_t>  huge;
+  microbson::BsonWriter hugeWriter{huge};
+  hugeWriter.openArray("longs");
+  for (int i = 0; i < 10; ++i) {
+    hugeWriter.append(std::numeric_limits<int64_t>::max());
+  }
+  hugeWriter.close().openArray("mixed").append(0.0);
+  for (int i = 0; i < 10; ++i) {
+    hugeWriter.append(std::numeric_limits<int64_t>::max());
+  }
+  hugeWriter.close().finish();
+  microbson::Document hugeDoc{huge.data(), int(huge.size())};
+  assert(microbson::aggregate(hugeDoc.get<microbson::Array>("longs")).sum ==
+         10 * 9223372036854775808.0);
+  assert(microbson::aggregate(hugeDoc.get<microbson::Array>("mixed")).sum ==
+         10 * 9223372036854775808.0);
+
+  // mixed arrays are read as bson::Scalar
+  std::vector<uint8_t> buffer;
+  microbson::BsonWriter{buffer}
+      .openArray("mixed")
+      .append(1)
+      .append(2.5)
+      .append(int64_t{-3})
+      .close()
+      .openArray("strings")
+      .append("1")
+      .close()
+      .openArray("booleans")
+      .append(true)
+      .close()
+      .finish();
+  microbson::Document doc{buffer.data(), int(buffer.size())};
+
+  [[maybe_unused]] microbson::Aggregate result =
+      microbson::aggregate(doc.get<microbson::Array>("mixed"));
+  assert(result.count == 3 && result.sum == 0.5);
+  assert(result.min == -3 && result.max == 2.5);
+
+  CHECK_EXCEPT(microbson::aggregate(doc.get<microbson::Array>("strings")),
+               bson::BadCast);
+  CHECK_EXCEPT(microbson::aggregate(doc.get<microbson::Array>("booleans")),
+               bson::BadCast);
+}
+
+void decode_test() {
+  std::vector<uint8_t>  buffer;
+  microbson::BsonWriter writer{buffer};
+  writer.openArray("ints");
+  for (int32_t i = 0; i < 1234; ++i) {
+    writer.append(i * 3 - 100);
+  }
+  writer.close();
+  writer.openArray("flags").append(true).append(false).append(true).close();
+  writer.openArray("mixed").append(1).append(2).append(3.5).append(4).close();
+  writer.finish();
+  microbson::Document doc{buffer.data(), int(buffer.size())};
+
+  std::vector<int32_t> ints =
+      microbson::decode<int32_t>(doc.get<microbson::Array>("ints"));
+  assert(ints.size() == 1234);
+  for (int32_t i = 0; i < 1234; ++i) {
+    assert(ints[i] == i * 3 - 100);
+  }
+
+  // decode in the buffer gives same result
+  std::vector<int32_t> span(2000);
+  assert(microbson::decode(doc.get<microbson::Array>("ints"),
+                           span.data(),
+                           span.size()) == 1234);
+  assert(std::equal(ints.begin(), ints.end(), span.begin()));
+  CHECK_EXCEPT(
+      microbson::decode(doc.get<microbson::Array>("ints"), span.data(), 100),
+      bson::OutOfRange);
+
+  assert((microbson::decode<bool>(doc.get<microbson::Array>("flags")) ==
+          std::vector<bool>{true, false, true}));
+  assert(microbson::decode<int64_t>(microbson::Array{}).empty());
+
+  // fails on first item of other type, previous items are decoded
+  int32_t mixed[4]{};
+  CHECK_EXCEPT(
+      microbson::decode(doc.get<microbson::Array>("mixed"), mixed, 4),
+      bson::BadCast);
+  assert(mixed[0] == 1 && mixed[1] == 2 && mixed[3] == 0);
+  CHECK_EXCEPT(microbson::decode<double>(doc.get<microbson::Array>("ints")),
+               bson::BadCast);
+
+  microbson::StridedView<int32_t> view{doc.get<microbson::Array>("ints")};
+  assert(view.size() == 1234);
+  for (size_t i = 0; i < view.size(); ++i) {
+    assert(view[i] == ints[i]);
+  }
+  CHECK_EXCEPT(view.at(1234), bson::OutOfRange);
+  CHECK_EXCEPT(microbson::StridedView<int32_t>{doc.get<microbson::Array>(
+                   "mixed")},
+               bson::BadCast);
+  assert(microbson::StridedView<double>{}.empty());
+
+  // keys, which are not indexes of items, are read by their length
+  auto rawArray = [](const std::vector<std::string> &keys) {
+    std::vector<uint8_t> raw(SIZE_OF_BSON_SIZE);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      int32_t value = int32_t(i) * 256;
+      raw.push_back(bson::int32_node);
+      raw.insert(raw.end(), keys[i].begin(), keys[i].end());
+      raw.push_back(0);
+      raw.insert(raw.end(),
+                 reinterpret_cast<uint8_t *>(&value),
+                 reinterpret_cast<uint8_t *>(&value + 1));
+    }
+    raw.push_back(0);
+    int32_t length = int32_t(raw.size());
+    std::memcpy(raw.data(), &length, SIZE_OF_BSON_SIZE);
+    return raw;
+  };
+  std::vector<uint8_t> shortKey =
+      rawArray({"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "1"});
+  std::vector<int32_t> decoded = microbson::decode<int32_t>(
+      microbson::Array{shortKey.data(), int(shortKey.size())});
+  assert(decoded.size() == 11 && decoded[10] == 2560);
+
+  std::vector<uint8_t> wrongKey = rawArray({"0", "1", "7", "3"});
+  microbson::Array     wrong{wrongKey.data(), int(wrongKey.size())};
+  CHECK_EXCEPT(microbson::StridedView<int32_t>{wrong}, bson::BadCast);
+  assert((microbson::decode<int32_t>(wrong) ==
+          std::vector<int32_t>{0, 256, 512, 768}));
+}
+
+void special_types_test() {
+  // {"_id": ObjectId, "at": datetime, "ts": timestamp, "d": decimal128}
+  const uint8_t raw[] = {
+      65,  0,   0,   0,                                      // length
+      0x07, '_', 'i', 'd', 0,                                // objectid
+      0x50, 0x7f, 0x1f, 0x77, 0xbc, 0xf8, 0x6c, 0xd7, 0x99, 0x43, 0x90, 0x11,
+      0x09, 'a', 't', 0,                                     // datetime
+      0x00, 0x68, 0xe5, 0xcf, 0x8b, 0x01, 0x00, 0x00,        // 1700000000000
+      0x11, 't', 's', 0,                                     // timestamp
+      0x05, 0x00, 0x00, 0x00, 0x00, 0xf1, 0x53, 0x65,        // 5, 1700000000
+      0x13, 'd', 0,                                          // decimal128
+      0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x30,        // 1
+      0};
+  static_assert(sizeof(raw) == 65);
+
+  microbson::Document doc{raw, sizeof(raw)};
+  assert(doc.valid());
+  assert(doc.get<bson::ObjectId>("_id").toString() ==
+         "507f1f77bcf86cd799439011");
+  assert(doc.get<bson::DateTime>("at").milliseconds == 1700000000000);
+  assert(bson::DateTime::fromTimePoint(
+             doc.get<bson::DateTime>("at").toTimePoint()) ==
+         doc.get<bson::DateTime>("at"));
+  assert((doc.get<bson::Timestamp>("ts") == bson::Timestamp{5, 1700000000}));
+  assert((doc.get<bson::Decimal128>("d") ==
+          bson::Decimal128{1, 0x3040000000000000}));
+  CHECK_EXCEPT(doc.get<int64_t>("at"), bson::BadCast);
+
+  // truncated value is invalid
+  uint8_t truncated[sizeof(raw)];
+  std::memcpy(truncated, raw, sizeof(raw));
+  truncated[0] = 20;
+  truncated[19] = 0;
+  assert(!microbson::Document(truncated, sizeof(truncated)).valid());
+
+  // minibson keeps values and serializes them back
+  minibson::Document mini{raw, sizeof(raw)};
+  assert(mini.get<bson::DateTime>("at").milliseconds == 1700000000000);
+  mini.set("next", bson::DateTime{1});
+  mini.erase("next");
+  std::vector<uint8_t> serialized = mini.serialize();
+  assert(minibson::Document(serialized.data(), serialized.size())
+             .get<bson::ObjectId>("_id") == doc.get<bson::ObjectId>("_id"));
+  assert(serialized.size() == sizeof(raw));
+
+  // writer gives same bytes as minibson in same order
+  std::vector<uint8_t> written;
+  microbson::BsonWriter{written}
+      .append("_id", doc.get<bson::ObjectId>("_id"))
+      .append("at", doc.get<bson::DateTime>("at"))
+      .append("d", doc.get<bson::Decimal128>("d"))
+      .append("ts", doc.get<bson::Timestamp>("ts"))
+      .openArray("dates")
+      .append(bson::DateTime{1})
+      .append(bson::DateTime{2})
+      .close()
+      .finish();
+  microbson::Document writtenDoc{written.data(), int(written.size())};
+  assert(writtenDoc.valid());
+  assert(std::equal(serialized.begin() + SIZE_OF_BSON_SIZE,
+                    serialized.end() - SIZE_OF_ZERO_BYTE,
+                    written.begin() + SIZE_OF_BSON_SIZE));
+
+  std::vector<bson::DateTime> dates = microbson::decode<bson::DateTime>(
+      writtenDoc.get<microbson::Array>("dates"));
+  assert(dates.size() == 2 && dates[1].milliseconds == 2);
+
+  // update in place
+  std::vector<uint8_t>       mutableBuffer = written;
+  microbson::MutableDocument mutableDoc{mutableBuffer.data(),
+                                        int(mutableBuffer.size())};
+  mutableDoc.set("ts", bson::Timestamp{6, 1700000001});
+  assert(mutableDoc.get<bson::Timestamp>("ts").increment == 6);
+}
+
+void batch_test() {
+  [[maybe_unused]] const char check[] = "123456789";
+  assert(microbson::crc32c(check, 9) == 0xE3069283);
+  assert(microbson::crc32c(check + 4, 5, microbson::crc32c(check, 4)) ==
+         0xE3069283);
+
+  const std::string path     = "batch_test.bsonbatch";
+  const std::string copyPath = "batch_test_copy.bsonbatch";
+
+  {
+    microbson::BatchWriter writer{path};
+    for (int32_t i = 0; i < 1000; ++i) {
+      minibson::Document doc;
+      doc.set("i", i);
+      doc.set("text", std::string(i % 50, 'x'));
+      [[maybe_unused]] size_t index;
+      if (i % 2) {
+        index = writer.append(doc);
+      } else {
+        std::vector<uint8_t> buf = doc.serialize();
+        index = writer.append(microbson::Document{buf.data(), int(buf.size())});
+      }
+      assert(index == size_t(i));
+    }
+    [[maybe_unused]] size_t index = writer.append(microbson::Document{});
+    assert(index == 1000);
+    writer.close();
+    CHECK_EXCEPT(writer.append(microbson::Document{}), bson::InvalidArgument);
+  }
+
+  {
+    microbson::BatchReader reader{path};
+    assert(reader.size() == 1001);
+    assert(!reader.recovered());
+    for (int32_t i = 0; i < 1000; ++i) {
+      assert(reader.at(i).get<int32_t>("i") == i);
+      assert(reader[i].get<std::string_view>("text").size() == size_t(i % 50));
+    }
+    assert(reader.at(1000).length() == MINIMAL_SIZE_OF_BSON_DOCUMENT);
+    assert(minibson::Document{reader.at(7)}.get<int32_t>("i") == 7);
+    CHECK_EXCEPT(reader.at(1001), bson::OutOfRange);
+  }
+
+  // continue closed file
+  {
+    microbson::BatchWriter writer{path, microbson::BatchWriter::append_mode};
+    assert(writer.size() == 1001);
+    minibson::Document doc;
+    doc.set("i", 1001);
+    [[maybe_unused]] size_t index = writer.append(doc);
+    assert(index == 1001);
+    writer.flush();
+
+    // copy of not closed file with partially written block, as after crash
+    std::ifstream      in{path, std::ios::binary};
+    std::vector<char>  bytes{std::istreambuf_iterator<char>{in}, {}};
+    std::ofstream      out{copyPath, std::ios::binary};
+    out.write(bytes.data(), bytes.size());
+    out.write("\x20\x00\x00\x00\x01\x02", 6);
+  }
+
+  {
+    microbson::BatchReader reader{path};
+    assert(reader.size() == 1002 && !reader.recovered());
+    assert(reader.at(1001).get<int32_t>("i") == 1001);
+  }
+
+  {
+    microbson::BatchReader reader{copyPath};
+    assert(reader.size() == 1002 && reader.recovered());
+    assert(reader.at(1001).get<int32_t>("i") == 1001);
+  }
+
+  // recovery truncates damaged tail
+  {
+    microbson::BatchWriter writer{copyPath,
+                                  microbson::BatchWriter::append_mode};
+    assert(writer.size() == 1002);
+    minibson::Document doc;
+    doc.set("i", 1002);
+    writer.append(doc);
+  }
+
+  {
+    microbson::BatchReader reader{copyPath};
+    assert(reader.size() == 1003 && !reader.recovered());
+    assert(reader.at(1002).get<int32_t>("i") == 1002);
+  }
+
+  // damaged block is detected by checksum
+  {
+    std::fstream file{copyPath,
+                      std::ios::binary | std::ios::in | std::ios::out};
+    file.seekp(SIZE_OF_BSON_BATCH_MAGIC + SIZE_OF_BSON_BATCH_BLOCK_HEADER + 10);
+    file.put('\x7f');
+  }
+
+  {
+    microbson::BatchReader reader{copyPath};
+    CHECK_EXCEPT(reader.at(0), bson::InvalidArgument);
+    assert(reader.at(1).get<int32_t>("i") == 1);
+  }
+
+  // damaged index footer is ignored, even if its checksum is valid
+  {
+    std::ifstream     in{path, std::ios::binary};
+    std::vector<char> bytes{std::istreambuf_iterator<char>{in}, {}};
+    char             *tail = &bytes[bytes.size() - SIZE_OF_BSON_BATCH_TAIL];
+    uint64_t          indexOffset;
+    std::memcpy(&indexOffset, tail, sizeof(uint64_t));
+    std::memcpy(bytes.data() + indexOffset, &indexOffset, sizeof(uint64_t));
+
+    for (bool validChecksum : {false, true}) {
+      if (validChecksum) {
+        uint32_t checksum = microbson::crc32c(
+            tail,
+            16,
+            microbson::crc32c(bytes.data() + indexOffset,
+                              tail - bytes.data() - indexOffset));
+        std::memcpy(tail + 16, &checksum, sizeof(uint32_t));
+      }
+      {
+        std::ofstream out{copyPath, std::ios::binary};
+        out.write(bytes.data(), bytes.size());
+      }
+
+      microbson::BatchReader reader{copyPath};
+      assert(reader.size() == 1002 && reader.recovered());
+      assert(reader.at(0).get<int32_t>("i") == 0);
+    }
+
+    microbson::BatchWriter writer{copyPath,
+                                  microbson::BatchWriter::append_mode};
+    assert(writer.size() == 1002);
+  }
+
+  {
+    std::ofstream out{copyPath, std::ios::binary};
+    out << "not a batch file";
+  }
+  CHECK_EXCEPT(microbson::BatchReader{copyPath}, bson::InvalidArgument);
+  CHECK_EXCEPT(microbson::BatchWriter(copyPath,
+                                      microbson::BatchWriter::append_mode),
+               bson::InvalidArgument);
+  CHECK_EXCEPT(microbson::BatchReader{"not_exists.bsonbatch"},
+               bson::SystemError);
+
+  std::remove(path.c_str());
+  std::remove(copyPath.c_str());
+}
+
+void index_test() {
+  const std::string path       = "index_test.bsonbatch";
+  const std::string userIndex  = "index_test.user.bsonindex";
+  const std::string scoreIndex = "index_test.score.bsonindex";
+  const std::string nameIndex  = "index_test.name.bsonindex";
+
+  {
+    microbson::BatchWriter writer{path};
+    for (int32_t i = 0; i < 500; ++i) {
+      minibson::Document doc;
+      doc.set("i", i);
+      if (i % 10 != 9) { // some documents have no field
+        minibson::Document user;
+        if (i % 2) {
+          user.set("id", int64_t(i % 7));
+        } else {
+          user.set("id", i % 7);
+        }
+        doc.set("user", std::move(user));
+      }
+      doc.set("score", i % 3 ? double(i) / 4 : i);
+      doc.set("name", "name" + std::to_string(i % 20));
+      writer.append(doc);
+    }
+  }
+
+  microbson::BatchReader batch{path};
+  using microbson::SecondaryIndex;
+  SecondaryIndex::build(
+      batch, "user.id", SecondaryIndex::int64_key, userIndex, 4);
+  SecondaryIndex::build(
+      batch, "score", SecondaryIndex::double_key, scoreIndex, 3);
+  SecondaryIndex::build(
+      batch, "name", SecondaryIndex::string_key, nameIndex, 1);
+
+  {
+    SecondaryIndex index{userIndex};
+    assert(index.type() == SecondaryIndex::int64_key);
+    assert(index.field() == "user.id");
+    assert(index.size() == 450);
+
+    std::vector<microbson::Document> found = index.find(batch, 3);
+    size_t expected = 0;
+    for (int32_t i = 0; i < 500; ++i) {
+      expected += i % 10 != 9 && i % 7 == 3;
+    }
+    assert(found.size() == expected);
+    for (size_t i = 0; i < found.size(); ++i) {
+      [[maybe_unused]] int32_t num = found[i].get<int32_t>("i");
+      assert(num % 7 == 3 && num % 10 != 9);
+      assert(i == 0 || found[i - 1].get<int32_t>("i") < num);
+    }
+
+    auto [first, last] = index.range(2, 4);
+    for (size_t i = first; i < last; ++i) {
+      [[maybe_unused]] int32_t num = batch[index.record(i)].get<int32_t>("i");
+      assert(num % 7 >= 2 && num % 7 <= 4);
+    }
+    assert(index.find(batch, 100).empty());
+    assert(index.find(batch, 4, 2).empty());
+    CHECK_EXCEPT(index.find(batch, 1.5), bson::BadCast);
+    CHECK_EXCEPT(index.find(batch, "3"), bson::BadCast);
+  }
+
+  {
+    SecondaryIndex index{scoreIndex};
+    assert(index.size() == 500);
+    std::vector<microbson::Document> found = index.find(batch, 10.0, 20.0);
+    size_t expected = 0;
+    for (int32_t i = 0; i < 500; ++i) {
+      double score = i % 3 ? double(i) / 4 : i;
+      expected += score >= 10 && score <= 20;
+    }
+    assert(found.size() == expected);
+    for (size_t i = 1; i < found.size(); ++i) {
+      assert(found[i - 1].get<bson::Scalar>("score") <=
+             found[i].get<bson::Scalar>("score"));
+    }
+    assert(index.find(batch, 12).size() == 1); // int32 value
+    assert(index.find(batch, 13).size() == 1); // double value 52 / 4
+  }
+
+  {
+    SecondaryIndex index{nameIndex};
+    assert(index.find(batch, "name7").size() == 25);
+    assert(index.find(batch, std::string{"name1"}, std::string{"name2"})
+               .size() == 12 * 25); // name1, name10 - name19, name2
+    assert(index.find(batch, "name").empty());
+  }
+
+  CHECK_EXCEPT(SecondaryIndex{path}, bson::InvalidArgument);
+
+  std::remove(path.c_str());
+  std::remove(userIndex.c_str());
+  std::remove(scoreIndex.c_str());
+  std::remove(nameIndex.c_str());
+}
+
+void heterogeneous_lookup_test() {
+  // keys are longer than small string buffer, so every copy allocates
+  const std::string key     = "key_which_is_not_in_small_string_buffer";
+  const std::string missing = "missing_key_which_is_not_in_small_buffer";
+
+  minibson::Document doc;
+  doc.set(key, 1);
+  minibson::Document nested;
+  nested.set("a", 2);
+  doc.set("nested_document_with_long_key", std::move(nested));
+
+  [[maybe_unused]] size_t before = allocations;
+  assert(doc.get<int32_t>(key) == 1);
+  assert(doc.get<int32_t>(std::string_view{key}) == 1);
+  assert(doc.get<bson::Scalar>(key.c_str()) == 1);
+  assert(doc.get<minibson::Document>("nested_document_with_long_key")
+             .get<int32_t>("a") == 2);
+  assert(doc.contains(key) && !doc.contains(std::string_view{missing}));
+  assert(doc.contains<int32_t>(key.c_str()));
+  assert(doc.contains<bson::Scalar>(key));
+  doc.erase(missing);
+  assert(allocations == before);
+
+  // only new value is allocated if the key exists
+  before = allocations;
+  doc.set(std::string_view{key}, 2);
+  assert(allocations == before + 1);
+  assert(doc.get<int32_t>(key) == 2);
+
+  // owned key is moved in the document: only value and node of the map
+  std::string owned = missing;
+  before            = allocations;
+  doc.set(std::move(owned), 3);
+  assert(allocations == before + 2);
+  assert(doc.get<int32_t>(missing) == 3);
+
+  // key by view is copied
+  before = allocations;
+  doc.set(std::string_view{"one_more_key_which_is_not_in_small_buffer"}, 4);
+  assert(allocations == before + 3);
+
+  minibson::Document extracted;
+  extracted.insert(doc.extract(std::string_view{missing}));
+  assert(!doc.contains(missing) && extracted.get<int32_t>(missing) == 3);
+  assert(doc.extract("not exists").empty());
+
+  doc.erase(std::string_view{key});
+  assert(!doc.contains(key) && doc.size() == 2);
+}
+
+void persistent_test() {
+  using minibson::PersistentDocument;
+
+  std::vector<uint8_t> serialized;
+  {
+    minibson::Document config;
+    config.set("timeout", 10);
+    config.set("retries", int64_t(3));
+    minibson::Array hosts;
+    hosts.push_back("a");
+    hosts.push_back("b");
+
+    minibson::Document doc;
+    doc.set("name", std::string(40, 'n'));
+    doc.set("config", std::move(config));
+    doc.set("hosts", std::move(hosts));
+    doc.set("ratio", 0.5);
+    doc.set("none");
+    serialized = doc.serialize();
+  }
+
+  const PersistentDocument v1{serialized.data(), int(serialized.size())};
+  assert(v1.size() == 5);
+  assert(v1.serialize() == serialized);
+  assert(v1.getSerializedSize() == int(serialized.size()));
+  assert(v1.get<PersistentDocument>("config").get<int32_t>("timeout") == 10);
+  assert(v1.get<bson::Scalar>("ratio") == 0.5);
+  assert(v1.get<minibson::Array>("hosts").size() == 2);
+  assert(v1.contains<void>("none") && v1.contains<bson::Scalar>("ratio"));
+  assert(!v1.contains("missing") && !v1.contains<int32_t>("name"));
+  CHECK_EXCEPT(v1.get<int32_t>("name"), bson::BadCast);
+  // nested documents are not minibson::Document
+  CHECK_EXCEPT(v1.get<minibson::Document>("config"), bson::BadCast);
+  assert(!v1.contains<minibson::Document>("config"));
+  assert(v1.contains<PersistentDocument>("config"));
+  CHECK_EXCEPT(v1.get<int32_t>("missing"), bson::OutOfRange);
+
+  // update of nested value makes new version, original is not changed
+  const PersistentDocument v2 = v1.set(
+      "config", v1.get<PersistentDocument>("config").set("timeout", 30));
+  assert(v1.get<PersistentDocument>("config").get<int32_t>("timeout") == 10);
+  assert(v2.get<PersistentDocument>("config").get<int32_t>("timeout") == 30);
+  assert(v2.get<PersistentDocument>("config").get<int64_t>("retries") == 3);
+  // not changed values are shared
+  assert(&v1.get<std::string>("name") == &v2.get<std::string>("name"));
+  assert(v1.serialize() == serialized);
+  std::vector<uint8_t> v2Serialized = v2.serialize();
+  minibson::Document   v2Parsed{v2Serialized.data(), int(v2Serialized.size())};
+  assert(v2Parsed.get<minibson::Document>("config").get<int32_t>("timeout") ==
+         30);
+
+  const PersistentDocument v3 = v2.erase("name").set("added", "value");
+  assert(v2.contains("name") && !v3.contains("name"));
+  assert(std::string{v3.get<const char *>("added")} == "value");
+  assert(v3.erase("missing").sameVersion(v3));
+  assert(v3.getSerializedSize() == int(v3.serialize().size()));
+
+  minibson::Document nested;
+  nested.set("x", 1);
+  const PersistentDocument v4 =
+      v3.set(std::string{"nested"}, std::move(nested));
+  assert(v4.get<PersistentDocument>("nested").get<int32_t>("x") == 1);
+
+  // snapshot is read by other thread while new versions are created
+  PersistentDocument snapshot = v4;
+  std::thread        reader{[snapshot]() {
+    for (int i = 0; i < 100; ++i) {
+      assert(snapshot.get<PersistentDocument>("config").get<int32_t>(
+                 "timeout") == 30);
+    }
+  }};
+
+  PersistentDocument big;
+  for (int i = 0; i < 1000; ++i) {
+    big = big.set(std::to_string(i * 7919 % 1000), i);
+  }
+  PersistentDocument half = big;
+  for (int i = 0; i < 1000; i += 2) {
+    half = half.erase(std::to_string(i));
+  }
+  reader.join();
+
+  assert(big.size() == 1000 && half.size() == 500);
+  for (int i = 0; i < 1000; ++i) {
+    assert(big.contains(std::to_string(i)));
+    assert(half.contains(std::to_string(i)) == (i % 2 == 1));
+  }
+
+  std::vector<uint8_t> halfSerialized = half.serialize();
+  minibson::Document   parsed{halfSerialized.data(),
+                            int(halfSerialized.size())};
+  assert(parsed.size() == 500);
+  assert(parsed.serialize() == halfSerialized);
+  assert(PersistentDocument{std::move(parsed)}.serialize() == halfSerialized);
+}
+
+void rcu_test() {
+  auto makeDocument = [](int32_t version) {
+    minibson::Document doc;
+    doc.set("version", version);
+    doc.set("route", "host" + std::to_string(version));
+    return doc;
+  };
+
+  {
+    std::vector<uint8_t> buffer = makeDocument(1).serialize();
+    microbson::OwnedDocument owned{buffer.data(), int(buffer.size())};
+    buffer.clear();
+    assert(owned.view().get<int32_t>("version") == 1);
+    CHECK_EXCEPT(microbson::OwnedDocument(std::vector<uint8_t>{1, 2, 3}),
+                 bson::InvalidArgument);
+  }
+
+  {
+    bson::RcuHolder<minibson::Document> holder;
+    assert(!holder.read());
+
+    holder.publish(makeDocument(1));
+    auto first = holder.read();
+    assert(first->get<int32_t>("version") == 1);
+
+    // snapshot keeps previous version alive
+    holder.publish(makeDocument(2));
+    {
+      auto nested = holder.read(); // nested pin of same thread
+      assert(nested->get<int32_t>("version") == 2);
+    }
+    holder.reclaim();
+    assert(holder.retired() == 1);
+    assert(first->get<std::string>("route") == "host1");
+
+    bson::RcuHolder<minibson::Document>::Snapshot moved = std::move(first);
+    assert(moved->get<int32_t>("version") == 1);
+  }
+
+  // concurrent readers and writer
+  bson::RcuHolder<microbson::OwnedDocument> holder{
+      microbson::OwnedDocument{makeDocument(0).serialize()}};
+  std::atomic<bool>        stop{false};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&holder, &stop]() {
+      [[maybe_unused]] int32_t last = 0;
+      while (!stop.load()) {
+        auto                snapshot = holder.read();
+        microbson::Document doc      = snapshot->view();
+        int32_t             version  = doc.get<int32_t>("version");
+        assert(version >= last);
+        assert(doc.get<std::string_view>("route") ==
+               "host" + std::to_string(version));
+        last = version;
+      }
+    });
+  }
+
+  for (int32_t version = 1; version <= 200; ++version) {
+    holder.publish(microbson::OwnedDocument{makeDocument(version).serialize()});
+  }
+  stop.store(true);
+  for (std::thread &reader : readers) {
+    reader.join();
+  }
+
+  holder.reclaim();
+  assert(holder.retired() == 0);
+  assert(holder.read()->view().get<int32_t>("version") == 200);
+}
+
+void lazy_test() {
+  std::vector<uint8_t> serialized;
+  {
+    minibson::Document limits;
+    limits.set("rps", 100);
+    minibson::Document config;
+    config.set("timeout", 10);
+    config.set("limits", std::move(limits));
+    minibson::Array hosts;
+    for (int i = 0; i < 3; ++i) {
+      minibson::Document host;
+      host.set("name", "host" + std::to_string(i));
+      hosts.push_back(std::move(host));
+    }
+
+    minibson::Document doc;
+    doc.set("config", std::move(config));
+    doc.set("hosts", std::move(hosts));
+    doc.set("version", 1);
+    serialized = doc.serialize();
+  }
+
+  // only first level is deserialized
+  bson::Statistics::reset();
+  minibson::Document doc{
+      serialized.data(), int(serialized.size()), minibson::lazy};
+  assert(bson::Statistics::snapshot().nodesAllocated == counted(3));
+  assert(doc.size() == 3);
+  assert(doc.getSerializedSize() == int(serialized.size()));
+  assert(doc.serialize() == serialized);
+
+  // untouched nested values are copied by blocks
+  bson::Statistics::reset();
+  assert(doc.serialize() == serialized);
+  assert(bson::Statistics::snapshot().serializedBytes ==
+         counted(serialized.size()));
+
+  // access expands only requested level
+  const minibson::Document &constDoc = doc;
+  bson::Statistics::reset();
+  assert(constDoc.get<minibson::Document>("config").get<int32_t>("timeout") ==
+         10);
+  assert(bson::Statistics::snapshot().nodesAllocated == counted(3));
+  assert(constDoc.contains<minibson::Document>("config"));
+  assert(doc.serialize() == serialized);
+
+  const minibson::Array &hosts = constDoc.get<minibson::Array>("hosts");
+  assert(hosts.size() == 3);
+  assert(hosts.at<minibson::Document>(2).get<std::string>("name") == "host2");
+  int count = 0;
+  for (auto iter = hosts.begin(); iter != hosts.end(); ++iter) {
+    assert(iter.value<minibson::Document>().contains<std::string>("name"));
+    ++count;
+  }
+  assert(count == 3);
+  CHECK_EXCEPT(doc.get<minibson::Array>("config"), bson::BadCast);
+
+  // mutation of expanded values
+  doc.get<minibson::Document>("config")
+      .get<minibson::Document>("limits")
+      .set("rps", 200);
+  minibson::Document eager{serialized.data(), int(serialized.size())};
+  eager.get<minibson::Document>("config")
+      .get<minibson::Document>("limits")
+      .set("rps", 200);
+  assert(doc.serialize() == eager.serialize());
+
+  // expanded tree not depends on source buffer
+  std::vector<uint8_t> copy = serialized;
+  minibson::Document   other{copy.data(), int(copy.size()), minibson::lazy};
+  other.expand();
+  copy.assign(copy.size(), 0);
+  assert(other.get<minibson::Array>("hosts")
+             .at<minibson::Document>(1)
+             .get<std::string>("name") == "host1");
+  assert(other.serialize() == serialized);
+
+  // persistent document expands lazy values
+  minibson::Document lazyDoc{
+      serialized.data(), int(serialized.size()), minibson::lazy};
+  minibson::PersistentDocument persistent{std::move(lazyDoc)};
+  assert(persistent.serialize() == serialized);
+
+  std::vector<uint8_t> hostsSource = serialized;
+  minibson::Array      lazyHosts{
+      microbson::Document{hostsSource.data(), int(hostsSource.size())}
+          .get<microbson::Array>("hosts"),
+      minibson::lazy};
+  minibson::PersistentDocument withHosts =
+      minibson::PersistentDocument{}.set("hosts", std::move(lazyHosts));
+  hostsSource.assign(hostsSource.size(), 0);
+  assert(withHosts.get<minibson::Array>("hosts")
+             .at<minibson::Document>(1)
+             .get<std::string>("name") == "host1");
+
+  // published documents are shared between threads, so they are expanded
+  {
+    std::vector<uint8_t> first  = serialized;
+    std::vector<uint8_t> second = serialized;
+    bson::RcuHolder<minibson::Document> holder{
+        minibson::Document{first.data(), int(first.size()), minibson::lazy}};
+    auto snapshot = holder.read();
+    holder.publish(
+        minibson::Document{second.data(), int(second.size()), minibson::lazy});
+    first.assign(first.size(), 0);
+    second.assign(second.size(), 0);
+    assert(snapshot->serialize() == serialized);
+    assert(holder.read()->serialize() == serialized);
+  }
+
+  // whole document is validated on construction
+  auto rps = std::search(serialized.begin(),
+                         serialized.end(),
+                         std::begin("rps"),
+                         std::end("rps"));
+  assert(rps != serialized.end());
+  *(rps - 1) = 0x7f; // unknown type of nested node
+  CHECK_EXCEPT((minibson::Document{serialized.data(), int(serialized.size()),
+                                   minibson::lazy}),
+               bson::InvalidArgument);
+}
+
+void overlay_test() {
+  std::vector<uint8_t> serialized;
+  {
+    minibson::Document user;
+    user.set("name", "alice");
+    user.set("age", 30);
+    minibson::Array tags;
+    tags.push_back("a");
+    tags.push_back("b");
+
+    minibson::Document doc;
+    doc.set("user", std::move(user));
+    doc.set("tags", std::move(tags));
+    doc.set("payload", std::string(1000, 'p'));
+    doc.set("ratio", 0.5);
+    serialized = doc.serialize();
+  }
+  microbson::Document source{serialized.data(), int(serialized.size())};
+
+  microbson::OverlayDocument overlay{source};
+  assert(!overlay.edited());
+  assert(overlay.serialize() == serialized);
+  assert(overlay.get<std::string_view>("user.name") == "alice");
+  assert(overlay.get<std::string_view>("tags.1") == "b");
+  assert(overlay.get<bson::Scalar>("ratio") == 0.5);
+  assert(overlay.contains<microbson::Document>("user"));
+  assert(!overlay.contains("user.email"));
+  CHECK_EXCEPT(overlay.get<int32_t>("user.name"), bson::BadCast);
+  CHECK_EXCEPT(overlay.get<int32_t>("missing"), bson::OutOfRange);
+
+  overlay.set("user.age", 31)
+      .set("user.email", "alice@example.com")
+      .erase("ratio")
+      .set("meta.version", int64_t{2});
+  assert(overlay.edited());
+  assert(overlay.get<int32_t>("user.age") == 31);
+  assert(overlay.get<std::string_view>("user.email") == "alice@example.com");
+  assert(overlay.get<std::string_view>("user.name") == "alice");
+  assert(!overlay.contains("ratio"));
+  assert(overlay.contains<microbson::Document>("meta"));
+  assert(overlay.get<int64_t>("meta.version") == 2);
+  CHECK_EXCEPT(overlay.get<microbson::Document>("user"), bson::InvalidArgument);
+  // set after erase of parent conflicts
+  CHECK_EXCEPT(overlay.set("ratio.x", 1), bson::InvalidArgument);
+
+  // set of document overwrites nested edits, and it is readable by paths
+  minibson::Document limits;
+  limits.set("rps", 100);
+  overlay.set("limits.burst", 1);
+  overlay.set("limits", bson::document_node, limits.serialize());
+  assert(overlay.get<int32_t>("limits.rps") == 100);
+  assert(overlay.get<microbson::Document>("limits").size() == 1);
+  assert(!overlay.contains("limits.burst"));
+  CHECK_EXCEPT(overlay.set("limits.rps", 1), bson::InvalidArgument);
+  overlay.erase("limits");
+  assert(!overlay.contains("limits") && !overlay.contains("limits.rps"));
+  overlay.set("user.age", 32);
+
+  std::vector<uint8_t> merged = overlay.serialize();
+  minibson::Document   expected{serialized.data(), int(serialized.size())};
+  expected.get<minibson::Document>("user").set("age", 32);
+  expected.get<minibson::Document>("user").set("email", "alice@example.com");
+  expected.erase("ratio");
+  minibson::Document meta;
+  meta.set("version", int64_t{2});
+  expected.set("meta", std::move(meta));
+
+  minibson::Document result{merged.data(), int(merged.size())};
+  assert(result.serialize() == expected.serialize());
+  assert(overlay.patch().operations().size() == 8);
+}
+
+void try_get_test() {
+  minibson::Document nested;
+  nested.set("x", 1);
+  minibson::Array array;
+  array.push_back(10);
+  array.push_back("text");
+
+  minibson::Document doc;
+  doc.set("int32", 1);
+  doc.set("int64", int64_t{2});
+  doc.set("string", "some long string value, which not fits in sso buffer");
+  doc.set("nested", std::move(nested));
+  doc.set("array", std::move(array));
+  std::vector<uint8_t> serialized = doc.serialize();
+
+  [[maybe_unused]] size_t before = allocations;
+
+  // minibson
+  {
+    [[maybe_unused]] auto string = doc.try_get<std::string>("string");
+    assert(string && string.error() == bson::Error::none);
+    assert(&string.value() == &doc.get<std::string>("string"));
+    assert(doc.try_get<int32_t>("int32").value() == 1);
+    assert(doc.try_get<bson::Scalar>("int64").value() == 2);
+    assert(doc.try_get<minibson::Document>("nested")->size() == 1);
+
+    [[maybe_unused]] auto missing = doc.try_get<int32_t>("missing");
+    assert(!missing && missing.error() == bson::Error::out_of_range);
+    assert(missing.value_or(7) == 7);
+    assert(doc.try_get<int32_t>("string").error() == bson::Error::bad_cast);
+    assert(doc.try_get<bson::Scalar>("string").error() ==
+           bson::Error::bad_cast);
+
+    [[maybe_unused]] const minibson::Array &arr =
+        doc.get<minibson::Array>("array");
+    assert(arr.try_at<int32_t>(0).value() == 10);
+    assert(arr.try_at<int32_t>(1).error() == bson::Error::bad_cast);
+    assert(arr.try_at<int32_t>(2).error() == bson::Error::out_of_range);
+    assert(arr.try_at<int32_t>(-1).error() == bson::Error::out_of_range);
+  }
+
+  // microbson
+  {
+    microbson::Document view{serialized.data(), int(serialized.size())};
+    assert(view.try_get<int64_t>("int64").value() == 2);
+    assert(view.try_get<std::string_view>("string")->size() == 52);
+    assert(view.try_get<bson::Scalar>("int32").value() == 1);
+    assert(view.try_get<int32_t>("missing").error() ==
+           bson::Error::out_of_range);
+    assert(view.try_get<int32_t>("nested").error() == bson::Error::bad_cast);
+    assert(view.try_get<microbson::Document>("nested")
+               .value()
+               .get<int32_t>("x") == 1);
+
+    microbson::Array arr = view.get<microbson::Array>("array");
+    assert(arr.try_at<std::string_view>(1).value() == "text");
+    assert(arr.try_at<std::string_view>(0).error() == bson::Error::bad_cast);
+    assert(arr.try_at<int32_t>(5).error() == bson::Error::out_of_range);
+  }
+
+  // failures not allocate memory
+  assert(allocations == before);
+
+  // lazy values of other type are not expanded
+  minibson::Document lazy{
+      serialized.data(), int(serialized.size()), minibson::lazy};
+  before = allocations;
+  assert(lazy.try_get<minibson::Array>("nested").error() ==
+         bson::Error::bad_cast);
+  assert(lazy.try_get<minibson::Document>("array").error() ==
+         bson::Error::bad_cast);
+  assert(!lazy.contains<minibson::Array>("nested"));
+  assert(allocations == before);
+  assert(lazy.serialize() == serialized);
+  assert(lazy.try_get<minibson::Document>("nested")->get<int32_t>("x") == 1);
+
+  // not throwing deserialization
+  bson::Error        error = bson::Error::bad_cast;
+  minibson::Document parsed{serialized.data(), int(serialized.size()), error};
+  assert(error == bson::Error::none);
+  assert(parsed.serialize() == serialized);
+
+  serialized.back() = 1;
+  before = allocations;
+  minibson::Document invalid{serialized.data(), int(serialized.size()), error};
+  assert(error == bson::Error::invalid_argument);
+  assert(invalid.empty());
+  minibson::Array invalidArray{
+      serialized.data(), int(serialized.size()), error};
+  assert(error == bson::Error::invalid_argument);
+  assert(allocations == before);
+}
+
+void shape_test() {
+  using minibson::Shape;
+  using minibson::ShapedDocument;
+
+  std::vector<uint8_t> serialized;
+  {
+    minibson::Document nested;
+    nested.set("x", 1);
+
+    minibson::Document doc;
+    doc.set("id", 1);
+    doc.set("name", "first");
+    doc.set("ratio", 0.5);
+    doc.set("nested", std::move(nested));
+    serialized = doc.serialize();
+  }
+
+  // documents with same keys share the shape
+  std::vector<ShapedDocument> docs;
+  for (int i = 0; i < 10; ++i) {
+    docs.emplace_back(serialized.data(), int(serialized.size()));
+  }
+  Shape::pointer shape = docs.front().shape();
+  assert(shape->size() == 4);
+  for ([[maybe_unused]] const ShapedDocument &doc : docs) {
+    assert(doc.shape() == shape);
+    assert(doc.serialize() == serialized);
+    assert(doc.getSerializedSize() == int(serialized.size()));
+  }
+
+  ShapedDocument &doc = docs.front();
+  assert(doc.size() == 4 && !doc.empty());
+  assert(doc.get<int32_t>("id") == 1);
+  assert(doc.get<std::string>("name") == "first");
+  assert(doc.get<bson::Scalar>("ratio") == 0.5);
+  assert(doc.get<minibson::Document>("nested").get<int32_t>("x") == 1);
+  assert(doc.contains("name") && doc.contains<std::string>("name"));
+  assert(!doc.contains("missing") && !doc.contains<int32_t>("name"));
+  assert(doc.try_get<int32_t>("missing").error() == bson::Error::out_of_range);
+  CHECK_EXCEPT(doc.get<int32_t>("missing"), bson::OutOfRange);
+  CHECK_EXCEPT(doc.get<int32_t>("name"), bson::BadCast);
+
+  // access by slot
+  [[maybe_unused]] size_t slot = shape->slot("id");
+  assert(slot != Shape::npos && shape->key(slot) == "id");
+  assert(shape->slot("missing") == Shape::npos);
+  for ([[maybe_unused]] const ShapedDocument &other : docs) {
+    assert(other.at<int32_t>(slot) == 1);
+  }
+
+  // replace of existing value not changes shape
+  doc.set("id", 2);
+  assert(doc.shape() == shape && doc.get<int32_t>("id") == 2);
+
+  // transitions are cached
+  docs[1].set("extra", true);
+  docs[2].set("extra", false);
+  assert(docs[1].shape() != shape);
+  assert(docs[1].shape() == docs[2].shape());
+  assert(docs[1].shape()->size() == 5);
+  assert(docs[1].get<bool>("extra"));
+
+  docs[1].erase("ratio").erase("missing");
+  docs[2].erase("ratio");
+  assert(docs[1].shape() == docs[2].shape());
+  assert(!docs[1].contains("ratio") && docs[1].size() == 4);
+  assert(docs[1].get<std::string>("name") == "first");
+
+  // removing gives same shape as adding of rest keys
+  {
+    ShapedDocument added;
+    added.set("id", 1).set("name", "").set("nested").set("extra", true);
+    assert(added.shape() == docs[1].shape());
+    ShapedDocument single;
+    single.set("id", 1);
+    ShapedDocument erased;
+    erased.set("name", "").set("id", 2).erase("name");
+    assert(erased.shape() == single.shape());
+  }
+
+  // serialized same as document
+  minibson::Document expected{serialized.data(), int(serialized.size())};
+  expected.set("extra", true);
+  expected.erase("ratio");
+  assert(docs[1].serialize() == expected.serialize());
+
+  ShapedDocument created;
+  created.set("b", "text").set("a", int64_t{3}).set("c");
+  minibson::Document createdExpected;
+  createdExpected.set("b", "text").set("a", int64_t{3}).set("c");
+  assert(created.serialize() == createdExpected.serialize());
+
+  // not used shapes are deleted
+  std::weak_ptr<const Shape> removed = docs[1].shape();
+  docs.erase(docs.begin() + 1, docs.begin() + 3);
+  assert(removed.expired());
+  docs[1].set("extra", 1);
+  assert(docs[1].shape()->size() == 5);
+
+  // transitions to deleted shapes are pruned
+  for (int i = 0; i < 1000; ++i) {
+    ShapedDocument temporary;
+    temporary.set("key" + std::to_string(i), i);
+  }
+  assert(Shape::empty()->transitions() < 64);
+
+  // shapes can be shared between threads
+  std::vector<std::thread> threads;
+  std::vector<Shape::pointer> shapes(4);
+  for (size_t i = 0; i < shapes.size(); ++i) {
+    threads.emplace_back([&serialized, &shapes, i]() {
+      for (int j = 0; j < 100; ++j) {
+        ShapedDocument local{serialized.data(), int(serialized.size())};
+        local.set("thread", int(i));
+        shapes[i] = local.shape();
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  for ([[maybe_unused]] const Shape::pointer &other : shapes) {
+    assert(other->size() == 5 && other->slot("thread") == 4);
+  }
+}